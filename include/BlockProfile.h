@@ -0,0 +1,53 @@
+/////////////////////////////////////////
+//BlockProfile.h                       //
+/////////////////////////////////////////
+//Block execution counts of a function //
+//from its !prof branch weights.       //
+//Class is implemented in BlockProfile.cpp//
+////////////////////////////////////////////
+
+#ifndef BLOCKPROFILE_H
+#define BLOCKPROFILE_H
+
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Analysis/BlockFrequencyInfo.h>
+
+using namespace llvm;
+
+namespace llvm {
+
+   ////////////////////////////////////
+   // Class BlockProfile             //
+   ////////////////////////////////////
+   //Both -sample-profile and clang -fprofile-instr-use leave their counts
+   //as branch_weights on terminators; BlockFrequencyInfo already follows
+   //them. BlockProfile turns its relative frequencies back into counts,
+   //scaled on the block whose terminator carries the largest weights.
+   class BlockProfile {
+      public:
+         BlockProfile(Function &F, BlockFrequencyInfo &BFI);
+
+         //sum of the branch weights of T, 0 if it has none
+         static uint64_t branchWeightSum(TerminatorInst *T);
+         //does any terminator of F carry branch weights?
+         static bool hasProfile(Function &F);
+         //largest branch weight sum in F, 0 without profile
+         static uint64_t functionHotness(Function &F);
+
+         bool valid() {return refFreq != 0;}
+         uint64_t count(BasicBlock *BB);
+         uint64_t entryCount() {return count(&MyF->getEntryBlock());}
+
+      private:
+         Function *MyF;
+         BlockFrequencyInfo *MyBFI;
+         uint64_t refCount; //measured count of the reference block
+         uint64_t refFreq;  //its frequency in MyBFI
+   }; //end of BlockProfile
+
+}//end of namespace
+
+#endif //BLOCKPROFILE_H
+
+// vim: ts=3 sts=3 sw=3 et
@@ -0,0 +1,55 @@
+/////////////////////////////////////////
+//CallClassify.h                       //
+/////////////////////////////////////////
+//Classify call instructions for duplication.//
+//Class is implemented in CallClassify.cpp   //
+///////////////////////////////////////////////
+
+#ifndef CALLCLASSIFY_H
+#define CALLCLASSIFY_H
+
+#include <llvm/IR/Instruction.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Function.h>
+#include <llvm/ADT/StringRef.h>
+
+using namespace llvm;
+
+namespace llvm {
+
+   //How a call is treated by InsDuplica and RedundAnalysis.
+   enum CALLKIND {
+      CALL_IGNORE,    //no effect on program state: not checked, not duplicated
+      CALL_DUPLICATE, //pure: duplicated like an ordinary instruction
+      CALL_SHARE,     //pure but not duplicable: arguments checked, result shared
+      CALL_SHADOW,    //call to a shadow clone: synch point, duplicates passed along
+      CALL_SYNCH      //synch point: operands are checked before the call
+   };
+
+   ////////////////////////////////////
+   // Class CallClassify             //
+   ////////////////////////////////////
+   //Intrinsics and known library functions are looked up in a table
+   //by name. Anything not in the table is classified from its
+   //attributes: readnone and readonly calls are duplicated (or share
+   //their result if marked noduplicate), the rest synchronise.
+   class CallClassify {
+      public:
+         static enum CALLKIND classify(CallInst *CI);
+
+         //shortcuts. Return false if I is not a call.
+         static bool isSynchCall(Instruction *I);
+         static bool isIgnoredCall(Instruction *I);
+         static bool isDuplicableCall(Instruction *I);
+         static bool isSharedCall(Instruction *I);
+         static bool isShadowCall(Instruction *I);
+
+      private:
+         static bool lookupTable(StringRef name, enum CALLKIND &kind);
+   }; //end of CallClassify
+
+}//end of namespace
+
+#endif //CALLCLASSIFY_H
+
+// vim: ts=3 sts=3 sw=3 et
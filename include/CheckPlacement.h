@@ -0,0 +1,74 @@
+/////////////////////////////////////////
+//CheckPlacement.h                     //
+/////////////////////////////////////////
+//Min-cut placement of the checks of   //
+//one value over the CFG.              //
+//Used by RedundAnalysis::placeChecks()//
+//Classes are implemented in CheckPlacement.cpp//
+/////////////////////////////////////////////////
+
+#ifndef CHECKPLACEMENT_H
+#define CHECKPLACEMENT_H
+
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Instruction.h>
+#include <llvm/Support/DataTypes.h>
+
+#include <list>
+#include <map>
+#include <utility>
+#include <vector>
+
+using namespace llvm;
+
+namespace llvm {
+
+   ////////////////////////////////////
+   // Class FlowGraph                //
+   ////////////////////////////////////
+   //Directed graph with edge capacities. maxFlow() is Edmonds-Karp; after
+   //it, sourceSide() is the smallest source side of a minimum cut.
+   class FlowGraph {
+      public:
+         static const uint64_t INF = 1ULL << 62;
+
+         unsigned int addNode();
+         void addEdge(unsigned int from, unsigned int to, uint64_t cap);
+         unsigned int size() {return adj.size();}
+
+         uint64_t maxFlow(unsigned int s, unsigned int t);
+         bool sourceSide(unsigned int n) {return reached[n];}
+
+      private:
+         struct Edge {
+            unsigned int to;
+            uint64_t cap;     //residual
+            unsigned int rev; //index of the reverse edge in adj[to]
+         };
+         std::vector<std::vector<Edge> > adj;
+         std::vector<char> reached;
+   }; //end of FlowGraph
+
+   ////////////////////////////////////
+   // Struct PlaceRegion             //
+   ////////////////////////////////////
+   //Flow network of one checked value v. A unit of flow is a fault in v
+   //that went unchecked: it starts at every movable check site, passes
+   //through the code and must be stopped before it reaches a synch point
+   //or a redefinition of v (the sink). It is stopped by the check at a
+   //site (its block's frequency), a check on a CFG edge (the edge's
+   //frequency) or any fixed check on v.
+   struct PlaceRegion {
+      FlowGraph graph;
+      unsigned int source, sink;
+      std::map<Instruction*, std::pair<unsigned int, unsigned int> > sites; //before, after the check
+      std::map<BasicBlock*, unsigned int> entry; //top of the block
+      std::map<BasicBlock*, unsigned int> exit;  //its branch, before the edges
+      std::list<std::pair<unsigned int, Instruction*> > toWalk; //node, first instruction after it
+   }; //end of PlaceRegion
+
+}//end of namespace
+
+#endif //CHECKPLACEMENT_H
+
+// vim: ts=3 sts=3 sw=3 et
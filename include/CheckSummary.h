@@ -0,0 +1,76 @@
+/////////////////////////////////////////
+//CheckSummary.h                       //
+/////////////////////////////////////////
+//Bottom-up per-function parameter summaries//
+//used to drop caller-side argument checks. //
+//Class is implemented in CheckSummary.cpp  //
+///////////////////////////////////////////////
+
+#ifndef CHECKSUMMARY_H
+#define CHECKSUMMARY_H
+
+#include <llvm/Pass.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+
+#include <map>
+#include <set>
+#include <list>
+#include <vector>
+
+using namespace llvm;
+
+namespace llvm {
+
+   //bits of a parameter summary
+   enum PARAMSUMMARY {
+      PARAM_OBSERVED  = 0,
+      PARAM_UNUSED    = 1, //never reaches a sink, also through callees
+      PARAM_CHECKED   = 2, //checked on entry, before any synch point
+      PARAM_FORWARDED = 4  //passed straight to a callee parameter that is checked
+   };
+
+   ////////////////////////////////////
+   // Class CheckSummary             //
+   ////////////////////////////////////
+   //Functions are visited in post order of the direct call graph, so a
+   //callee is summarised before its callers. Functions on a call cycle see
+   //no summary for the members still in progress and stay conservative.
+   //
+   //Only PARAM_UNUSED lets RedundAnalysis drop a caller-side check. A plain
+   //callee checks its parameter against a copy made on entry, which cannot
+   //catch a fault in the caller's computation; PARAM_CHECKED and
+   //PARAM_FORWARDED are reported for that reason only, the duplicate reaches
+   //the callee through -ShadowCC instead.
+   class CheckSummary : public ModulePass {
+      public:
+         static char ID;
+         CheckSummary():ModulePass(ID){}
+         void getAnalysisUsage(AnalysisUsage &AU) const {
+            AU.setPreservesAll();
+         }
+         bool runOnModule(Module &M);
+         void releaseMemory();
+
+         //summary bits of parameter argNo of F, PARAM_OBSERVED if unknown
+         unsigned getParamSummary(Function *F, unsigned argNo);
+         //Can the caller skip its check of argument argNo at CI?
+         bool canSkipArgCheck(CallInst *CI, unsigned argNo);
+
+      private:
+         std::map<Function*, std::vector<unsigned char> > summaryMap;
+
+         void postOrder(Function *F, std::set<Function*> &visited, std::list<Function*> &order);
+         void summarize(Function *F);
+         bool isUnused(Argument *arg);
+         bool isDeadSlot(Value *ptr);
+         unsigned checkedOnEntry(Argument *arg);
+         void dumpSummary(Function *F);
+   }; //end of CheckSummary
+
+}//end of namespace
+
+#endif //CHECKSUMMARY_H
+
+// vim: ts=3 sts=3 sw=3 et
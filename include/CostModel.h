@@ -0,0 +1,89 @@
+/////////////////////////////////////////
+//CostModel.h                          //
+/////////////////////////////////////////
+//Static cost of duplication and checks//
+//and their selection under a budget.  //
+//Class is implemented in CostModel.cpp//
+/////////////////////////////////////////
+
+#ifndef COSTMODEL_H
+#define COSTMODEL_H
+
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Analysis/BlockFrequencyInfo.h>
+
+#include <map>
+#include <set>
+#include <vector>
+
+#include "RedundOPT.h"
+
+using namespace llvm;
+
+namespace llvm {
+
+   ////////////////////////////////////
+   // Class CostModel                //
+   ////////////////////////////////////
+   //Cost is frequency (BlockFrequencyInfo) x latency of what InsDup adds.
+   //Each check, and each conditional branch duplicated by DuplicaBr, is a
+   //candidate protecting the backward slice of the values it compares;
+   //its benefit is the weight of the sink (store address, branch, call,
+   //...) times the executed instructions of the part of that slice not
+   //protected yet. Candidates are taken greedily by benefit per cost
+   //until the extra cost reaches budget% of the cost of F.
+   //
+   //Checks left out are dropped from CheckCodeMap, branches left out are
+   //not duplicated, and instructions in no selected slice are not
+   //duplicated either (their duplicate is the original, like a safe reg).
+   class CostModel {
+      public:
+         CostModel(Function &F, BlockFrequencyInfo &BFI);
+
+         void select(CheckCodeMap *checkCodeMap, unsigned int budget);
+         bool isProtected(Instruction *I) {return protectedSet.count(I) > 0;}
+         bool isBranchDropped(BranchInst *BI) {return droppedBr.count(BI) > 0;}
+         void noteUnprotected() {localnumbudgetunprot++;}
+         void printStat(Function &F);
+
+         static unsigned int latency(Instruction *I);
+
+      private:
+         struct Candidate {
+            Instruction *sink;
+            std::vector<Value*> elems;
+            std::set<Instruction*> slice;
+            uint64_t checkCost;
+            unsigned int weight;
+            bool mandatory;
+         };
+
+         Function *MyF;
+         BlockFrequencyInfo *MyBFI;
+         uint64_t baseCost;
+         uint64_t extraCost;
+         uint64_t dropCost;
+         std::vector<Candidate> candidates;
+         std::set<Instruction*> protectedSet;
+         std::set<BranchInst*> droppedBr;
+
+         int localnumbudgetcand;
+         int localnumbudgetdrop;
+         int localnumbudgetunprot;
+
+         uint64_t freq(BasicBlock *BB);
+         uint64_t cost(Instruction *I) {return freq(I->getParent()) * latency(I);}
+         void addCheckCandidates(CheckCodeMap *checkCodeMap);
+         void addBranchCandidates(CheckCodeMap *checkCodeMap);
+         void computeSlice(Value *v, std::set<Instruction*> &slice);
+         uint64_t marginalCost(Candidate &c);
+         uint64_t marginalBenefit(Candidate &c);
+         void accept(Candidate &c);
+   }; //end of CostModel
+
+}//end of namespace
+
+#endif //COSTMODEL_H
+
+// vim: ts=3 sts=3 sw=3 et
@@ -4,13 +4,16 @@
 //Duplicate all instructions, give special //
 //care to nested ifs                       //
 //=========================================//
+//Classes are implemented in IFDuplica.cpp
 
 #ifndef IFDUPLICA_H
 #define IFDUPLICA_H
 
-#include "ShortcutConstruct.h"
+#include "ShortcutDetector.h"
 #include "InsDuplica.h"
 
+#include <vector>
+
 #undef Jing_DEBUG1 
 //#define Jing_DEBUG1
 
@@ -18,45 +21,53 @@ using namespace llvm;
 
 namespace llvm {
     
+    //-InsDup plus the replicas of the ShortcutDetectorPass head sets, one
+    //error block and one valueMap. The branches of a set get no checker
+    //blocks (specialDupBB()); once everything is duplicated, each Rep on
+    //an edge of the set becomes a block that branches on the duplicated
+    //condition of its base block, to the next block or to the error block.
     class IfDuplica :public InsDuplica {
     public:
-	virtual void getAnalysisUsage (AnalysisUsage &AU) const {
-	    AU.addRequired<DominatorSet>();
-	}
-	virtual bool runOnFunction(Function &F);
+	virtual void getAnalysisUsage (AnalysisUsage &AU) const;
 
     protected:
-	void DuplicaAllBB(Function &F, std::list<ChildrenSet*> *HeadNodeList);
-	void DupOnIFs(std::list<ChildrenSet*> *); 
-	bool inEdgesMarked(ChildrenSet*node, std::set<Edge*>&MarkedEdge);
+	IfDuplica(char &pid, ShortcutDetectorPass::RepMode mode):InsDuplica(pid),repMode(mode){}
+	virtual void DuplicaAllBB(Function &F);
 
-	virtual void IFDupforNode(ChildrenSet*){}; //do not implement
-	
-	void markMidNodes(std::set<BasicBlock*>&, std::set<ChildrenSet*>*);
-	ChildrenSet* OneofPattern(BasicBlock *, std::list<ChildrenSet*> *);
+    private:
+	//a replica: its base block, its side, and the block it goes on to
+	typedef std::pair<std::pair<BasicBlock*, bool>, BasicBlock*> ReplicaKey;
+	typedef std::map<ReplicaKey, BasicBlock*> ReplicaMap;
 
-	void specialDupBB(BasicBlock *, ChildrenSet*);
-	Instruction *findPosin(ChildrenSet*);
-	BasicBlock* preRepBlock(BasicBlock *, Instruction*);
-	BasicBlock *RepBrBlock (BasicBlock *,Instruction*, BasicBlock*);
-	bool ImplementonEdge(Edge*, unsigned int, Instruction*);
-	bool noEffect(Instruction*);
-	void replaceLocalOperands(Instruction *, std::map<Value*,Value*>&);
+	ShortcutDetectorPass::RepMode repMode;
+	int localnumcoveredbr; //branches left to the replicas
+	int localnumreplica; //replica blocks
+	int localnumsharedreplica; //replicas used by more than one edge
+	std::vector<ChildrenSet*> coveredSets; //heads of the sets taken over
+	std::map<BasicBlock*, BranchInst*> BBupdateMap; //node -> its branch, wherever it moves
 
-	std::map<BasicBlock*,BasicBlock*> BBupdateMap;
+	bool canCover(ChildrenSet*);
+	void setNodes(ChildrenSet*, std::vector<ChildrenSet*>&);
+	void specialDupBB(ChildrenSet*);
+	bool ImplementonEdge(Edge*, unsigned int, ReplicaMap&);
+	BasicBlock *RepBrBlock(Rep*, BasicBlock*, BasicBlock*);
 
     }; //end of class IfDuplica
 
     
 
+    //the partial Reps of -ParIFDup
     class ParIfDuplica : public IfDuplica {
-    private:
-	virtual void IFDupforNode(ChildrenSet*);
+    public:
+	static char ID;
+	ParIfDuplica():IfDuplica(ID, ShortcutDetectorPass::PartialReps){}
     };
 
+    //every exit edge of a set checks all the branches on its path
     class FullIfDuplica : public IfDuplica{
-    private:
-	virtual void IFDupforNode(ChildrenSet*);
+    public:
+	static char ID;
+	FullIfDuplica():IfDuplica(ID, ShortcutDetectorPass::FullReps){}
     };
 
 }//end of namespace
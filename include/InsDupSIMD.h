@@ -0,0 +1,54 @@
+//-----Developed by Jing Yu -------------//
+// InsDupSIMD.h                          //
+//=======================================//
+//Duplicate all instructions, run the    //
+//arithmetic and its duplicate as two    //
+//lanes of one vector operation          //
+//=======================================//
+//Class is implemented in InsDupSIMD.cpp
+
+#ifndef INSDUPSIMD_H
+#define INSDUPSIMD_H
+
+#include "InsDuplica.h"
+
+#include <map>
+#include <vector>
+
+using namespace llvm;
+
+namespace llvm {
+
+   //-InsDup where a chain of integer or FP arithmetic runs as <2 x T>
+   //operations: lane 0 is the original, lane 1 the duplicate. Lanes are
+   //extracted only for the users outside the chain, for the duplicated
+   //users and for the checks, which then compare the two lanes. The
+   //originals are replaced by their lane 0 once everything is duplicated,
+   //so the checks and the tables of InsDuplica keep seeing them until then.
+   class InsDupSIMD : public InsDuplica {
+      public:
+         static char ID;
+         InsDupSIMD():InsDuplica(ID){}
+
+      protected:
+         virtual void DuplicaAllBB(Function &F);
+         virtual void DuplicaInst(Instruction*, Instruction*);
+
+      private:
+         int localnumpacked; //number of original/duplicate pairs run as one vector op
+         int localnumlanein; //number of values inserted into lanes
+         std::map<Value*, Instruction*> packedMap; //original -> its vector op
+         std::map<std::pair<Value*, BasicBlock*>, Value*> laneMap; //other values, moved into lanes in a block
+         std::vector<std::pair<Instruction*, Instruction*> > lane0s; //original, its lane 0
+
+         bool packable(Instruction*);
+         bool worthPacking(Instruction*);
+         Value *getPacked(Value*, Instruction*);
+         void replaceOriginals();
+   }; //end of class InsDupSIMD
+
+}//end of namespace
+
+#endif //INSDUPSIMD_H
+
+// vim: ts=3 sts=3 sw=3 et
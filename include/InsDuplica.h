@@ -18,9 +18,18 @@
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/Module.h>
 #include <llvm/Analysis/Dominators.h>
+#include <llvm/Analysis/LoopInfo.h>
 
 #include "RedundOPT.h"
 #include "SafeRegOPT.h"
+#include "PrivateSlot.h"
+#include "ProtectPolicy.h"
+#include "CostModel.h"
+#include "BlockProfile.h"
+#include "SiteCounters.h"
+#include "OverheadEstimator.h"
+#include "StoreVAtool.h"
+#include "LdAddrAnalysis.h"
 
 #include <set>
 #include <string>
@@ -28,6 +37,7 @@
 #include <map>
 #include <iostream>
 #include <sstream>
+#include <vector>
 
 #undef Jing_DEBUG 
 //#define Jing_DEBUG
@@ -42,15 +52,53 @@ namespace llvm {
          InsDuplica():FunctionPass(ID){}
          void getAnalysisUsage (AnalysisUsage &AU) const ;
 
+         bool doInitialization(Module &M);
          bool runOnFunction(Function &F);
+         bool doFinalization(Module &M);
 
+         static bool notdummyFunc(Function &F); //test if this function is dummy
 
       private:
       protected:
+         //for subclasses registered under their own name
+         InsDuplica(char &pid):FunctionPass(pid){}
+
          int tmpld;
          int localnuminsdup; //number of generated instructions for this function
          int localnumBBchecker;//number of generated branch checker BBs
          int localnumStorechecker; //number of generated store checker BBs
+         int localnumcalldup; //number of duplicated pure calls
+         int localnumcallshare; //number of noduplicate pure calls sharing one result
+         int localnumcallignore; //number of ignored calls (debug, lifetime...)
+         int localnumpromoted; //number of allocas promoted to registers
+         int localnumslot; //number of duplicated private slots
+         int localnumslotaccess; //number of duplicated private slot accesses
+         int localnumsampled; //number of checks folded into the sample accumulator
+         int localnumswitch; //number of checked switch instructions
+         int localnumreload; //number of stores checked by loading them again
+         int localnumdatakept; //number of instructions not duplicated by addrctl
+         int localnumdataskip; //number of checks dropped by addrctl
+         int localsamplerate; //iterations between two sample checks, 0 if not sampling
+         int localnumstsigloop; //number of loops checked by store signatures
+         int localnumstsigcal; //number of store checks folded into the signature
+         int localnumstsigcheck; //number of signature checks at loop exits
+
+         //for per function overhead (size before and after, and the same
+         //weighted by the profile counts, or by 8^loop depth without one,
+         //as an estimate of executed instructions)
+         uint64_t localstaticbefore, localstaticafter;
+         uint64_t localdynbefore, localdynafter;
+         std::map<BasicBlock*, uint64_t> blockWeight;
+         BlockProfile *profile; //NULL if F has no profile
+         void measureBefore(Function&, LoopInfo&);
+         void measureAfter(Function&);
+         //instructions before duplication, the others get !ifdup.added
+         std::set<Instruction*> origInsts;
+
+         //module totals, reported by doFinalization()
+         uint64_t modulestaticbefore, modulestaticafter;
+         uint64_t moduleprofbefore, moduleprofafter;
+         uint64_t moduleestbefore, moduleestafter;
 
          //for redundant check
          int localnumfinalldcheck;
@@ -66,11 +114,16 @@ namespace llvm {
 
          BasicBlock *errorBlock;
          //      std::set<std::string> ldnameset;
+         //conditional branches checked by someone else (IfDuplica):
+         //DuplicaBr() only duplicates their condition
+         std::set<BranchInst*> coveredBr;
 
-         void DuplicaAllBB (Function &F);
+         virtual void DuplicaAllBB (Function &F);
          virtual void DuplicaBB(BasicBlock*);
          void DuplicaBr(BasicBlock*, Instruction*, BranchInst*);
-         void DuplicaInst(Instruction*, Instruction*);
+         void DuplicaSwitch(BasicBlock*, SwitchInst*);
+         BasicBlock *newSwitchChecker(SwitchInst*, BasicBlock*);
+         virtual void DuplicaInst(Instruction*, Instruction*);
          BasicBlock* DuplicaLoad(LoadInst*, BasicBlock *BB);
 
          void replaceOperands(Instruction *);
@@ -78,9 +131,12 @@ namespace llvm {
          BasicBlock* newCheckerSynch(Instruction*,BasicBlock*, Instruction * &nextI);
          virtual BasicBlock *newCheckerStore(Instruction*,BasicBlock*, Instruction * &nextI);
          BasicBlock *newOneValueChecker(Value*, Instruction*, BasicBlock*, std::string&nameTag);
+         //policy.storeCheck == STORECHECK_RELOAD
+         Value *knownDup(Value*);
+         bool canReload(StoreInst*, std::set<Value*>*, BasicBlock*);
+         BasicBlock *newReloadChecker(StoreInst*, BasicBlock*);
 
          BasicBlock * buildErrorBlock(Function &F);
-         bool notdummyFunc(Function &F); //test if this function is dummy
          bool workFunc(Function &F); //test if this function is in our working set
          std::map<Value*, Value*> valueMap;
          std::map<Instruction*, std::list<Instruction*>*> toAddvalueMap;
@@ -104,6 +160,40 @@ namespace llvm {
          std::set<Value*> arguSet;
          bool isFuncArgu(Value*);
          void dupFuncArgu(Function &F);
+         //shadow-value calling convention (ShadowCall.h)
+         Value *getShadowDup(Value*);
+         void patchShadowCall(CallInst*);
+         void DuplicaShadow(Instruction*);
+         //protection tier of the current function (ProtectPolicy.h)
+         PolicySelector selector;
+         ProtectPolicy policy;
+         virtual ProtectPolicy choosePolicy(Function &F);
+         //checks and slices kept under policy.budget, NULL if no budget
+         CostModel *costModel;
+         void keepOriginal(Instruction*);
+         //numbered checker branches, counted with -ifdup-site-counters
+         SiteCounters sites;
+         //non-escaping allocas (PrivateSlot.h)
+         PrivateSlots privateSlots;
+         void DuplicaSlot(Instruction*);
+         //sampled checks in loops (policy.sampleCheck)
+         AllocaInst *sampleAcc; //or of all differences since the last sample
+         std::set<BasicBlock*> sampleBlocks;
+         std::vector<BasicBlock*> sampleHeaders;
+         std::set<BasicBlock*> sampleExits;
+         void setupSampling(Function&, LoopInfo&);
+         bool canSampleLoop(Loop*);
+         bool isStoreAddress(Value*, Instruction*);
+         bool isSampled(BasicBlock*, Type*);
+         Value *asSampleInt(Value*, Instruction*);
+         void accumulateDiff(Value*, Instruction*);
+         void flushSample(BasicBlock*, BasicBlock*);
+         void finishSampling(Function&);
+         //what reaches addresses and branches (policy.addrCtl), else NULL
+         LdAddr *ldAddr;
+         //store signatures in store-dense loops (policy.storeSig)
+         StoreVAtool *stVAtool;
+
          void statRegRemove(Instruction*);  // count removal checks for reg safe
 
          //For redundant checks analysis
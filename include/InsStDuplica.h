@@ -1,6 +1,9 @@
 //-------------------Developed by Jing Yu----------------//
 //InsStDuplica.h                                         //
 //====================================================== //
+//-InsDup with store signatures (StoreVAtool.h) in every //
+//function, whatever its tier says                       //
+//====================================================== //
 
 #ifndef INSSTDUPLICA_H
 #define INSSTDUPLICA_H
@@ -13,21 +16,17 @@ using namespace llvm;
 namespace llvm {
     class InsStDuplica: public InsDuplica {
     public:
-        virtual bool runOnFunction(Function &F);
-        virtual void getAnalysisUsage (AnalysisUsage &AU) const {
-            AU.addRequired<LoopInfo>();
-        }
-
-	void DuplicaAllBB(Function &F,LoopInfo &loopinfo);
-	StoreVAtool *stVAtool;
-	void stdupBB(BasicBlock *);    
-	void recordSynch(Instruction*, BasicBlock*,std::list<checkVec*>*);
-    	void propSigtoNewBr(BasicBlock*);
-        void requestAllToMap(UpdateListType*);
+	static char ID;
+	InsStDuplica():InsDuplica(ID){}
+
+    protected:
+	virtual ProtectPolicy choosePolicy(Function &F) {
+	    ProtectPolicy p = InsDuplica::choosePolicy(F);
+	    p.storeSig = true;
+	    return p;
+	}
     }; //end of class InsStDuplica
 
-
-
 } //end of namespace llvm
 
 
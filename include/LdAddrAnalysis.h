@@ -1,19 +1,21 @@
 //---Developed by Jing Yu ---- //
 //LdAddrAnalysis.h            //
 //============================//
+//Values that reach a load    //
+//address or a branch         //
+//============================//
+//Classes are implemented in LdAddrAnalysis.cpp
+
 #ifndef LDADDRANALYSIS_H
 #define LDADDRANALYSIS_H
 
-#include "llvm/Pass.h"
-#include "llvm/Instruction.h"
-#include "llvm/Instructions.h"
-#include "llvm/Function.h"
-#include "llvm/ADT/Statistic.h"
+#include <llvm/Pass.h>
+#include <llvm/IR/Instruction.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Function.h>
 
 #include <map>
-#include <string>
 #include <list>
-#include <iostream>
 #include <set>
 
 using namespace llvm;
@@ -21,100 +23,75 @@ using namespace llvm;
 namespace llvm {
  struct InstPair{
      private:
-        Instruction *origI;
+	Instruction *origI;
 	Instruction *dupI;
      public:
 	InstPair(Instruction *o, Instruction*d) {origI = o; dupI=d;}
-	void add(Instruction *I, bool isdup) {
-	    if (isdup) {
-		//debug
-		/*
-		if (dupI) {
-		  std::cerr << "dupI occupied.I="<<I->getName()<<" " << dump();
-		}
-		*/
-
-		assert(!dupI && "dupI occupied. Exam same name instruction.");
-		dupI = I;
-	    } else {
-		//debug
-		/*
-		if (origI) {
-		    std::cerr << "origI occupied. I="<<I->getName()<<" " <<dump();
-		}
-		*/
-		assert (!origI && "origI occupied. Exam same name instruction.");
-		origI = I;
-	    }
+	bool isPair() {
+	    if (origI && dupI) return true;
+	    else return false;
+	}
+	Instruction *getorigI() {
+	    return origI;
+	}
+	Instruction *getdupI() {
+	    return dupI;
 	}
-      InstPair(Instruction *I, bool isdup) {
-	    origI = NULL;
-	    dupI = NULL;
-	    add (I, isdup);
-      }
-     bool isPair() {
-	 if (origI && dupI) return true;
-	 else return false;
-     }
-     bool hasdupentry() {
-	 if (dupI) return true;
-	 else return false;
-     }
-
-     Instruction *getdupI() {
-	 return dupI;
-     }
-     std::string dump() {
-	std::string temp = "Ipair(origI=" ;
-	if (origI) temp+= origI->getName() + " ,dupI=";
-	else temp += "null,dupI=";
-	if (dupI) temp+=dupI->getName()+")";
-	else temp+="null)";
-	if (isPair()) temp += "P";
-	return temp;
-     } 
  }; //end of struct InstPair
 
+ //Originals and their duplicates, paired by the !ifdup.dupof metadata
+ //InsDuplica leaves on every duplicate (it names the original), so
+ //unnamed values pair as well as named ones.
  class InstDupMap {
     private:
-	std::map<std::string, InstPair*> InstMap;
-	int classifydup(Instruction *);
-	std::string &getkey(Instruction *I);
+	std::map<Instruction*, InstPair*> InstMap; //both halves lead to their pair
     public:
-	InstDupMap();
-	~InstDupMap();
-	bool isdup(Instruction *I);
-	bool hasTF(Instruction*);
+	~InstDupMap() {clear();}
+	static void tagDup(Instruction *origI, Instruction *dupI);
+	static Instruction *dupOf(Instruction *I); //NULL if I is no duplicate
 	void buildMap(Instruction *I);
+	bool isdup(Instruction *I);
 	bool hasDup(Instruction *I);
 	void clear();
  }; //end of class InstDupMap
 
 
+ //The values a fault can turn into a wrong address or a wrong path:
+ //the backward slices of load and store addresses, of branch
+ //conditions, switch selectors, indirect callees and pointers passed
+ //to synchronising calls. Loads inside a slice take their own address
+ //with them, and loads from a local slot every value stored into it. Run after -InsDup it also
+ //reports which of them got a duplicate; InsDuplica runs analyze() on
+ //its own for the addrctl tier, once allocas are promoted.
  class LdAddr : public FunctionPass {
     public:
+	static char ID;
+	LdAddr():FunctionPass(ID){}
+	virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+	    AU.setPreservesAll();
+	}
 	virtual bool runOnFunction(Function &F);
+
+	void analyze(Function &F);
+	bool needProtect(Value *V) {return needprotectset.count(V) > 0;}
+
     private:
-	bool isSynchPoint(Instruction*);
-	bool duplicable (Instruction *);
-      	bool workingInstType(Instruction *);
 	InstDupMap instmap;
 	void setupmap(Function &F);
 	std::list<LoadInst*> loadlist;
 	void scanLoadList();
 	void scanCondset();
-	void scanLoad(LoadInst *);
-	Value * scanCast(Value *);
-	int scanValue(Value*,int);
-        void needprotect(Instruction *, bool);
-
-	int scanCondOperandValue(Value *operand, Instruction *condI);
-
-	bool isOriginalBranch(BranchInst *bI, std::string &errorblockname);
- 	std::set<Instruction*> needprotectset;
-        std::set<Instruction*> needprotectIV;
+	int scanValue(Value*);
+	void needprotect(Value *);
+	AllocaInst *slotOf(Value *);
+	void storedInto(AllocaInst *, std::list<Value*> &);
+	bool isInductionPHI(PHINode *);
+
+	std::set<Value*> needprotectset;
+	std::set<AllocaInst*> needprotectslots; //slots loaded inside the slice
+	std::set<Instruction*> needprotectIV;
 	std::set<Instruction*> condset;
-        
+
 	int localtotalload;
 	int localprotectedload;
 	int localunprotectedload;
@@ -122,13 +99,14 @@ namespace llvm {
 	int localloadaddr;
 
 	int localbrconduseload;
-	int localnumnotsafecondition;
 	int localnumcondnodup;
 	int localtotalcond;
 	int localbrcondduetoiv;
 	int localbrcondduetold;
 	int localbrcondduetoldiv;
-	
+
+	void initLocalCounter();
+	void printStat(Function &F);
 
  }; //end of class LdAddr
 
@@ -0,0 +1,72 @@
+/////////////////////////////////////////
+//OverheadEstimator.h                  //
+/////////////////////////////////////////
+//Expected dynamic inflation of the    //
+//hardened code, from BlockFrequencyInfo//
+//Class is implemented in OverheadEstimator.cpp//
+/////////////////////////////////////////////////
+
+#ifndef OVERHEADESTIMATOR_H
+#define OVERHEADESTIMATOR_H
+
+#include <llvm/Pass.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <set>
+
+using namespace llvm;
+
+namespace llvm {
+
+   ////////////////////////////////////
+   // Class OverheadEstimator        //
+   ////////////////////////////////////
+   //-InsDup and -ParIFDup tag what they add with !ifdup.added. Run right
+   //after them, -IFDupCost weights every instruction, conditional branch
+   //and block by its frequency per call of the function and prints, per
+   //function and for the module, original and added amounts and their
+   //ratio: one IFDUP_COST line each, fixed columns (see printHeader()).
+   //
+   //A function counts once per call, or by its entry count if it has a
+   //profile, in the module totals.
+   class OverheadEstimator : public FunctionPass {
+      public:
+         static char ID;
+         OverheadEstimator():FunctionPass(ID){}
+         void getAnalysisUsage(AnalysisUsage &AU) const;
+
+         bool doInitialization(Module &M);
+         bool runOnFunction(Function &F);
+         bool doFinalization(Module &M);
+
+         //for the duplicating passes: remember F before, tag the rest after
+         static void recordOriginal(Function &F, std::set<Instruction*> &orig);
+         static void tagAdded(Function &F, std::set<Instruction*> &orig);
+         static bool isAdded(Instruction *I);
+
+      private:
+         struct Amounts {
+            double insts, addedInsts;
+            double branches, addedBranches;
+            double blocks, addedBlocks;
+            void clear();
+            void add(Amounts &a, double times);
+         };
+
+         Amounts module;
+         double moduleCalls;
+         raw_ostream *out;
+         raw_ostream *file; //-ifdup-cost-file, NULL for stderr
+
+         void printHeader();
+         void printLine(StringRef kind, StringRef name, double calls, Amounts &a);
+   }; //end of OverheadEstimator
+
+}//end of namespace
+
+#endif //OVERHEADESTIMATOR_H
+
+// vim: ts=3 sts=3 sw=3 et
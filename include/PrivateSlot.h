@@ -0,0 +1,57 @@
+/////////////////////////////////////////
+//PrivateSlot.h                        //
+/////////////////////////////////////////
+//Find allocas that never escape the   //
+//function. Their loads and stores are //
+//duplicated instead of checked.       //
+//Class is implemented in PrivateSlot.cpp//
+/////////////////////////////////////////
+
+#ifndef PRIVATESLOT_H
+#define PRIVATESLOT_H
+
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Analysis/Dominators.h>
+
+#include <set>
+
+using namespace llvm;
+
+namespace llvm {
+
+   ////////////////////////////////////
+   // Class PrivateSlots             //
+   ////////////////////////////////////
+   //promoteAllocas() first turns promotable allocas into registers.
+   //collect() then records the remaining allocas whose address is only
+   //used to load, store, memset or memcpy into them, directly or through
+   //GEPs and bitcasts. InsDup gives each of them a duplicated slot: the
+   //duplicated stream stores to and loads from its own copy, so these
+   //accesses are ordinary duplicated instructions, not synch points.
+   class PrivateSlots {
+      public:
+         PrivateSlots() {}
+         static int promoteAllocas(Function &F, DominatorTree &DT);
+         void collect(Function &F);
+         void clear() { allocaSet.clear(); addrSet.clear(); }
+
+         bool isPrivateAlloca(Instruction *I);
+         bool isPrivateAddr(Value *ptr);
+         //store, load or memory intrinsic writing a private slot
+         bool isPrivateAccess(Instruction *I);
+         int size() { return allocaSet.size(); }
+
+      private:
+         std::set<Instruction*> allocaSet;
+         std::set<Value*> addrSet; //allocas and pointers derived from them
+
+         bool isMemIntrinsicOnSlot(CallInst *CI, Value *ptr);
+         bool noEscape(AllocaInst *AI, std::set<Value*> &derived);
+   }; //end of PrivateSlots
+
+}//end of namespace
+
+#endif //PRIVATESLOT_H
+
+// vim: ts=3 sts=3 sw=3 et
@@ -0,0 +1,134 @@
+/////////////////////////////////////////
+//ProtectPolicy.h                      //
+/////////////////////////////////////////
+//Protection tier of one function.     //
+//Class is implemented in ProtectPolicy.cpp//
+/////////////////////////////////////////////
+
+#ifndef PROTECTPOLICY_H
+#define PROTECTPOLICY_H
+
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Module.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Regex.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+namespace llvm {
+
+   //How values reaching a store are checked.
+   enum STORELEVEL {
+      STORE_L1, //stores are synch points: value and address checked at the store
+      STORE_L3  //only calls synchronise: store checks are removable, addresses decomposed
+   };
+
+   //How a checked store is checked.
+   enum STORECHECK {
+      STORECHECK_COMPARE, //address and value against their duplicates, before the store
+      STORECHECK_RELOAD   //the stored word read back through the duplicated address, plus the address
+   };
+
+   //What protects a switch; the switch itself is kept for its jump table.
+   enum SWITCHCHECK {
+      SWITCH_OFF,
+      SWITCH_SELECTOR, //the selector against its duplicate, before the switch
+      SWITCH_TARGET    //each target checks the duplicated selector led there
+   };
+
+   ////////////////////////////////////
+   // Store strategies               //
+   ////////////////////////////////////
+   //RedundAnalysis instantiates its table setup once per strategy, so
+   //the scan over all instructions does not test the level again.
+   struct StoreL1 {
+      static const enum STORELEVEL level = STORE_L1;
+      static const bool storeIsSynch = true;   //a store ends a check region
+      static const bool storeCheckedAt = false; //store checks are PROPORFINAL
+      static const bool decomposeStore = false; //check the address as a whole
+   };
+
+   struct StoreL3 {
+      static const enum STORELEVEL level = STORE_L3;
+      static const bool storeIsSynch = false;
+      static const bool storeCheckedAt = true;
+      static const bool decomposeStore = true;
+   };
+
+   ////////////////////////////////////
+   // Class ProtectPolicy            //
+   ////////////////////////////////////
+   //Defaults come from the command line (-ifdup-*). The tier chosen by
+   //PolicySelector is applied on top, then the string attribute
+   //"ifdup-policy". Both are comma separated lists of: on, off, l1, l3,
+   //regsafe, noregsafe, brops, nobrops, slots, noslots, scev, noscev,
+   //place, noplace, sample, nosample, stsig, nostsig, addrctl, noaddrctl,
+   //budget=<percent>,
+   //switch=off|selector|target, stcheck=compare|reload. The sample rate is read from
+   //"ifdup-sample-rate".
+   class ProtectPolicy {
+      public:
+         ProtectPolicy();
+         static ProtectPolicy forFunction(Function &F, StringRef tier = "");
+
+         bool enabled;        //"off" leaves the function unprotected
+         enum STORELEVEL storeLevel;
+         bool regSafe;        //loaded and checked values are not checked again
+         bool checkBrOperands; //check the operands of branch conditions
+         bool privateSlots;   //promote and duplicate non-escaping allocas
+         bool loopSCEV;       //move loop checks to preheaders and exits
+         bool placeChecks;    //min-cut placement of store checks (CheckPlacement.h)
+         bool sampleCheck;    //sample checks inside loops
+         bool addrCtl;        //duplicate and check only what reaches addresses and branches (LdAddrAnalysis.h)
+         bool storeSig;       //store signatures in store-dense loops (StoreVAtool.h)
+         float storeSigDensity; //stores per block that make a loop store-dense
+         enum SWITCHCHECK switchCheck;
+         enum STORECHECK storeCheck;
+         int sampleRate;
+         unsigned int budget; //max estimated slowdown in percent, 0: no limit
+
+         //apply one token of "ifdup-policy"; false if unknown
+         bool apply(StringRef token);
+         //apply a comma separated list, complain about unknown tokens
+         void applyList(StringRef tier, Function &F);
+         std::string str();
+   }; //end of ProtectPolicy
+
+   ////////////////////////////////////
+   // Class PolicySelector           //
+   ////////////////////////////////////
+   //Picks the tier of every function of a module once, in this order:
+   // 1. __attribute__((annotate("ifdup=<tier>"))) on the function,
+   // 2. the first line of -ifdup-policy-file whose regex matches the
+   //    name ("<regex> <tier>" per line, '#' starts a comment),
+   // 3. -ifdup-skip=<regex> (off) and -ifdup-only=<regex> (off for
+   //    every function it does not match),
+   // 4. with -ifdup-profile-tiers, the measured counts (BlockProfile.h):
+   //    the hottest functions covering -ifdup-hot-fraction of all counts
+   //    get -ifdup-hot-tier, never executed ones -ifdup-cold-tier.
+   //Functions matched by none of them keep the command line defaults.
+   class PolicySelector {
+      public:
+         void build(Module &M);
+         StringRef lookup(Function *F);
+
+      private:
+         std::map<const Function*, std::string> tiers;
+         std::vector<std::pair<Regex*, std::string> > rules;
+
+         void readAnnotations(Module &M);
+         void readPolicyFile(StringRef path);
+         void applyProfileTiers(Module &M);
+         bool matchRules(StringRef name, std::string &tier);
+         void clearRules();
+   }; //end of PolicySelector
+
+}//end of namespace
+
+#endif //PROTECTPOLICY_H
+
+// vim: ts=3 sts=3 sw=3 et
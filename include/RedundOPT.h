@@ -21,6 +21,8 @@
 
 #include <llvm/Support/raw_ostream.h>
 
+#include "ProtectPolicy.h"
+
 #include <map>
 #include <set>
 #include <vector>
@@ -31,6 +33,14 @@
 using namespace llvm;
 
 namespace llvm { 
+   class CheckSummary;
+   class PrivateSlots;
+   class BlockProfile;
+   class ScalarEvolution;
+   class BlockFrequencyInfo;
+   class BranchProbabilityInfo;
+   struct PlaceRegion;
+
    ////////////////////////////////////
    // Class CheckCode                //
    ////////////////////////////////////
@@ -56,6 +66,7 @@ namespace llvm {
          virtual std::set<Value*>& getCheckElemList(){return CheckElem;} //final version
          std::set<Value*>& getCheckElems() {return CheckElem;}//whatever in CheckElem
          virtual unsigned int getFinalNumElem(){return CheckElem.size();}
+         virtual void drop() {CheckElem.clear();} //nothing is checked any more
          void dumpCheckCode();
          virtual void dump();
    }; //end of CheckCode
@@ -69,11 +80,14 @@ namespace llvm {
       private:
          std::set<Value*> finalElems;
          bool computeFinal;
+         bool family; //decompose even into several values
          void ComputeFinal(); //compute finalElems
       public:
+         void setFamily() {family = true;}
          virtual unsigned int getOrigNumElem();
          virtual std::set<Value*>& getCheckElemList();
          virtual unsigned int getFinalNumElem();
+         virtual void drop() {CheckElem.clear(); finalElems.clear(); computeFinal = true;}
          virtual void dump();
    }; //end of CheckLoad
 
@@ -85,11 +99,14 @@ namespace llvm {
       private:
          std::set<Value*> finalElems;
          bool computeFinal;
+         bool family; //decompose even into several values
          void ComputeFinal();
       public:
+         void setFamily() {family = true;}
          virtual unsigned int getOrigNumElem();
          virtual std::set<Value*>& getCheckElemList();
          virtual unsigned int getFinalNumElem();
+         virtual void drop() {CheckElem.clear(); finalElems.clear(); computeFinal = true;}
          virtual void dump();
    }; //end of CheckStore
 
@@ -109,6 +126,12 @@ namespace llvm {
          virtual unsigned int getOrigNumElem();
          virtual std::set<Value*>& getCheckElemList();
          virtual unsigned int getFinalNumElem();
+         virtual void drop() {
+            CheckElem.clear();
+            propCheckList.clear();
+            propToList.clear();
+            isOrigList.clear();
+         }
          virtual void dump();
 
          void insertPropCheck(Value* elem, bool propTo, bool orig){
@@ -147,10 +170,11 @@ namespace llvm {
    ////////////////////////////////
    class CheckCodeMap {
       public:
-         CheckCodeMap(){checkCodeMap.clear();}
+         CheckCodeMap(enum STORELEVEL level = STORE_L1) : storeLevel(level) {checkCodeMap.clear();}
          ~CheckCodeMap();
       private:
          std::map<Instruction*, CheckCode*> checkCodeMap;
+         enum STORELEVEL storeLevel; //CheckStore under L3, CheckCode under L1
 
       public:
          CheckCode* getCheckCode(Instruction*); //return null if not found
@@ -232,7 +256,6 @@ namespace llvm {
          std::map<BranchInst*,bool> ExitingBranch;
 
          void addExitingBlocks(std::vector<BasicBlock*>&blocks);
-         void addIVset(std::vector<PHINode*>&IVs);
          void dump();
 
       private:
@@ -263,8 +286,15 @@ namespace llvm {
       void removeOverlap(CheckCodeMap *checkCodeMap, ValueCheckedAtMap *valueCheckedAtMap, Function &F, PostDominatorTree& PDT);
       void rmSafeReg(CheckCodeMap *checkCodeMap, ValueCheckedAtMap *valueCheckedAtMap, Function &F);
       void printStatforTotal(Function &F);
-      void rmLoopIV(CheckCodeMap *checkCodeMap, ValueCheckedAtMap *valueCheckedAtMap, Function &F, LoopInfo &loopinfo);
+      void rmLoopSCEV(CheckCodeMap *checkCodeMap, ValueCheckedAtMap *valueCheckedAtMap, Function &F, LoopInfo &loopinfo, ScalarEvolution &SE);
       void enableCheckADVRegSafe(DominatorTree *DT);
+      void setCalleeSummary(CheckSummary *summary);
+      void setPrivateSlots(PrivateSlots *slots);
+      void setPolicy(const ProtectPolicy &policy) {MyPolicy = policy;}
+      //move checks to colder points of the CFG (CheckPlacement.cpp)
+      void placeChecks(CheckCodeMap *checkCodeMap, ValueCheckedAtMap *valueCheckedAtMap, Function &F, DominatorTree &DT, BlockFrequencyInfo &BFI, BranchProbabilityInfo &BPI);
+      //executed checks from measured counts, before the blocks are split
+      void countProfiledChecks(BlockProfile *profile);
 
 
       private:
@@ -285,15 +315,15 @@ namespace llvm {
       //for table setup
       std::list<Instruction*>ToUpdateList;
       void addtoUpdateList(Value*);
-      void ScanAllCheckCodes(Function &F);
+      template <class Level> void ScanAllCheckCodes(Function &F);
       void PropagateChecks();
       bool canPropErrorInst(Instruction*);
       bool isCheckPoint(Instruction*ins);
-      void SetupTablewithCheckPoint(Instruction*, BasicBlock*);
+      template <class Level> void SetupTablewithCheckPoint(Instruction*, BasicBlock*);
       void SetupTablewithBranch(Instruction *, BranchInst*, BasicBlock*);
       void SetupTablewithReturn(ReturnInst *, BasicBlock*);
       void SetupTablewithLoad(LoadInst *, BasicBlock*);
-      void SetupTablewithStore(StoreInst *, BasicBlock*, enum CHECKTYPE);
+      template <class Level> void SetupTablewithStore(StoreInst *, BasicBlock*);
       void SetupTablewithCall(CallInst*, BasicBlock*, enum CHECKTYPE);
       void SetUpTablewithOP(CheckCode*, Value*, Instruction*,enum CHECKTYPE);
       //for remove overlap
@@ -301,6 +331,11 @@ namespace llvm {
 
       //for load address decomposition
       void DecomposeAddress(std::set<Value*>&valueSet, Value *addrP);
+      bool decomposeInto(std::set<Value*>&leaves, Value *v, int depth);
+      bool isAddressArith(Instruction*);
+      Value *addressBase(Value*);
+      void markAddressFamilies();
+      int localnumaddrfamily;
       Value *scanCast(Value*);
 
       //for regsafe
@@ -311,17 +346,43 @@ namespace llvm {
       //for advanced reg safe
       bool reg_safe;
 
-      //for loop iv
-      void getInnermostLoop(std::list<Loop*>&innermostLoops, Function &F,LoopInfo &loopinfo);
-      LoopIVInfo *getLoopIV(Loop*);
-      bool optimizeOnIV(Loop*,LoopIVInfo*);
-      void getAllInductionVariable(Loop*loop, std::vector<PHINode*>&IVs);
+      //protection tier (ProtectPolicy.h)
+      ProtectPolicy MyPolicy;
+
+      //for callee summaries
+      CheckSummary *MyCalleeSummary;
+      int localnumsummaryskip;
+
+      //for non-escaping allocas
+      PrivateSlots *MyPrivateSlots;
+      bool isPrivateAccess(Instruction*);
+
+      //for loop checks (SCEV)
+      void getLoopsInnerFirst(std::list<Loop*>&loops, LoopInfo &loopinfo);
+      bool optimizeLoopSCEV(Loop*, LoopInfo&, ScalarEvolution&);
+      bool coverInLoop(Value*, Loop*, LoopInfo&, ScalarEvolution&, std::set<Value*>&, std::set<Value*>&, int);
+      bool canMoveLoopChecks(Loop*);
       bool insideLoop(Loop*, Instruction*);
       void moveOutofLoop(Value*, LoopIVInfo*);
-      void optConstantCheck(Value*,Loop *,Instruction*,LoopIVInfo*);
+      void moveToPreheader(Value*, BasicBlock*);
       void statLoopOpt(Value*, Instruction *);
       void printLoopOptPassStat(Function &F);
 
+      //for check placement
+      DominatorTree *MyDT;
+      BlockFrequencyInfo *MyBFI;
+      BranchProbabilityInfo *MyBPI;
+      bool isMovableCheck(Instruction*);
+      bool placeChecksOnValue(Value*, std::vector<Instruction*>&);
+      void walkFrom(Value*, unsigned int, Instruction*, PlaceRegion&);
+      unsigned int entryNode(PlaceRegion&, BasicBlock*);
+      unsigned int exitNode(Value*, PlaceRegion&, BasicBlock*);
+      bool canPlaceOnEdge(Value*, BasicBlock*, unsigned int);
+      void placeOnEdge(Value*, BasicBlock*, unsigned int);
+      uint64_t blockCost(BasicBlock*);
+      uint64_t edgeCost(BasicBlock*, unsigned int);
+      void printPlacePassStat(Function &F);
+
       //for synchpoint
       std::vector<char> connectTable; //connectivity
       std::vector<char> dirtyTable;  //has a dirty path
@@ -344,6 +405,7 @@ namespace llvm {
       bool hasSynchPoint(Instruction*, Instruction*);
       bool hasSynchPointWithinBB(Instruction*,Instruction*);
       bool isSynchPoint(Instruction*I);
+      template <class Level> bool isSynchPointAt(Instruction*I);
 
 
       //statistic
@@ -352,6 +414,11 @@ namespace llvm {
       int localnumtotalbrcheck;
       int localnumtotalothercheck;
 
+      //executed checks, with a profile
+      bool profiled;
+      uint64_t localdynorigcheck;
+      uint64_t localdynfinalcheck;
+
       int localnumsaferegld;
       int localnumsaferegst;
       int localnumsaferegbr;
@@ -361,6 +428,13 @@ namespace llvm {
       int localnumloopst;
       int localnumloopbr;
       int localnumloopother;
+      int localnumloophoist;
+      int localnumloopexit;
+
+      int localnumplaceremoved;
+      int localnumplaceadded;
+      int localnumplaceskip;
+      uint64_t localplacesaved;
 
 
    }; //end of class RedundAnalysis
@@ -0,0 +1,65 @@
+/////////////////////////////////////////
+//ShadowCall.h                         //
+/////////////////////////////////////////
+//Shadow-value calling convention.          //
+//Internal functions are cloned with shadow //
+//parameters and an {orig, dup} return, so  //
+//the duplicated stream flows across calls. //
+//Class is implemented in ShadowCall.cpp    //
+///////////////////////////////////////////////
+
+#ifndef SHADOWCALL_H
+#define SHADOWCALL_H
+
+#include <llvm/Pass.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Attributes.h>
+#include "ProtectPolicy.h"
+
+#include <list>
+
+using namespace llvm;
+
+namespace llvm {
+
+   ////////////////////////////////////
+   // Class ShadowCall               //
+   ////////////////////////////////////
+   //Run before InsDup: opt -ShadowCC -InsDup, with the same -ifdup-*
+   //options, since only functions InsDup protects are cloned.
+   //
+   //f(a0..an-1) becomes f.shadow(a0..an-1, s0..sn-1) returning {r, r_dup}.
+   //Every call site is rewritten to pass its arguments twice; InsDup later
+   //replaces the second copy with the duplicates. All instructions built
+   //here carry "ifdup.shadow" metadata so InsDup and RedundAnalysis can
+   //recognise them, and each clone is listed in the "ifdup.shadow" named
+   //metadata together with its number of original parameters.
+   class ShadowCall : public ModulePass {
+      public:
+         static char ID;
+         ShadowCall():ModulePass(ID){}
+         void getAnalysisUsage(AnalysisUsage &AU) const {}
+         bool runOnModule(Module &M);
+
+         //number of original parameters of a shadow clone, -1 otherwise
+         static int numOrigParams(Function *F);
+         //Is I built by this pass?
+         static bool isShadowInst(Instruction *I);
+
+      private:
+         PolicySelector selector;
+
+         bool canShadow(Function *F);
+         static AttributeSet shadowAttributes(LLVMContext &C, AttributeSet PAL, unsigned int numParams);
+         Function *cloneWithShadow(Function *F);
+         void rewriteCall(CallInst *CI, Function *NF);
+         void markShadow(Instruction *I);
+   }; //end of ShadowCall
+
+}//end of namespace
+
+#endif //SHADOWCALL_H
+
+// vim: ts=3 sts=3 sw=3 et
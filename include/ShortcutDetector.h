@@ -11,6 +11,8 @@
 #include <llvm/IR/Function.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/Support/Allocator.h>
 #include <llvm/Analysis/Dominators.h>
 
 #include <set>
@@ -19,12 +21,14 @@
 #include <iostream>
 #include <sstream>
 #include <list>
+#include <vector>
 
 
 using namespace llvm;
 
 
 class ChildrenSet;
+class ShortcutArena;
 
 class Rep {
 	public:
@@ -114,6 +118,8 @@ class Edge {
 		}
 		bool isPRepEmpty() {return propgtRep.empty();}
 		bool isFRepEmpty() {return fixRep.empty();}
+		bool isnoRep() {return propgtRep.empty() && fixRep.empty();}
+		void clearReps() {propgtRep.clear(); fixRep.clear();}
 
 		std::list<Rep*> *getfinalRep() {
 			if (!propgtRep.empty()) 
@@ -130,12 +136,12 @@ class Edge {
 		std::string dump(std::list<Rep*> &listtodump) {
 			if (listtodump.empty()) return " ";
 
-			std::string *s = new std::string();
+			std::string s;
 			std::list<Rep*>::iterator iter;
 			for (iter=listtodump.begin(); iter!=listtodump.end(); iter++) {
-				(*s)+=(*iter)->dump()+" ";
+				s+=(*iter)->dump()+" ";
 			}
-			return (*s);
+			return s;
 		}
 
 };//end of struct Edge
@@ -149,7 +155,11 @@ class ChildrenSet {
 		ChildrenSet(BasicBlock *thisBB, BasicBlock *leftleaf, ChildrenSet *rightSet);
 		ChildrenSet(BasicBlock *thisBB, ChildrenSet *leftSet, BasicBlock *rightleaf);
 		ChildrenSet(BasicBlock *thisBB, ChildrenSet *leftSet, ChildrenSet *rightSet);
-		inline ~ChildrenSet();
+		~ChildrenSet() {
+			delete SCmidnodeset;
+			delete mySCpath;
+			delete inEdges;
+		}
 
 	private:
 		BasicBlock *myBB;
@@ -183,6 +193,11 @@ class ChildrenSet {
 		int getSCnum() {return SCnum;}
 		//std::set<BasicBlock*> *getCHnodes() {return &allchnodes;}
 		std::set<ChildrenSet*> *getSCmidnodeset() {return SCmidnodeset;}
+		std::set<ChildrenSet*> *takeSCmidnodeset() {
+			std::set<ChildrenSet*> *taken = SCmidnodeset;
+			SCmidnodeset = NULL;
+			return taken;
+		}
 		BasicBlock *getBB() {return myBB;}
 		void setUplink(ChildrenSet *up,bool isLchild ) {uplink = up; isMomsLchild = isLchild; }
 		ChildrenSet * getUplink() {return uplink;}
@@ -193,16 +208,48 @@ class ChildrenSet {
 		void dump();
 
 
-		void ChildrenSetUnion(std::set<ChildrenSet*>*,std::set<ChildrenSet*>*);
+		void ChildrenSetSplice(std::set<ChildrenSet*>*&,std::set<ChildrenSet*>*);
 		void ChildrenSetInsert(std::set<ChildrenSet*>*, ChildrenSet*);
 
 	public:
 		Edge *out0, *out1;
 		std::list<Edge*>* inEdges;
-		void conEdgeGraph(std::set<ChildrenSet*>*);
+		void conEdgeGraph(std::set<ChildrenSet*>*, ShortcutArena&);
 		void addinEdges(Edge *);
 };
 
+//////////////////////////////////////
+//////////////////////////////////////
+//The shortcut graph of one function: its ChildrenSets, Edges and Reps
+//share one bump allocator and go away together in clear().
+class ShortcutArena {
+	public:
+		~ShortcutArena() {clear();}
+
+		template <class Left, class Right>
+		ChildrenSet *newChildrenSet(BasicBlock *thisBB, Left left, Right right) {
+			ChildrenSet *node = new (Alloc.Allocate<ChildrenSet>()) ChildrenSet(thisBB, left, right);
+			Nodes.push_back(node);
+			return node;
+		}
+		template <class To>
+		Edge *newEdge(ChildrenSet *from, To to) {
+			Edge *edge = new (Alloc.Allocate<Edge>()) Edge(from, to);
+			Edges.push_back(edge);
+			return edge;
+		}
+		//nothing to destroy
+		Rep *newRep(BasicBlock *baseBB, bool trueside, BasicBlock *notTo = NULL) {
+			return new (Alloc.Allocate<Rep>()) Rep(baseBB, trueside, notTo);
+		}
+		void clear();
+
+	private:
+		BumpPtrAllocator Alloc;
+		std::vector<ChildrenSet*> Nodes;
+		std::vector<Edge*> Edges;
+};
+
 //////////////////////////////////////
 //////////////////////////////////////
 class ShortcutDetectorPass : public FunctionPass {
@@ -212,7 +259,14 @@ class ShortcutDetectorPass : public FunctionPass {
 		virtual bool runOnFunction(Function &F);
 
 		void getAnalysisUsage(AnalysisUsage &AU) const;
-		void dumpShortcut (std::list<ChildrenSet*> &headlist);
+		virtual void releaseMemory();
+		void dumpShortcut (const std::list<ChildrenSet*> &headlist);
+		//PartialReps: a node's own Reps stay on its edges, except those
+		//that go past a shortcut. FullReps: they all go as far down the
+		//set as they can, every exit edge checks the whole path.
+		enum RepMode {NoReps, PartialReps, FullReps};
+		//place the Reps of every head set on its edges
+		void propagateReps(RepMode mode = PartialReps);
 
 	private:
 		bool isTwowayBranch (BasicBlock *BB);
@@ -220,16 +274,30 @@ class ShortcutDetectorPass : public FunctionPass {
 		bool isJumpBack (BasicBlock *BB, BasicBlock *Target);
 		bool hasBackEdge(BasicBlock *BB);
 		int localshortcut, localSCset, localFailed;
-		void conSCSetMap(std::set<BasicBlock*>&, std::set<BasicBlock*>& ,std::map<BasicBlock*,ChildrenSet*>&);
-		void BuildHeadNodeList (std::map<BasicBlock*,ChildrenSet*>&, Function &);
-		void ClearUselessNodesin (std::map<BasicBlock*,ChildrenSet*>&, std::list<ChildrenSet*>&); 
+		//blocks in function order, and the position of every block and
+		//instruction; the sets below are indexed by block
+		std::vector<BasicBlock*> BBs;
+		DenseMap<BasicBlock*, unsigned int> BBindex;
+		DenseMap<Instruction*, unsigned int> InstOrdinal;
+		void numberBlocks(Function &F);
+		void conSCSetMap(std::vector<char>&, std::vector<char>&, std::vector<ChildrenSet*>&);
+		void BuildHeadNodeList (std::vector<ChildrenSet*>&);
+		void ClearUselessNodesin (std::vector<ChildrenSet*>&, std::list<ChildrenSet*>&); 
 		bool verify_domination(ChildrenSet *);
 		std::list<ChildrenSet*> HeadNodeList;
 		void conEdgeGraph(std::list<ChildrenSet*>&);
+		bool inEdgesMarked(ChildrenSet *, std::set<Edge*>&);
+		void IFDupforNode(ChildrenSet *, RepMode);
+		RepMode RepsPropagated; //what is on the edges now
+		ShortcutArena Arena; //everything in HeadNodeList, until releaseMemory()
 
 	public:
-		explicit ShortcutDetectorPass():FunctionPass(ID){}
-		std::list<ChildrenSet*> getHeadNodeList() {return HeadNodeList;}
+		explicit ShortcutDetectorPass():FunctionPass(ID),RepsPropagated(NoReps){}
+		const std::list<ChildrenSet*> &getHeadNodeList() const {return HeadNodeList;}
+		//replicas placed on the edges, freed with the graph
+		Rep *newRep(BasicBlock *baseBB, bool trueside, BasicBlock *notTo = NULL) {
+			return Arena.newRep(baseBB, trueside, notTo);
+		}
 
 };
 
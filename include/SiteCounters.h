@@ -0,0 +1,92 @@
+/////////////////////////////////////////
+//SiteCounters.h                       //
+/////////////////////////////////////////
+//Numbered check sites: execution      //
+//counters and their profile.          //
+//Class is implemented in SiteCounters.cpp//
+////////////////////////////////////////////
+
+#ifndef SITECOUNTERS_H
+#define SITECOUNTERS_H
+
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/ADT/StringRef.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+namespace llvm {
+
+   ////////////////////////////////////
+   // Class SiteProfile              //
+   ////////////////////////////////////
+   //Counts dumped by the runtime (runtime/ifdup_rt.c), host byte order:
+   //   "IFDS" u32 version u32 nmodules
+   //   nmodules x { u32 namelen, name, u32 nsites, u64 counts[nsites] }
+   //A module is "<module identifier>:<pass>".
+   class SiteProfile {
+      public:
+         bool load(StringRef path);
+         //NULL if the module was not profiled
+         std::vector<uint64_t> *lookup(StringRef name);
+
+      private:
+         std::map<std::string, std::vector<uint64_t> > modules;
+   }; //end of SiteProfile
+
+   ////////////////////////////////////
+   // Class SiteCounters             //
+   ////////////////////////////////////
+   //Every checker branch is a site, numbered in the order the pass creates
+   //them and tagged with !ifdup.site. The same input and options give the
+   //same numbers, which is what ties a profile to the sites.
+   //
+   //With -ifdup-site-counters, each function loads once the counter array
+   //of the current thread,
+   //   %ifdup.sites = call i64* @__ifdup_thread_sites(@__ifdup_module)
+   //and each site adds one to its slot before branching: a plain load,
+   //add and store, the array is private to the thread.
+   //
+   //With -ifdup-site-profile=<file>, the ok edge of each site gets its
+   //measured count as branch weight.
+   class SiteCounters {
+      public:
+         SiteCounters();
+
+         void beginModule(Module &M, StringRef pass);
+         void endModule();
+         void beginFunction(Function &F);
+         void endFunction(Function &F);
+         //checkBr goes to successor okSucc when the check passes (a
+         //switch: to every successor that is the same block)
+         unsigned int addSite(TerminatorInst *checkBr, unsigned int okSucc);
+         void printStat(Function &F);
+
+      private:
+         Module *MyM;
+         std::string moduleName;
+         GlobalVariable *desc;  //{i8* name, i32 nsites}, NULL if not counting
+         Function *threadSites; //__ifdup_thread_sites
+         CallInst *curSites;    //counters of F, inserted by endFunction()
+         unsigned int nsites;
+
+         SiteProfile profile;
+         std::vector<uint64_t> *counts; //of this module, NULL without profile
+
+         int localnumsites;
+         uint64_t localsiteexec;
+         unsigned int localhotsite;
+         uint64_t localhotcount;
+   }; //end of SiteCounters
+
+}//end of namespace
+
+#endif //SITECOUNTERS_H
+
+// vim: ts=3 sts=3 sw=3 et
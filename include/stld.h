@@ -15,9 +15,21 @@ using namespace llvm;
 
 namespace llvm {
 
+    //-InsDup with stcheck=reload in every function: a store is checked
+    //after it, by loading the word through the duplicated address and
+    //comparing it with the duplicated value, and the address with its
+    //duplicate, in one branch (newReloadChecker()).
     class InsDupStld: public InsDuplica {
+    public:
+	static char ID;
+	InsDupStld():InsDuplica(ID){}
+
     protected:
-	virtual BasicBlock* newCheckerStore(Instruction *, BasicBlock *, Instruction* &nextI);
+	virtual ProtectPolicy choosePolicy(Function &F) {
+	    ProtectPolicy p = InsDuplica::choosePolicy(F);
+	    p.storeCheck = STORECHECK_RELOAD;
+	    return p;
+	}
     };
 }
 
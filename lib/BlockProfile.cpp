@@ -0,0 +1,71 @@
+////////////////////////////////////////
+//BlockProfile.cpp                    //
+////////////////////////////////////////
+//Counts from branch_weights metadata //
+////////////////////////////////////////
+
+#include "BlockProfile.h"
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Metadata.h>
+
+using namespace llvm;
+
+uint64_t BlockProfile::branchWeightSum(TerminatorInst *T) {
+   MDNode *MD = T->getMetadata(LLVMContext::MD_prof);
+   if (!MD || MD->getNumOperands() < 2) return 0;
+   MDString *tag = dyn_cast<MDString>(MD->getOperand(0));
+   if (!tag || tag->getString() != "branch_weights") return 0;
+
+   uint64_t sum = 0;
+   for (unsigned int i = 1; i < MD->getNumOperands(); i++)
+      if (ConstantInt *CI = dyn_cast<ConstantInt>(MD->getOperand(i)))
+         sum += CI->getZExtValue();
+   return sum;
+}
+
+bool BlockProfile::hasProfile(Function &F) {
+   for (Function::iterator BBi = F.begin(), BBE = F.end(); BBi!=BBE; ++BBi)
+      if (MDNode *MD = BBi->getTerminator()->getMetadata(LLVMContext::MD_prof))
+         if (MDString *tag = dyn_cast<MDString>(MD->getOperand(0)))
+            if (tag->getString() == "branch_weights") return true;
+   return false;
+}
+
+uint64_t BlockProfile::functionHotness(Function &F) {
+   uint64_t hot = 0;
+   for (Function::iterator BBi = F.begin(), BBE = F.end(); BBi!=BBE; ++BBi) {
+      uint64_t w = branchWeightSum(BBi->getTerminator());
+      if (w > hot) hot = w;
+   }
+   return hot;
+}
+
+BlockProfile::BlockProfile(Function &F, BlockFrequencyInfo &BFI) {
+   MyF = &F;
+   MyBFI = &BFI;
+   refCount = 0;
+   refFreq = 0;
+
+   //the largest weights give the best resolution
+   for (Function::iterator BBi = F.begin(), BBE = F.end(); BBi!=BBE; ++BBi) {
+      BasicBlock *BB = BBi;
+      uint64_t w = branchWeightSum(BB->getTerminator());
+      uint64_t f = BFI.getBlockFreq(BB).getFrequency();
+      if (w > refCount && f != 0) {
+         refCount = w;
+         refFreq = f;
+      }
+   }
+}
+
+////////////////////////////////////
+//count()                         //
+////////////////////////////////////
+uint64_t BlockProfile::count(BasicBlock *BB) {
+   if (!valid()) return 0;
+   uint64_t f = MyBFI->getBlockFreq(BB).getFrequency();
+   return (uint64_t)((double)f * (double)refCount / (double)refFreq + 0.5);
+}
+
+// vim: ts=3 sts=3 sw=3 et
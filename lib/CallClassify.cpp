@@ -0,0 +1,161 @@
+////////////////////////////////////////
+//CallClassify.cpp                    //
+////////////////////////////////////////
+//Decide whether a call is ignored,   //
+//duplicated or a synch point.        //
+////////////////////////////////////////
+
+#include "CallClassify.h"
+#include "ShadowCall.h"
+
+//Classification table. An entry ending with '.' matches every name
+//with that prefix (overloaded intrinsics), other entries match exactly.
+static const struct {
+   const char *name;
+   enum CALLKIND kind;
+} CallTable[] = {
+   //debug info, lifetime markers and hints do not change program state
+   {"llvm.dbg.",           CALL_IGNORE},
+   {"llvm.lifetime.",      CALL_IGNORE},
+   {"llvm.invariant.",     CALL_IGNORE},
+   {"llvm.assume",         CALL_IGNORE},
+   {"llvm.prefetch",       CALL_IGNORE},
+   {"llvm.donothing",      CALL_IGNORE},
+   {"llvm.var.annotation", CALL_IGNORE},
+
+   //pure intrinsics
+   {"llvm.expect.",        CALL_DUPLICATE},
+   {"llvm.sqrt.",          CALL_DUPLICATE},
+   {"llvm.fabs.",          CALL_DUPLICATE},
+   {"llvm.copysign.",      CALL_DUPLICATE},
+   {"llvm.floor.",         CALL_DUPLICATE},
+   {"llvm.ceil.",          CALL_DUPLICATE},
+   {"llvm.trunc.",         CALL_DUPLICATE},
+   {"llvm.rint.",          CALL_DUPLICATE},
+   {"llvm.nearbyint.",     CALL_DUPLICATE},
+   {"llvm.round.",         CALL_DUPLICATE},
+   {"llvm.fma.",           CALL_DUPLICATE},
+   {"llvm.fmuladd.",       CALL_DUPLICATE},
+   {"llvm.pow.",           CALL_DUPLICATE},
+   {"llvm.powi.",          CALL_DUPLICATE},
+   {"llvm.exp.",           CALL_DUPLICATE},
+   {"llvm.exp2.",          CALL_DUPLICATE},
+   {"llvm.log.",           CALL_DUPLICATE},
+   {"llvm.log2.",          CALL_DUPLICATE},
+   {"llvm.log10.",         CALL_DUPLICATE},
+   {"llvm.sin.",           CALL_DUPLICATE},
+   {"llvm.cos.",           CALL_DUPLICATE},
+   {"llvm.bswap.",         CALL_DUPLICATE},
+   {"llvm.ctpop.",         CALL_DUPLICATE},
+   {"llvm.ctlz.",          CALL_DUPLICATE},
+   {"llvm.cttz.",          CALL_DUPLICATE},
+
+   //library calls that never touch memory or errno
+   {"abs",                 CALL_DUPLICATE},
+   {"labs",                CALL_DUPLICATE},
+   {"llabs",               CALL_DUPLICATE},
+   {"fabs",                CALL_DUPLICATE},
+   {"fabsf",               CALL_DUPLICATE},
+   {"fabsl",               CALL_DUPLICATE},
+   {"floor",               CALL_DUPLICATE},
+   {"floorf",              CALL_DUPLICATE},
+   {"ceil",                CALL_DUPLICATE},
+   {"ceilf",               CALL_DUPLICATE},
+   {"trunc",               CALL_DUPLICATE},
+   {"truncf",              CALL_DUPLICATE},
+   {"copysign",            CALL_DUPLICATE},
+   {"copysignf",           CALL_DUPLICATE},
+   {"fmin",                CALL_DUPLICATE},
+   {"fminf",               CALL_DUPLICATE},
+   {"fmax",                CALL_DUPLICATE},
+   {"fmaxf",               CALL_DUPLICATE}
+};
+
+bool
+CallClassify::lookupTable(StringRef name, enum CALLKIND &kind) {
+   unsigned int size = sizeof(CallTable)/sizeof(CallTable[0]);
+   for (unsigned int i = 0; i < size; i++) {
+      StringRef entry(CallTable[i].name);
+      bool match;
+      if (entry.endswith("."))
+         match = name.startswith(entry);
+      else
+         match = (name == entry);
+      if (match) {
+         kind = CallTable[i].kind;
+         return true;
+      }
+   }
+   return false;
+}
+
+enum CALLKIND
+CallClassify::classify(CallInst *CI) {
+   //built by ShadowCall: arguments travel with their duplicates
+   if (ShadowCall::isShadowInst(CI)) return CALL_SHADOW;
+
+   //indirect calls and inline asm always synchronise
+   Function *callee = CI->getCalledFunction();
+   if (!callee) return CALL_SYNCH;
+
+   enum CALLKIND kind;
+   if (lookupTable(callee->getName(), kind)) {
+      //a duplicated call must produce a value to compare
+      if (kind == CALL_DUPLICATE && CI->getType()->isVoidTy())
+         return CALL_IGNORE;
+      return kind;
+   }
+
+   //readnone and readonly functions: duplicate them, or ignore them if
+   //they return nothing. A readonly copy is safe because the duplicate
+   //is placed next to the original with no synch point, hence no store,
+   //in between: both calls see the same memory.
+   if (CI->doesNotAccessMemory() || CI->onlyReadsMemory()) {
+      if (CI->getType()->isVoidTy()) return CALL_IGNORE;
+      //a second call is not allowed: check the arguments once and let
+      //both streams use the same result
+      if (CI->hasFnAttr(Attribute::NoDuplicate)) return CALL_SHARE;
+      return CALL_DUPLICATE;
+   }
+
+   return CALL_SYNCH;
+}
+
+bool
+CallClassify::isSynchCall(Instruction *I) {
+   if (CallInst *CI = dyn_cast<CallInst>(I)) {
+      enum CALLKIND kind = classify(CI);
+      return (kind == CALL_SYNCH || kind == CALL_SHARE || kind == CALL_SHADOW);
+   }
+   return false;
+}
+
+bool
+CallClassify::isSharedCall(Instruction *I) {
+   if (CallInst *CI = dyn_cast<CallInst>(I))
+      return (classify(CI) == CALL_SHARE);
+   return false;
+}
+
+bool
+CallClassify::isShadowCall(Instruction *I) {
+   if (CallInst *CI = dyn_cast<CallInst>(I))
+      return (classify(CI) == CALL_SHADOW);
+   return false;
+}
+
+bool
+CallClassify::isIgnoredCall(Instruction *I) {
+   if (CallInst *CI = dyn_cast<CallInst>(I))
+      return (classify(CI) == CALL_IGNORE);
+   return false;
+}
+
+bool
+CallClassify::isDuplicableCall(Instruction *I) {
+   if (CallInst *CI = dyn_cast<CallInst>(I))
+      return (classify(CI) == CALL_DUPLICATE);
+   return false;
+}
+
+// vim: ts=3 sts=3 sw=3 et
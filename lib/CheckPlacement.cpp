@@ -0,0 +1,322 @@
+////////////////////////////////////////
+//CheckPlacement.cpp                  //
+////////////////////////////////////////
+//Frequency weighted min-cut placement//
+//of the store checks of each value   //
+////////////////////////////////////////
+
+#include "RedundOPT.h"
+#include "CheckPlacement.h"
+#include <llvm/Analysis/Dominators.h>
+#include <llvm/Analysis/BlockFrequencyInfo.h>
+#include <llvm/Analysis/BranchProbabilityInfo.h>
+#include <llvm/Support/BranchProbability.h>
+
+#include <algorithm>
+#include <queue>
+
+using namespace llvm;
+
+//bigger regions keep their checks where they are
+static const unsigned int MaxPlaceNodes = 512;
+
+///////////////////////////////////////////////////////
+///    FlowGraph                                     //
+///////////////////////////////////////////////////////
+const uint64_t FlowGraph::INF;
+
+unsigned int
+FlowGraph::addNode() {
+   adj.push_back(std::vector<Edge>());
+   return adj.size() - 1;
+}
+
+void
+FlowGraph::addEdge(unsigned int from, unsigned int to, uint64_t cap) {
+   Edge e = {to, cap, (unsigned int)adj[to].size()};
+   Edge back = {from, 0, (unsigned int)adj[from].size()};
+   adj[from].push_back(e);
+   adj[to].push_back(back);
+}
+
+//shortest augmenting paths, until t is out of reach
+uint64_t
+FlowGraph::maxFlow(unsigned int s, unsigned int t) {
+   unsigned int n = adj.size();
+   std::vector<unsigned int> prevNode(n), prevEdge(n);
+   uint64_t total = 0;
+
+   while (true) {
+      reached.assign(n, 0);
+      reached[s] = 1;
+      std::queue<unsigned int> worklist;
+      worklist.push(s);
+      while (!worklist.empty() && !reached[t]) {
+         unsigned int u = worklist.front();
+         worklist.pop();
+         for (unsigned int i = 0; i < adj[u].size(); i++) {
+            Edge &e = adj[u][i];
+            if (e.cap == 0 || reached[e.to]) continue;
+            reached[e.to] = 1;
+            prevNode[e.to] = u;
+            prevEdge[e.to] = i;
+            worklist.push(e.to);
+         }
+      }
+      if (!reached[t]) break;
+
+      uint64_t push = INF;
+      for (unsigned int v = t; v != s; v = prevNode[v])
+         push = std::min(push, adj[prevNode[v]][prevEdge[v]].cap);
+      for (unsigned int v = t; v != s; v = prevNode[v]) {
+         Edge &e = adj[prevNode[v]][prevEdge[v]];
+         e.cap -= push;
+         adj[v][e.rev].cap += push;
+      }
+      total += push;
+   }
+   return total;
+}
+
+///////////////////////////////////////////////////////
+///    placeChecks                                   //
+///////////////////////////////////////////////////////
+//removeOverlap drops a check only if a later check post-dominates it.
+//Here, for each value, the checks of its stores are placed anew: fewest
+//executed checks such that a fault in the value, once past a store that
+//no longer checks it, is still checked before a synch point. The checks
+//go to the stores or to CFG edges, the way moveToPreheader() and
+//moveOutofLoop() place theirs.
+void
+RedundAnalysis::placeChecks(CheckCodeMap *checkCodeMap, ValueCheckedAtMap *valueCheckedAtMap, Function &F, DominatorTree &DT, BlockFrequencyInfo &BFI, BranchProbabilityInfo &BPI) {
+   assert(&F == MyF && "Function changed");
+   assert(checkCodeMap == MycheckCodeMap && "MycheckCodeMap changed");
+   assert(valueCheckedAtMap == MyvalueCheckedAtMap
+         && "MyvalueCheckedAtMap changed");
+
+   localnumplaceremoved = 0;
+   localnumplaceadded = 0;
+   localnumplaceskip = 0;
+   localplacesaved = 0;
+   MyDT = &DT;
+   MyBFI = &BFI;
+   MyBPI = &BPI;
+
+#ifdef R_DEBUG
+   errs() << "\n============Place checks ("<< F.getName();
+   errs() <<") ==============\n";
+#endif
+
+   //movable check sites of every value
+   std::map<Value*, std::vector<Instruction*> > sitesOf;
+   std::map<Instruction*,CheckCode*>&codes = MycheckCodeMap->getMap();
+   for (std::map<Instruction*,CheckCode*>::iterator i=codes.begin(), e=codes.end(); i!=e; i++) {
+      if (!isMovableCheck((*i).first)) continue;
+      std::set<Value*> &elems = (*i).second->getCheckElems();
+      for (std::set<Value*>::iterator vi = elems.begin(), ve = elems.end(); vi != ve; vi++)
+         sitesOf[*vi].push_back((*i).first);
+   }
+
+   bool changed = false;
+   for (std::map<Value*, std::vector<Instruction*> >::iterator i=sitesOf.begin(), e=sitesOf.end(); i!=e; i++) {
+      if (placeChecksOnValue((*i).first, (*i).second)) changed = true;
+   }
+
+   if (changed) {
+      printPlacePassStat(F);
+   } else {
+#ifdef R_DEBUG
+      errs() << "No change...\n";
+#endif
+   }
+   MyDT = NULL;
+   MyBFI = NULL;
+   MyBPI = NULL;
+}
+
+//A store under L1 is a synch point of its own: a later check of the same
+//fault is as good as its own (see removeOverlapOnValue()).
+bool
+RedundAnalysis::isMovableCheck(Instruction *I) {
+   return MyPolicy.storeLevel == STORE_L1 && isa<StoreInst>(I) && !isPrivateAccess(I);
+}
+
+bool
+RedundAnalysis::placeChecksOnValue(Value *v, std::vector<Instruction*> &sites) {
+   PlaceRegion R;
+   R.source = R.graph.addNode();
+   R.sink = R.graph.addNode();
+
+   //checking at every site is what we have
+   uint64_t before = 0;
+   for (unsigned int i = 0; i < sites.size(); i++) {
+      Instruction *S = sites[i];
+      unsigned int in = R.graph.addNode(), out = R.graph.addNode();
+      R.sites[S] = std::make_pair(in, out);
+      R.graph.addEdge(R.source, in, FlowGraph::INF);
+      R.graph.addEdge(in, out, blockCost(S->getParent()));
+      before += blockCost(S->getParent());
+      R.toWalk.push_back(std::make_pair(out, S->getNextNode()));
+   }
+   while (!R.toWalk.empty()) {
+      if (R.graph.size() > MaxPlaceNodes) {
+         localnumplaceskip++;
+         return false;
+      }
+      std::pair<unsigned int, Instruction*> w = R.toWalk.front();
+      R.toWalk.pop_front();
+      walkFrom(v, w.first, w.second, R);
+   }
+
+   uint64_t after = R.graph.maxFlow(R.source, R.sink);
+   if (after >= before) return false;
+
+   //checks left at the sites, the others go
+   ValueCheckedAt *checkedAt = MyvalueCheckedAtMap->getValueCheckedTable(v);
+   for (unsigned int i = 0; i < sites.size(); i++) {
+      Instruction *S = sites[i];
+      if (!R.graph.sourceSide(R.sites[S].second)) continue;
+      MycheckCodeMap->deleteElem(S, v);
+      checkedAt->CheckedAtList.erase(S);
+      localnumplaceremoved++;
+   }
+   //and the cut edges get one
+   for (std::map<BasicBlock*, unsigned int>::iterator i=R.exit.begin(), e=R.exit.end(); i!=e; i++) {
+      BasicBlock *P = (*i).first;
+      if (!R.graph.sourceSide((*i).second)) continue;
+      TerminatorInst *T = P->getTerminator();
+      for (unsigned int s = 0; s < T->getNumSuccessors(); s++) {
+         if (!R.graph.sourceSide(R.entry[T->getSuccessor(s)]))
+            placeOnEdge(v, P, s);
+      }
+   }
+   localplacesaved += before - after;
+
+#ifdef R_DEBUG
+   errs() << "Place checks on " << v->getName() << ": cost " << before << " -> " << after << "\n";
+#endif
+   return true;
+}
+
+//Follow the flow from node `from` down the block, starting at `start`,
+//to where it is checked, goes on, or escapes.
+void
+RedundAnalysis::walkFrom(Value *v, unsigned int from, Instruction *start, PlaceRegion &R) {
+   BasicBlock *BB = start->getParent();
+   for (BasicBlock::iterator I = start, E = BB->end(); I != E; ++I) {
+      //a new instance of v: the faulty one was never checked
+      if (&*I == v) {
+         R.graph.addEdge(from, R.sink, FlowGraph::INF);
+         return;
+      }
+      if (CheckCode *checkcode = MycheckCodeMap->getCheckCode(I)) {
+         if (R.sites.count(I)) {
+            R.graph.addEdge(from, R.sites[I].first, FlowGraph::INF);
+            return;
+         }
+         if (checkcode->getCheckElems().count(v) || checkcode->getCheckElemList().count(v))
+            return;
+      }
+      if (isSynchPoint(I)) {
+         R.graph.addEdge(from, R.sink, FlowGraph::INF);
+         return;
+      }
+      if (isa<TerminatorInst>(I)) {
+         if (isa<BranchInst>(I))
+            R.graph.addEdge(from, exitNode(v, R, BB), FlowGraph::INF);
+         else
+            R.graph.addEdge(from, R.sink, FlowGraph::INF);
+         return;
+      }
+   }
+}
+
+unsigned int
+RedundAnalysis::entryNode(PlaceRegion &R, BasicBlock *BB) {
+   if (R.entry.count(BB)) return R.entry[BB];
+   unsigned int n = R.graph.addNode();
+   R.entry[BB] = n;
+   R.toWalk.push_back(std::make_pair(n, &BB->front()));
+   return n;
+}
+
+unsigned int
+RedundAnalysis::exitNode(Value *v, PlaceRegion &R, BasicBlock *BB) {
+   if (R.exit.count(BB)) return R.exit[BB];
+   unsigned int n = R.graph.addNode();
+   R.exit[BB] = n;
+   TerminatorInst *T = BB->getTerminator();
+   for (unsigned int s = 0; s < T->getNumSuccessors(); s++) {
+      uint64_t cap = canPlaceOnEdge(v, BB, s) ? edgeCost(BB, s) : FlowGraph::INF;
+      R.graph.addEdge(n, entryNode(R, T->getSuccessor(s)), cap);
+   }
+   return n;
+}
+
+//v must be available at the branch, and the edge must have a checker
+//block of its own
+bool
+RedundAnalysis::canPlaceOnEdge(Value *v, BasicBlock *P, unsigned int s) {
+   BranchInst *BI = cast<BranchInst>(P->getTerminator());
+   if (Instruction *def = dyn_cast<Instruction>(v))
+      if (!MyDT->dominates(def, BI)) return false;
+   if (BI->isUnconditional()) return true;
+   if (BI->getSuccessor(0) == BI->getSuccessor(1)) return false;
+
+   //moveOutofLoop() may have put v on the other side already
+   if (CheckCode *checkcode = MycheckCodeMap->getCheckCode(BI)) {
+      CheckBranch *checkbr = (CheckBranch*)(checkcode);
+      for (unsigned int t = 0; t < checkbr->PropCheckSize(); t++)
+         if (checkbr->getPropCheckValue(t) == v && checkbr->getPropTo(t) != (s == 0))
+            return false;
+   }
+   return true;
+}
+
+//an unconditional branch checks v before it, as a preheader does; a
+//conditional one in the checker block of the edge, as a loop exit does
+void
+RedundAnalysis::placeOnEdge(Value *v, BasicBlock *P, unsigned int s) {
+   BranchInst *BI = cast<BranchInst>(P->getTerminator());
+   CheckCode *checkcode = MycheckCodeMap->getCheckCode(BI);
+   if (!checkcode)
+      checkcode = MycheckCodeMap->newCheckCode(BI);
+
+   if (BI->isUnconditional()) {
+      if (checkcode->getCheckElems().count(v)) return;
+      checkcode->insertOrigElement(v);
+      MyvalueCheckedAtMap->insertPropOrFinal(v, BI);
+   } else {
+      CheckBranch *checkbr = (CheckBranch*)(checkcode);
+      checkbr->insertPropCheck(v, s == 0, false);
+   }
+   localnumplaceadded++;
+
+#ifdef R_DEBUG
+   errs() << "Place check on " << v->getName() << " at edge " << s << " of BB(" <<
+      P->getName()<<")\n";
+#endif
+}
+
+//never 0, so that fewer checks win among equally cold ones
+uint64_t
+RedundAnalysis::blockCost(BasicBlock *BB) {
+   return std::max<uint64_t>(MyBFI->getBlockFreq(BB).getFrequency(), 1);
+}
+
+uint64_t
+RedundAnalysis::edgeCost(BasicBlock *P, unsigned int s) {
+   BranchProbability prob = MyBPI->getEdgeProbability(P, s);
+   double f = (double)MyBFI->getBlockFreq(P).getFrequency() * prob.getNumerator() / prob.getDenominator();
+   return std::max<uint64_t>((uint64_t)f, 1);
+}
+
+void
+RedundAnalysis::printPlacePassStat(Function &F) {
+   errs() << "LOCAL_REDUND_CHECK "<< localnumplaceremoved <<" localnumplaceremoved ("<<F.getName()<<")\n";
+   errs() << "LOCAL_REDUND_CHECK "<< localnumplaceadded <<" localnumplaceadded ("<<F.getName()<<")\n";
+   errs() << "LOCAL_REDUND_CHECK "<< localnumplaceskip <<" localnumplaceskip ("<<F.getName()<<")\n";
+   errs() << "LOCAL_REDUND_CHECK "<< localplacesaved <<" localplacesaved ("<<F.getName()<<")\n";
+}
+
+// vim: ts=3 sts=3 sw=3 et
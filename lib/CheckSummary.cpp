@@ -0,0 +1,198 @@
+////////////////////////////////////////
+//CheckSummary.cpp                    //
+////////////////////////////////////////
+//Bottom-up parameter summaries for   //
+//caller-side argument checks.        //
+////////////////////////////////////////
+
+#define DEBUG_TYPE "check_summary"
+
+#include "CheckSummary.h"
+#include "CallClassify.h"
+#include <llvm/ADT/Statistic.h>
+#include <llvm/Support/raw_ostream.h>
+
+STATISTIC(NumUnusedParam, "Number of parameters never observed by their callee");
+STATISTIC(NumCheckedParam, "Number of parameters checked on callee entry");
+
+using namespace llvm;
+
+char CheckSummary::ID = 0;
+static RegisterPass<CheckSummary> X("CheckSum", "Summarise parameter checks of every function", false, true);
+
+////////////////////////////////////
+//runOnModule()                   //
+////////////////////////////////////
+bool CheckSummary::runOnModule(Module &M) {
+   std::set<Function*> visited;
+   std::list<Function*> order;
+
+   for (Module::iterator Fi = M.begin(), Fe = M.end(); Fi != Fe; ++Fi)
+      postOrder(Fi, visited, order);
+
+   //callees come first
+   for (std::list<Function*>::iterator i = order.begin(), e = order.end(); i != e; ++i) {
+      summarize(*i);
+#ifdef Jing_DEBUG
+      dumpSummary(*i);
+#endif
+   }
+   return false;
+}
+
+void CheckSummary::releaseMemory() {
+   summaryMap.clear();
+}
+
+////////////////////////////////////
+//postOrder()                     //
+//post order over direct calls    //
+////////////////////////////////////
+void CheckSummary::postOrder(Function *F, std::set<Function*> &visited, std::list<Function*> &order) {
+   if (F->isDeclaration() || visited.count(F)) return;
+   visited.insert(F);
+
+   for (Function::iterator BBi = F->begin(), BBe = F->end(); BBi != BBe; ++BBi)
+      for (BasicBlock::iterator Ii = BBi->begin(), Ie = BBi->end(); Ii != Ie; ++Ii)
+         if (CallInst *CI = dyn_cast<CallInst>(Ii))
+            if (Function *callee = CI->getCalledFunction())
+               postOrder(callee, visited, order);
+
+   order.push_back(F);
+}
+
+////////////////////////////////////
+//summarize()                     //
+////////////////////////////////////
+void CheckSummary::summarize(Function *F) {
+   std::vector<unsigned char> summary;
+   for (Function::arg_iterator AI = F->arg_begin(), E = F->arg_end(); AI != E; ++AI) {
+      unsigned char bits = PARAM_OBSERVED;
+      if (isUnused(AI)) {
+         bits |= PARAM_UNUSED;
+         NumUnusedParam++;
+      } else {
+         bits |= checkedOnEntry(AI);
+         if (bits & PARAM_CHECKED) NumCheckedParam++;
+      }
+      summary.push_back(bits);
+   }
+   summaryMap[F] = summary;
+}
+
+////////////////////////////////////
+//isUnused()                      //
+//arg is only used by ignored     //
+//calls, stored to a dead slot or //
+//passed to unused params         //
+////////////////////////////////////
+bool CheckSummary::isUnused(Argument *arg) {
+   for (Value::use_iterator UI = arg->use_begin(), UE = arg->use_end(); UI != UE; ++UI) {
+      //clang -O0 stores every parameter to its .addr slot; this runs
+      //before InsDup promotes them
+      if (StoreInst *SI = dyn_cast<StoreInst>(*UI)) {
+         if (SI->getValueOperand() == arg && isDeadSlot(SI->getPointerOperand())) continue;
+         return false;
+      }
+      CallInst *CI = dyn_cast<CallInst>(*UI);
+      if (!CI) return false;
+      if (CallClassify::isIgnoredCall(CI)) continue;
+
+      Function *callee = CI->getCalledFunction();
+      if (!callee || CI->getCalledValue() == arg) return false;
+      for (unsigned int j = 0, e = CI->getNumArgOperands(); j < e; j++) {
+         if (CI->getArgOperand(j) != arg) continue;
+         if (!(getParamSummary(callee, j) & PARAM_UNUSED)) return false;
+      }
+   }
+   return true;
+}
+
+//an alloca that is only stored to: nothing reads or escapes it
+bool CheckSummary::isDeadSlot(Value *ptr) {
+   AllocaInst *AI = dyn_cast<AllocaInst>(ptr);
+   if (!AI) return false;
+   for (Value::use_iterator UI = AI->use_begin(), UE = AI->use_end(); UI != UE; ++UI) {
+      if (StoreInst *SI = dyn_cast<StoreInst>(*UI)) {
+         if (SI->getPointerOperand() != AI || SI->getValueOperand() == AI || SI->isVolatile()) return false;
+         continue;
+      }
+      Instruction *I = dyn_cast<Instruction>(*UI);
+      if (I && CallClassify::isIgnoredCall(I)) continue;
+      return false;
+   }
+   return true;
+}
+
+////////////////////////////////////
+//checkedOnEntry()                //
+//Scan the entry block up to and  //
+//including the first synch point //
+////////////////////////////////////
+unsigned CheckSummary::checkedOnEntry(Argument *arg) {
+   BasicBlock *entry = &arg->getParent()->getEntryBlock();
+   for (BasicBlock::iterator Ii = entry->begin(), Ie = entry->end(); Ii != Ie; ++Ii) {
+      Instruction *I = Ii;
+      if (LoadInst *LI = dyn_cast<LoadInst>(I)) {
+         if (LI->getPointerOperand() == arg) return PARAM_CHECKED;
+         continue;
+      }
+      if (StoreInst *SI = dyn_cast<StoreInst>(I)) {
+         if (SI->getPointerOperand() == arg || SI->getValueOperand() == arg)
+            return PARAM_CHECKED;
+         return PARAM_OBSERVED;
+      }
+      if (ReturnInst *RI = dyn_cast<ReturnInst>(I)) {
+         if (RI->getReturnValue() == arg) return PARAM_CHECKED;
+         return PARAM_OBSERVED;
+      }
+      if (isa<TerminatorInst>(I)) return PARAM_OBSERVED;
+
+      if (CallInst *CI = dyn_cast<CallInst>(I)) {
+         if (!CallClassify::isSynchCall(CI)) continue;
+         unsigned bits = PARAM_OBSERVED;
+         Function *callee = CI->getCalledFunction();
+         for (unsigned int j = 0, e = CI->getNumArgOperands(); j < e; j++) {
+            if (CI->getArgOperand(j) != arg) continue;
+            if (!CallClassify::isShadowCall(CI))
+               bits |= PARAM_CHECKED; //checked at this call site
+            else if (callee && (getParamSummary(callee, j) & (PARAM_CHECKED|PARAM_FORWARDED)))
+               bits |= PARAM_FORWARDED;
+         }
+         return bits;
+      }
+   }
+   return PARAM_OBSERVED;
+}
+
+////////////////////////////////////
+//getParamSummary()               //
+////////////////////////////////////
+unsigned CheckSummary::getParamSummary(Function *F, unsigned argNo) {
+   std::map<Function*, std::vector<unsigned char> >::iterator it = summaryMap.find(F);
+   if (it == summaryMap.end()) return PARAM_OBSERVED;
+   if (argNo >= it->second.size()) return PARAM_OBSERVED;
+   return it->second[argNo];
+}
+
+bool CheckSummary::canSkipArgCheck(CallInst *CI, unsigned argNo) {
+   Function *callee = CI->getCalledFunction();
+   if (!callee || callee->isDeclaration()) return false;
+   //a weak body may be replaced by one that uses the argument
+   if (callee->mayBeOverridden()) return false;
+   return (getParamSummary(callee, argNo) & PARAM_UNUSED);
+}
+
+void CheckSummary::dumpSummary(Function *F) {
+   int unused = 0, checked = 0, forwarded = 0;
+   std::vector<unsigned char> &summary = summaryMap[F];
+   for (unsigned int i = 0; i < summary.size(); i++) {
+      if (summary[i] & PARAM_UNUSED) unused++;
+      if (summary[i] & PARAM_CHECKED) checked++;
+      if (summary[i] & PARAM_FORWARDED) forwarded++;
+   }
+   errs() << "CALLEE_SUMMARY " << unused << " unused " << checked << " checked "
+      << forwarded << " forwarded (" << F->getName() << ")\n";
+}
+
+// vim: ts=3 sts=3 sw=3 et
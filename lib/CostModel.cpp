@@ -0,0 +1,264 @@
+////////////////////////////////////////
+//CostModel.cpp                       //
+////////////////////////////////////////
+//Rank checks and duplicated slices by//
+//benefit per cost, keep the best ones//
+//within the overhead budget.         //
+////////////////////////////////////////
+
+#include "CostModel.h"
+#include <llvm/Support/raw_ostream.h>
+
+#include <queue>
+
+using namespace llvm;
+
+//a slice stops growing here; what is beyond is left unprotected
+#define MAX_SLICE 64
+
+//sink weights: a wrong store address or branch corrupts more than a
+//wrong stored value or argument
+#define WEIGHT_STORE_ADDR 4
+#define WEIGHT_LOAD_ADDR  3
+#define WEIGHT_BRANCH     3
+#define WEIGHT_VALUE      2
+
+CostModel::CostModel(Function &F, BlockFrequencyInfo &BFI) {
+   MyF = &F;
+   MyBFI = &BFI;
+   extraCost = 0;
+   dropCost = 0;
+   localnumbudgetcand = 0;
+   localnumbudgetdrop = 0;
+   localnumbudgetunprot = 0;
+
+   baseCost = 0;
+   for (Function::iterator BBi = F.begin(), BBE = F.end(); BBi!=BBE; ++BBi)
+      for (BasicBlock::iterator I = BBi->begin(), E = BBi->end(); I != E; ++I)
+         baseCost += cost(I);
+}
+
+uint64_t CostModel::freq(BasicBlock *BB) {
+   uint64_t f = MyBFI->getBlockFreq(BB).getFrequency();
+   return f ? f : 1;
+}
+
+////////////////////////////////////
+//latency()                       //
+//rough cycles of one instruction //
+////////////////////////////////////
+unsigned int CostModel::latency(Instruction *I) {
+   switch (I->getOpcode()) {
+      case Instruction::PHI:
+         return 0;
+      case Instruction::Mul:
+         return 3;
+      case Instruction::FAdd:
+      case Instruction::FSub:
+      case Instruction::FPToUI:
+      case Instruction::FPToSI:
+      case Instruction::UIToFP:
+      case Instruction::SIToFP:
+      case Instruction::Load:
+         return 4;
+      case Instruction::FMul:
+         return 5;
+      case Instruction::Call:
+         return 10;
+      case Instruction::UDiv:
+      case Instruction::SDiv:
+      case Instruction::URem:
+      case Instruction::SRem:
+      case Instruction::FDiv:
+      case Instruction::FRem:
+         return 20;
+      default:
+         return 1;
+   }
+}
+
+////////////////////////////////////
+//select()                        //
+////////////////////////////////////
+struct RankedCandidate {
+   double ratio;
+   unsigned int index;
+   bool operator<(const RankedCandidate &o) const {return ratio < o.ratio;}
+};
+
+void CostModel::select(CheckCodeMap *checkCodeMap, unsigned int budget) {
+   candidates.clear();
+   protectedSet.clear();
+   droppedBr.clear();
+   addCheckCandidates(checkCodeMap);
+   addBranchCandidates(checkCodeMap);
+   localnumbudgetcand = candidates.size();
+
+   //checks already moved to loop exits are cheap and stay
+   std::vector<bool> accepted(candidates.size(), false);
+   std::priority_queue<RankedCandidate> ranked;
+   for (unsigned int c = 0; c < candidates.size(); c++) {
+      if (candidates[c].mandatory) {
+         extraCost += marginalCost(candidates[c]);
+         accept(candidates[c]);
+         accepted[c] = true;
+      }
+   }
+   for (unsigned int c = 0; c < candidates.size(); c++) {
+      if (accepted[c]) continue;
+      RankedCandidate r;
+      r.index = c;
+      r.ratio = (double)marginalBenefit(candidates[c]) / (double)marginalCost(candidates[c]);
+      ranked.push(r);
+   }
+
+   //greedy on benefit per cost. Accepting a candidate makes the slices
+   //it shares with others cheaper and less useful for them, so a ratio
+   //is recomputed when popped and pushed back if it went down.
+   uint64_t allowed = baseCost / 100 * budget + baseCost % 100 * budget / 100;
+   while (!ranked.empty()) {
+      RankedCandidate r = ranked.top();
+      ranked.pop();
+      Candidate &c = candidates[r.index];
+      uint64_t mc = marginalCost(c);
+      double ratio = (double)marginalBenefit(c) / (double)mc;
+      if (ratio < r.ratio && !ranked.empty() && ratio < ranked.top().ratio) {
+         r.ratio = ratio;
+         ranked.push(r);
+         continue;
+      }
+      if (extraCost + mc > allowed) continue;
+      extraCost += mc;
+      accept(c);
+      accepted[r.index] = true;
+   }
+
+   //drop the rest
+   for (unsigned int c = 0; c < candidates.size(); c++) {
+      if (accepted[c]) continue;
+      Candidate &cand = candidates[c];
+      dropCost += cand.checkCost;
+      localnumbudgetdrop++;
+      if (BranchInst *BI = dyn_cast<BranchInst>(cand.sink)) droppedBr.insert(BI);
+      if (CheckCode *code = checkCodeMap->getCheckCode(cand.sink)) code->drop();
+   }
+}
+
+////////////////////////////////////
+//addCheckCandidates()            //
+//one per load, store, call and   //
+//return check                    //
+////////////////////////////////////
+void CostModel::addCheckCandidates(CheckCodeMap *checkCodeMap) {
+   std::map<Instruction*,CheckCode*>&codes = checkCodeMap->getMap();
+   for (std::map<Instruction*,CheckCode*>::iterator i=codes.begin(), e=codes.end(); i!=e; i++) {
+      Instruction *I = (*i).first;
+      //branches are handled with their duplication
+      if (isa<BranchInst>(I)) continue;
+      std::set<Value*> &elems = (*i).second->getCheckElemList();
+      if (elems.empty()) continue;
+
+      Candidate c;
+      c.sink = I;
+      c.mandatory = false;
+      c.weight = WEIGHT_VALUE;
+      if (isa<LoadInst>(I)) c.weight = WEIGHT_LOAD_ADDR;
+      for (std::set<Value*>::iterator ei = elems.begin(), ee = elems.end(); ei != ee; ei++) {
+         c.elems.push_back(*ei);
+         computeSlice(*ei, c.slice);
+         //anything but the stored value is (part of) the address
+         if (isa<StoreInst>(I) && *ei != I->getOperand(0)) c.weight = WEIGHT_STORE_ADDR;
+      }
+      c.checkCost = freq(I->getParent()) * 2 * elems.size(); //compare and branch
+      candidates.push_back(c);
+   }
+}
+
+////////////////////////////////////
+//addBranchCandidates()           //
+//one per conditional branch, with//
+//the checks attached to it       //
+////////////////////////////////////
+void CostModel::addBranchCandidates(CheckCodeMap *checkCodeMap) {
+   for (Function::iterator BBi = MyF->begin(), BBE = MyF->end(); BBi!=BBE; ++BBi) {
+      BranchInst *BI = dyn_cast<BranchInst>(BBi->getTerminator());
+      if (!BI || !BI->isConditional()) continue;
+      Instruction *cond = dyn_cast<Instruction>(BI->getCondition());
+      if (!cond) continue;
+
+      Candidate c;
+      c.sink = BI;
+      c.mandatory = false;
+      c.weight = WEIGHT_BRANCH;
+      c.elems.push_back(cond);
+      computeSlice(cond, c.slice);
+      //DuplicaBr recomputes the condition and branches on one side
+      c.checkCost = freq(BI->getParent()) * (latency(cond) + 1);
+
+      if (CheckCode *code = checkCodeMap->getCheckCode(BI)) {
+         CheckBranch *checkbr = (CheckBranch*)code;
+         std::set<Value*> &elems = checkbr->getCheckElemList();
+         for (std::set<Value*>::iterator ei = elems.begin(), ee = elems.end(); ei != ee; ei++) {
+            c.elems.push_back(*ei);
+            computeSlice(*ei, c.slice);
+            c.checkCost += freq(BI->getParent()) * 2;
+         }
+         for (unsigned int p = 0; p < checkbr->PropCheckSize(); p++) {
+            c.elems.push_back(checkbr->getPropCheckValue(p));
+            computeSlice(checkbr->getPropCheckValue(p), c.slice);
+            c.mandatory = true;
+         }
+      }
+      candidates.push_back(c);
+   }
+}
+
+////////////////////////////////////
+//computeSlice()                  //
+//instructions whose faults reach v//
+////////////////////////////////////
+//Loads have their own check and calls their own arguments, so the slice
+//ends there.
+void CostModel::computeSlice(Value *v, std::set<Instruction*> &slice) {
+   std::vector<Instruction*> worklist;
+   if (Instruction *I = dyn_cast<Instruction>(v)) worklist.push_back(I);
+
+   while (!worklist.empty() && slice.size() < MAX_SLICE) {
+      Instruction *I = worklist.back();
+      worklist.pop_back();
+      if (isa<LoadInst>(I) || isa<AllocaInst>(I) || slice.count(I)) continue;
+      slice.insert(I);
+      if (isa<CallInst>(I)) continue;
+      for (unsigned int op = 0; op < I->getNumOperands(); op++)
+         if (Instruction *opI = dyn_cast<Instruction>(I->getOperand(op)))
+            worklist.push_back(opI);
+   }
+}
+
+uint64_t CostModel::marginalCost(Candidate &c) {
+   uint64_t mc = c.checkCost;
+   for (std::set<Instruction*>::iterator i = c.slice.begin(), e = c.slice.end(); i != e; i++)
+      if (protectedSet.count(*i) == 0) mc += cost(*i);
+   return mc ? mc : 1;
+}
+
+uint64_t CostModel::marginalBenefit(Candidate &c) {
+   uint64_t mb = freq(c.sink->getParent());
+   for (std::set<Instruction*>::iterator i = c.slice.begin(), e = c.slice.end(); i != e; i++)
+      if (protectedSet.count(*i) == 0) mb += cost(*i);
+   return mb * c.weight;
+}
+
+void CostModel::accept(Candidate &c) {
+   protectedSet.insert(c.slice.begin(), c.slice.end());
+}
+
+void CostModel::printStat(Function &F) {
+   errs() << "local budget candidates: " << localnumbudgetcand << " (" << F.getName() <<")\n";
+   errs() << "local budget dropped checks: " << localnumbudgetdrop << " (" << F.getName() <<")\n";
+   errs() << "local budget unprotected instructions: " << localnumbudgetunprot << " (" << F.getName() <<")\n";
+   errs() << "local budget estimated cost: base " << baseCost << ", added " << extraCost
+      << ", saved " << dropCost << " (" << F.getName() <<")\n";
+}
+
+// vim: ts=3 sts=3 sw=3 et
@@ -8,8 +8,8 @@
 #include <assert.h>
 using namespace std;
 
-void ParIFDuplica::DupImplement(std::list<ChildrenSet*> *HeadNodeList){
-   std::list<ChildrenSet*>::iterator iter;
+void ParIFDuplica::DupImplement(const std::list<ChildrenSet*> *HeadNodeList){
+   std::list<ChildrenSet*>::const_iterator iter;
    ChildrenSet * SCHead;
 
    //initialize a map that associates "global" value and its duplica
@@ -23,6 +23,14 @@ void ParIFDuplica::DupImplement(std::list<ChildrenSet*> *HeadNodeList){
       //find a proper position inside SCHead to duplicate all variables that were used by this set but were generated by previous blocks
       Instruction *HeadInsertBF = findPosin(SCHead);
 
+      //too much code for this set: every branch only checks itself
+      if (ReplicaBudgetOpt > 0 && replicaCost(SCHead, HeadInsertBF) > ReplicaBudgetOpt) {
+         checkBranchesOnly(SCHead);
+         localnumoverbudget++;
+      }
+      //replicas of this set, shared between its edges
+      ReplicaMap replicas;
+
       //work through midnodeset. The access order is not important.
       std::list<ChildrenSet*>WorkList;
       WorkList.push_front(SCHead);
@@ -43,10 +51,10 @@ void ParIFDuplica::DupImplement(std::list<ChildrenSet*> *HeadNodeList){
          WorkList.pop_front();
 
          //work on out1 edge
-         ImplementonEdge(thisnode->out0,0,valueMap,HeadInsertBF);
+         ImplementonEdge(thisnode->out0,0,valueMap,HeadInsertBF,replicas);
 
          //work on out2 edge
-         ImplementonEdge(thisnode->out1,1,valueMap,HeadInsertBF);
+         ImplementonEdge(thisnode->out1,1,valueMap,HeadInsertBF,replicas);
 
       }
    }//end of for
@@ -81,56 +89,123 @@ bool ParIFDuplica::noEffect(Instruction *i) {
 }
 
 //Implement duplication on the edge
-bool ParIFDuplica::ImplementonEdge(Edge *theEdge,unsigned int fromOP,std::map<Value*,Value*>&valueMap,Instruction *HeadInsertBF ) {
+//The chain of replicas is built from toBB backwards: a replica with the
+//same base block, side and successor as one of another edge of the set
+//is the same code, and is shared.
+bool ParIFDuplica::ImplementonEdge(Edge *theEdge,unsigned int fromOP,std::map<Value*,Value*>&valueMap,Instruction *HeadInsertBF,ReplicaMap &replicas) {
 
    //get Rep on that edge
    std::list<Rep*> *RepList = theEdge->getfinalRep();
    if (RepList->empty()) return false; //no need to update the link
 
-   NumReplicatedBB += RepList->size();
-   localnumreplicatedBB += RepList->size();
-
    BasicBlock *fromBB = theEdge->getFrom()->getBB();
    BasicBlock *toBB = theEdge->getTo();
 
    BranchInst *fromBBBranchI = dyn_cast<BranchInst>(fromBB->getTerminator());
    assert((fromBBBranchI->getSuccessor(fromOP) == toBB) && "Error: SC construction is corrupted");
 
-   BasicBlock *currentBBlink = fromBB;
-   BranchInst *currentBI = fromBBBranchI;
+   //the replica that feeds the PHIs of toBB belongs to this edge only
+   bool shareLast = !isa<PHINode>(toBB->begin());
+   BasicBlock *next = toBB;
+   BasicBlock *lastReplica = NULL;
 
-   std::list<Rep*>::iterator RepListiter;
-   for (RepListiter = RepList->begin(); RepListiter != RepList->end(); RepListiter++) {
+   std::list<Rep*>::reverse_iterator RepListiter;
+   for (RepListiter = RepList->rbegin(); RepListiter != RepList->rend(); RepListiter++) {
       Rep *thisRep = *RepListiter;
-      BasicBlock *BBtobeDup = thisRep->getBB();
-
-      //make a dup of BBtobeDup
-      BasicBlock *DupBB = RepBlock(BBtobeDup,valueMap,HeadInsertBF,toBB);
-
-      //link currentBBlink (operand) to CloneBB
-      currentBI->setSuccessor(fromOP,DupBB);
-
-      //update currentBBlink and curentBI
-      currentBBlink = DupBB;
-      currentBI = dyn_cast<BranchInst>(currentBBlink->getTerminator());
-      assert(currentBI && "Error: last instruction must be a terminator");
-
-      //set CloneBB's outgoing edge that points to ERROR block
       unsigned int correctBranch = (thisRep->getOntrueside()?0:1);
       unsigned int errorBranch = (correctBranch==0?1:0);
-      setbranchtoError(currentBI, errorBranch);
-
-      fromOP = correctBranch;
+      ReplicaKey key(std::make_pair(thisRep->getBB(), thisRep->getOntrueside()), next);
+      bool share = (next != toBB || shareLast);
+
+      BasicBlock *DupBB;
+      if (share && replicas.count(key)) {
+         DupBB = replicas[key];
+         NumSharedBB++;
+         localnumsharedBB++;
+      } else {
+         //make a dup of BBtobeDup
+         DupBB = RepBlock(thisRep->getBB(),valueMap,HeadInsertBF,toBB);
+         BranchInst *DupBI = dyn_cast<BranchInst>(DupBB->getTerminator());
+         assert(DupBI && "Error: last instruction must be a terminator");
+
+         //the correct side goes on, the other one to the ERROR block
+         DupBI->setSuccessor(correctBranch,next);
+         setbranchtoError(DupBI, errorBranch);
+         sites.addSite(DupBI, correctBranch);
+         if (share) replicas[key] = DupBB;
+         NumReplicatedBB++;
+         localnumreplicatedBB++;
+      }
+      if (!lastReplica) lastReplica = DupBB;
+      next = DupBB;
    }
 
-   //link currentBBlink to toBB
-   currentBI->setSuccessor(fromOP,toBB);
+   //link fromBB to the first replica
+   fromBBBranchI->setSuccessor(fromOP,next);
    //if toBB has PhINode
-   if (isa<PHINode>(toBB->begin())) UpdateIncomeSource(toBB,fromBB,currentBBlink);
+   if (isa<PHINode>(toBB->begin())) UpdateIncomeSource(toBB,fromBB,lastReplica);
    return true;
 
 }
 
+//Instructions ImplementonEdge() would replicate for the set of SCHead,
+//shared replicas counted once
+unsigned int ParIFDuplica::replicaCost(ChildrenSet *SCHead, Instruction *HeadInsertBF) {
+   std::vector<ChildrenSet*> nodes(1, SCHead);
+   std::set<ChildrenSet*> *midnodeset = SCHead->getSCmidnodeset();
+   nodes.insert(nodes.end(), midnodeset->begin(), midnodeset->end());
+
+   //the successor of a replica is its entry here, or a position of this
+   //edge's list when it can not be shared
+   std::set<ReplicaKey> seen;
+   unsigned int cost = 0;
+   for (unsigned int n = 0; n < nodes.size(); n++) {
+      Edge *outs[2] = {nodes[n]->out0, nodes[n]->out1};
+      for (unsigned int o = 0; o < 2; o++) {
+         std::list<Rep*> *RepList = outs[o]->getfinalRep();
+         BasicBlock *toBB = outs[o]->getTo();
+         bool shareLast = !isa<PHINode>(toBB->begin());
+         const void *next = toBB;
+         std::list<Rep*>::reverse_iterator RepListiter;
+         for (RepListiter = RepList->rbegin(); RepListiter != RepList->rend(); RepListiter++) {
+            Rep *thisRep = *RepListiter;
+            ReplicaKey key(std::make_pair(thisRep->getBB(), thisRep->getOntrueside()), next);
+            if (next != toBB || shareLast) {
+               std::pair<std::set<ReplicaKey>::iterator, bool> added = seen.insert(key);
+               if (added.second) cost += replicaSize(thisRep->getBB(), HeadInsertBF);
+               next = &*added.first;
+            } else {
+               cost += replicaSize(thisRep->getBB(), HeadInsertBF);
+               next = &*RepListiter;
+            }
+         }
+      }
+   }
+   return cost;
+}
+
+//what RepBlock() copies of BB
+unsigned int ParIFDuplica::replicaSize(BasicBlock *BB, Instruction *HeadInsertBF) {
+   BasicBlock::iterator first = BB->begin();
+   if (HeadInsertBF->getParent() == BB) first = HeadInsertBF;
+   return std::distance(first, BB->end());
+}
+
+//Replace the Reps of the set by one replica of each node on both of its
+//edges: its branch is checked, the conditions it skips are not
+void ParIFDuplica::checkBranchesOnly(ChildrenSet *SCHead) {
+   std::vector<ChildrenSet*> nodes(1, SCHead);
+   std::set<ChildrenSet*> *midnodeset = SCHead->getSCmidnodeset();
+   nodes.insert(nodes.end(), midnodeset->begin(), midnodeset->end());
+   for (unsigned int n = 0; n < nodes.size(); n++) {
+      ChildrenSet *node = nodes[n];
+      node->out0->clearReps();
+      node->out0->insertRep(SCDetector->newRep(node->getBB(), true));
+      node->out1->clearReps();
+      node->out1->insertRep(SCDetector->newRep(node->getBB(), false));
+   }
+}
+
 //duplicate this BB, place it before beforeBB, return it
 //The branch targets are left uncared
 BasicBlock * ParIFDuplica::RepBlock(BasicBlock *thisBB,std::map<Value*,Value*>&valueMap,Instruction* HeadInsertBF, BasicBlock *beforeBB)
@@ -0,0 +1,175 @@
+////////////////////////////////////////
+//IFDuplica.cpp                       //
+////////////////////////////////////////
+//-InsDup with the shortcut replicas  //
+//of the nested-if sets: one error    //
+//block, one valueMap, no double      //
+//checked branch                      //
+////////////////////////////////////////
+
+#define DEBUG_TYPE "if_duplica"
+
+#include "IFDuplica.h"
+#include "LockInst.h"
+#include <llvm/ADT/Statistic.h>
+#include <llvm/Support/raw_ostream.h>
+
+using namespace llvm;
+
+STATISTIC(NumCoveredBr, "Number of branches checked by shortcut replicas");
+STATISTIC(NumReplica, "Number of shortcut replica blocks");
+
+char ParIfDuplica::ID = 0;
+char FullIfDuplica::ID = 0;
+static RegisterPass<ParIfDuplica> X("IFInsDup", "Duplicate all Instructions, partially duplicate shortcut IFs");
+static RegisterPass<FullIfDuplica> Y("FullIFInsDup", "Duplicate all Instructions, fully duplicate shortcut IFs");
+
+void IfDuplica::getAnalysisUsage(AnalysisUsage &AU) const {
+   InsDuplica::getAnalysisUsage(AU);
+   AU.addRequired<ShortcutDetectorPass>();
+}
+
+////////////////////////////////////
+//DuplicaAllBB()                  //
+////////////////////////////////////
+//The sets are chosen once the redundant checks and the cost model are
+//known, and their replicas built once every condition has a duplicate.
+void IfDuplica::DuplicaAllBB(Function &F) {
+   localnumcoveredbr = 0;
+   localnumreplica = 0;
+   localnumsharedreplica = 0;
+   coveredBr.clear();
+   coveredSets.clear();
+   BBupdateMap.clear();
+
+   ShortcutDetectorPass &SCDetector = getAnalysis<ShortcutDetectorPass>();
+   SCDetector.propagateReps(repMode);
+   const std::list<ChildrenSet*> &HeadNodeList = SCDetector.getHeadNodeList();
+   for (std::list<ChildrenSet*>::const_iterator iter = HeadNodeList.begin(); iter != HeadNodeList.end(); iter++) {
+      if (!canCover(*iter)) continue;
+      coveredSets.push_back(*iter);
+      std::vector<ChildrenSet*> nodes;
+      setNodes(*iter, nodes);
+      for (unsigned int n = 0; n < nodes.size(); n++)
+         specialDupBB(nodes[n]);
+   }
+   localnumcoveredbr = coveredBr.size();
+   NumCoveredBr += localnumcoveredbr;
+
+   InsDuplica::DuplicaAllBB(F);
+
+   for (unsigned int i = 0; i < coveredSets.size(); i++) {
+      //replicas of this set, shared between its edges
+      ReplicaMap replicas;
+      std::vector<ChildrenSet*> nodes;
+      setNodes(coveredSets[i], nodes);
+      for (unsigned int n = 0; n < nodes.size(); n++) {
+         ImplementonEdge(nodes[n]->out0, 0, replicas);
+         ImplementonEdge(nodes[n]->out1, 1, replicas);
+      }
+   }
+   coveredBr.clear();
+
+   errs() << "local branches covered by shortcut replicas: " << localnumcoveredbr << "\n";
+   errs() << "local shortcut replicas: " << localnumreplica << "\n";
+   errs() << "local shared shortcut replicas: " << localnumsharedreplica << "\n";
+}
+
+//A set is left to DuplicaBr() if one of its branches has checks to place
+//on its edges, or is dropped by the cost model
+bool IfDuplica::canCover(ChildrenSet *SCHead) {
+   std::vector<ChildrenSet*> nodes;
+   setNodes(SCHead, nodes);
+   for (unsigned int n = 0; n < nodes.size(); n++) {
+      BranchInst *BI = dyn_cast<BranchInst>(nodes[n]->getBB()->getTerminator());
+      if (!BI || !BI->isConditional() || !isa<Instruction>(BI->getCondition()))
+         return false;
+      if (costModel && costModel->isBranchDropped(BI))
+         return false;
+      if (CheckCode *checkcode = mycheckCodeMap->getCheckCode(BI))
+         if (((CheckBranch*)checkcode)->PropCheckSize() > 0)
+            return false;
+   }
+   return true;
+}
+
+//DuplicaBr() only duplicates the condition of the node, its replicas
+//check the branch
+void IfDuplica::specialDupBB(ChildrenSet *node) {
+   BranchInst *BI = cast<BranchInst>(node->getBB()->getTerminator());
+   BBupdateMap[node->getBB()] = BI;
+   coveredBr.insert(BI);
+}
+
+//the head and its midnodes
+void IfDuplica::setNodes(ChildrenSet *SCHead, std::vector<ChildrenSet*> &nodes) {
+   std::set<ChildrenSet*> *midnodeset = SCHead->getSCmidnodeset();
+   nodes.assign(1, SCHead);
+   nodes.insert(nodes.end(), midnodeset->begin(), midnodeset->end());
+}
+
+//The chain of replicas of the edge, built from toBB backwards as in
+//ParIFDup. The branch of the edge may now end a split tail of its block.
+bool IfDuplica::ImplementonEdge(Edge *theEdge, unsigned int fromOP, ReplicaMap &replicas) {
+   std::list<Rep*> *RepList = theEdge->getfinalRep();
+   if (RepList->empty()) return false;
+
+   BranchInst *fromBI = BBupdateMap[theEdge->getFrom()->getBB()];
+   BasicBlock *fromBB = fromBI->getParent();
+   BasicBlock *toBB = theEdge->getTo();
+   assert((fromBI->getSuccessor(fromOP) == toBB) && "Error: SC construction is corrupted");
+
+   //the replica that feeds the PHIs of toBB belongs to this edge only
+   bool shareLast = !isa<PHINode>(toBB->begin());
+   BasicBlock *next = toBB;
+   BasicBlock *lastReplica = NULL;
+
+   std::list<Rep*>::reverse_iterator RepListiter;
+   for (RepListiter = RepList->rbegin(); RepListiter != RepList->rend(); RepListiter++) {
+      Rep *thisRep = *RepListiter;
+      ReplicaKey key(std::make_pair(thisRep->getBB(), thisRep->getOntrueside()), next);
+      bool share = (next != toBB || shareLast);
+
+      BasicBlock *DupBB;
+      if (share && replicas.count(key)) {
+         DupBB = replicas[key];
+         localnumsharedreplica++;
+      } else {
+         DupBB = RepBrBlock(thisRep, next, toBB);
+         if (share) replicas[key] = DupBB;
+      }
+      if (!lastReplica) lastReplica = DupBB;
+      next = DupBB;
+   }
+
+   fromBI->setSuccessor(fromOP, next);
+   updatePHInodesBB(toBB, fromBB, lastReplica);
+   return true;
+}
+
+//A branch on the duplicated condition of the base block: its side goes
+//on to next, the other one to the error block
+BasicBlock *IfDuplica::RepBrBlock(Rep *thisRep, BasicBlock *next, BasicBlock *toBB) {
+   Lock& LockIns = getAnalysis<Lock>();
+   BasicBlock *baseBB = thisRep->getBB();
+   Value *cond = BBupdateMap[baseBB]->getCondition();
+   if (valueMap.count(cond) > 0) cond = valueMap[cond];
+
+   std::string newName = baseBB->getName().str()+"_dup_"+toBB->getName().str();
+   BasicBlock *DupBB = BasicBlock::Create(baseBB->getContext(), newName, baseBB->getParent(), toBB);
+
+   BranchInst *DupBI;
+   if (thisRep->getOntrueside())
+      DupBI = BranchInst::Create(next, errorBlock, cond, DupBB);
+   else
+      DupBI = BranchInst::Create(errorBlock, next, cond, DupBB);
+   sites.addSite(DupBI, thisRep->getOntrueside() ? 0 : 1);
+   LockIns.lock_inst(DupBI);
+
+   NumReplica++;
+   localnumreplica++;
+   localnuminsdup++;
+   return DupBB;
+}
+
+// vim: ts=3 sts=3 sw=3 et
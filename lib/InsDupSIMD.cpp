@@ -0,0 +1,164 @@
+////////////////////////////////////////
+//InsDupSIMD.cpp                      //
+////////////////////////////////////////
+//-InsDup with the arithmetic and its //
+//duplicate in two lanes of one       //
+//vector operation                    //
+////////////////////////////////////////
+
+#define DEBUG_TYPE "simd_duplica"
+
+#include "InsDupSIMD.h"
+#include "LockInst.h"
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Operator.h>
+#include <llvm/ADT/Statistic.h>
+#include <llvm/Support/raw_ostream.h>
+
+using namespace llvm;
+
+STATISTIC(NumPacked, "Number of duplicated pairs run as one vector op");
+
+char InsDupSIMD::ID = 0;
+static RegisterPass<InsDupSIMD> X("InsDupSIMD", "Duplicate all Instructions, arithmetic in two vector lanes");
+
+void InsDupSIMD::DuplicaAllBB(Function &F) {
+   localnumpacked = 0;
+   localnumlanein = 0;
+   packedMap.clear();
+   laneMap.clear();
+   lane0s.clear();
+
+   InsDuplica::DuplicaAllBB(F);
+   replaceOriginals();
+
+   errs() << "local packed pairs: " << localnumpacked << " (" << F.getName() <<")\n";
+   errs() << "local values moved into lanes: " << localnumlanein << " (" << F.getName() <<")\n";
+}
+
+//Opcodes SSE2 runs on two lanes in one instruction. Integer multiplies
+//and shifts by a register would be split into scalars again.
+bool InsDupSIMD::packable(Instruction *I) {
+   BinaryOperator *BO = dyn_cast<BinaryOperator>(I);
+   if (!BO) return false;
+   Type *ty = I->getType();
+   switch (BO->getOpcode()) {
+      case Instruction::Add:
+      case Instruction::Sub:
+      case Instruction::And:
+      case Instruction::Or:
+      case Instruction::Xor:
+         return ty->isIntegerTy(32) || ty->isIntegerTy(64);
+      case Instruction::FAdd:
+      case Instruction::FSub:
+      case Instruction::FMul:
+      case Instruction::FDiv:
+         return ty->isFloatTy() || ty->isDoubleTy();
+      default:
+         return false;
+   }
+}
+
+//Moving a value into its lanes costs two instructions, more than a
+//scalar duplicate: pack only what continues or ends a chain.
+bool InsDupSIMD::worthPacking(Instruction *I) {
+   for (unsigned int i = 0; i < I->getNumOperands(); i++)
+      if (packedMap.count(I->getOperand(i))) return true;
+   for (Value::use_iterator ui = I->use_begin(), ue = I->use_end(); ui != ue; ++ui)
+      if (Instruction *U = dyn_cast<Instruction>(*ui))
+         if (U->getType() == I->getType() && packable(U)) return true;
+   return false;
+}
+
+//V as <orig, dup>; NULL while the duplicate of V is not known
+Value *InsDupSIMD::getPacked(Value *V, Instruction *insertBefore) {
+   if (packedMap.count(V)) return packedMap[V];
+   if (Constant *C = dyn_cast<Constant>(V)) return ConstantVector::getSplat(2, C);
+
+   std::pair<Value*, BasicBlock*> key(V, insertBefore->getParent());
+   if (laneMap.count(key)) return laneMap[key];
+
+   Value *dup = V;
+   if (valueMap.count(V) > 0) dup = valueMap[V];
+   else if (duplicable(V)) return NULL;
+
+   Type *i32 = Type::getInt32Ty(V->getContext());
+   Value *vec = UndefValue::get(VectorType::get(V->getType(), 2));
+   vec = InsertElementInst::Create(vec, V, ConstantInt::get(i32, 0), V->getName()+"_l0", insertBefore);
+   vec = InsertElementInst::Create(vec, dup, ConstantInt::get(i32, 1), V->getName()+"_l1", insertBefore);
+   laneMap[key] = vec;
+
+   localnumlanein++;
+   NumInsDup += 2;
+   localnuminsdup += 2;
+   return vec;
+}
+
+////////////////////////////////
+//DuplicaInst()               //
+//I and its duplicate as one  //
+//<2 x T> op, if it pays      //
+////////////////////////////////
+void InsDupSIMD::DuplicaInst(Instruction *I, Instruction *insertBefore) {
+   //lane 0 takes the place of I, so the op must sit where I is
+   if (insertBefore != I || !packable(I) || !worthPacking(I)) {
+      InsDuplica::DuplicaInst(I, insertBefore);
+      return;
+   }
+   Value *a = getPacked(I->getOperand(0), I);
+   Value *b = a ? getPacked(I->getOperand(1), I) : NULL;
+   if (!b) {
+      InsDuplica::DuplicaInst(I, insertBefore);
+      return;
+   }
+
+   Lock& LockIns = getAnalysis<Lock>();
+   Type *i32 = Type::getInt32Ty(I->getContext());
+   BinaryOperator *BO = cast<BinaryOperator>(I);
+   BinaryOperator *vecOp = BinaryOperator::Create(BO->getOpcode(), a, b, I->getName()+"_v", I);
+   if (isa<OverflowingBinaryOperator>(BO)) {
+      vecOp->setHasNoUnsignedWrap(BO->hasNoUnsignedWrap());
+      vecOp->setHasNoSignedWrap(BO->hasNoSignedWrap());
+   }
+   //locked, or -O2 would see both lanes are the same; the lock keeps
+   //nuw/nsw but no fast-math flags, so the lanes run strict FP
+   Instruction *vec = LockIns.lock_inst(vecOp);
+
+   Instruction *lane0 = ExtractElementInst::Create(vec, ConstantInt::get(i32, 0), I->getName()+"_l0", I);
+   Instruction *lane1 = ExtractElementInst::Create(vec, ConstantInt::get(i32, 1), I->getName()+"_dup", I);
+   InstDupMap::tagDup(I, lane1);
+
+   packedMap[I] = vec;
+   lane0s.push_back(std::make_pair(I, lane0));
+   valueMap[I] = lane1;
+   updateUsersMap(I, lane1);
+
+   localnumpacked++;
+   NumPacked++;
+   //the op and lane 1 are the duplicate, lane 0 replaces I
+   NumInsDup += 2;
+   localnuminsdup += 2;
+}
+
+////////////////////////////////
+//replaceOriginals()          //
+//the scalar originals go, now//
+//that nothing looks them up  //
+////////////////////////////////
+void InsDupSIMD::replaceOriginals() {
+   for (unsigned int i = 0; i < lane0s.size(); i++) {
+      Instruction *I = lane0s[i].first;
+      Instruction *lane0 = lane0s[i].second;
+      I->replaceAllUsesWith(lane0);
+      lane0->takeName(I);
+      //lane 0 is the original now, for the overhead tags
+      origInsts.erase(I);
+      origInsts.insert(lane0);
+      I->eraseFromParent();
+   }
+   lane0s.clear();
+   packedMap.clear();
+   laneMap.clear();
+}
+
+// vim: ts=3 sts=3 sw=3 et
@@ -9,21 +9,34 @@
 
 //Protect br with redundant branches.
 
-//#define FUNC_DEBUG 1
-
 #define DEBUG_TYPE "ins_duplica"
-#define REG_SAFE 1
+//Register safe, private slots, loop hoisting and sampling are chosen per
+//function by ProtectPolicy (-ifdup-* options, "ifdup-policy" attribute).
+//Sampling: inside loops, differences are or-ed into an accumulator that
+//is checked every sampleRate iterations and at the loop exits. Store
+//addresses stay exact, as the accumulator and countdowns are in memory.
+//Store signatures: the same in store-dense loops, for store checks only,
+//and checked at the loop exits alone (StoreVAtool.h).
 
 #include "RedundOPT.h"
 #include "InsDuplica.h"
+#include "InsStDuplica.h"
+#include "stld.h"
 #include <llvm/Analysis/LoopInfo.h>
 #include <llvm/ADT/PostOrderIterator.h>
 #include <llvm/Analysis/PostDominators.h>
+#include <llvm/Analysis/ScalarEvolution.h>
+#include <llvm/Analysis/BranchProbabilityInfo.h>
+#include <llvm/Support/Format.h>
 
 #include <set>
+#include <algorithm>
 
 //Add header file. by haomeng
 #include "LockInst.h"
+#include "CallClassify.h"
+#include "ShadowCall.h"
+#include "CheckSummary.h"
 
 STATISTIC(NumInsDup, "Number of generated instructions");
 STATISTIC(NumBBChecker, "Number of generated branch checker BBs");
@@ -34,6 +47,8 @@ using namespace llvm;
 namespace {
    RegisterPass<InsDuplica> X("InsDup", "Duplicate all Instructions");
    RegisterPass<InsDuplicaTile> Y("InsDupTile", "Duplicate all Instructions in tile");
+   RegisterPass<InsStDuplica> Z("InsStDup", "Duplicate all Instructions, store signatures in loops");
+   RegisterPass<InsDupStld> W("InsDupStld", "Duplicate all Instructions, check stores by loading them again");
 }
 
 //////////////////////////////
@@ -41,6 +56,17 @@ namespace {
 //////////////////////////////
 
 char InsDuplica::ID = 0;
+char InsStDuplica::ID = 0;
+char InsDupStld::ID = 0;
+
+//growth from before to after, in percent
+static std::string overheadPercent(uint64_t before, uint64_t after) {
+   std::string s;
+   raw_string_ostream os(s);
+   if (before == 0) os << "0.0";
+   else os << format("%.1f", 100.0 * ((double)after - (double)before) / (double)before);
+   return os.str();
+}
 
 //Set up a Lock. by haomeng
 //Lock* LockIns = new Lock();
@@ -51,70 +77,192 @@ void InsDuplica::getAnalysisUsage (AnalysisUsage &AU) const
    AU.addRequired<LoopInfo>();
    AU.addRequired<DominatorTree>();
    AU.addRequired<PostDominatorTree>();
+   AU.addRequired<ScalarEvolution>();
+   AU.addRequired<BlockFrequencyInfo>();
+   AU.addRequired<BranchProbabilityInfo>();
    AU.addRequired<Lock>();
+   AU.addRequired<CheckSummary>();
+}
+
+//annotations, the policy file and the regexes are resolved once
+bool InsDuplica::doInitialization(Module &M) {
+   selector.build(M);
+   sites.beginModule(M, "InsDup");
+   modulestaticbefore = modulestaticafter = 0;
+   moduleprofbefore = moduleprofafter = 0;
+   moduleestbefore = moduleestafter = 0;
+   return false;
+}
+
+//expected overhead of the whole module
+bool InsDuplica::doFinalization(Module &M) {
+   sites.endModule();
+   errs() << "module static size: " << modulestaticbefore << " -> " << modulestaticafter
+      << ", overhead " << overheadPercent(modulestaticbefore, modulestaticafter) << "%\n";
+   if (moduleprofbefore > 0)
+      errs() << "module profiled dynamic size: " << moduleprofbefore << " -> " << moduleprofafter
+         << ", overhead " << overheadPercent(moduleprofbefore, moduleprofafter) << "%\n";
+   if (moduleestbefore > 0)
+      errs() << "module estimated dynamic size (no profile): " << moduleestbefore << " -> " << moduleestafter
+         << ", overhead " << overheadPercent(moduleestbefore, moduleestafter) << "%\n";
+   return false;
 }
 
 bool InsDuplica::runOnFunction(Function &F) {
    //initiate local counters
    initLocalCounter();
+   policy = choosePolicy(F);
+
+   //measured counts, if -sample-profile or -fprofile-instr-use left any
+   BlockFrequencyInfo &BFI = getAnalysis<BlockFrequencyInfo>();
+   profile = NULL;
+   if (BlockProfile::hasProfile(F)) {
+      profile = new BlockProfile(F, BFI);
+      if (!profile->valid()) {
+         delete profile;
+         profile = NULL;
+      }
+   }
 
    //if the function is not dummy, we need to work on it
    if (notdummyFunc(F) && workFunc(F)) {
 
-#ifdef REG_SAFE
       DominatorTree& DT = getAnalysis<DominatorTree>();
-#endif
 
-      mycheckCodeMap = new CheckCodeMap();
+      privateSlots.clear();
+      if (policy.privateSlots) {
+         //-O0 input keeps every local in memory. Registers need no store
+         //checks, the rest get a duplicated slot.
+         localnumpromoted = PrivateSlots::promoteAllocas(F, DT);
+         privateSlots.collect(F);
+      }
+      //promotion is what -O2 would do anyway: measure from here
+      measureBefore(F, getAnalysis<LoopInfo>());
+      OverheadEstimator::recordOriginal(F, origInsts);
+
+      //addrctl: the slices are taken on the promoted code
+      ldAddr = NULL;
+      if (policy.addrCtl) {
+         ldAddr = new LdAddr();
+         ldAddr->analyze(F);
+      }
+
+      mycheckCodeMap = new CheckCodeMap(policy.storeLevel);
       myvalueCheckedAtMap = new ValueCheckedAtMap();
 
-#ifdef REG_SAFE
       // Initialize a map to recording safe registers
-      safeRegMap = new SafeRegMap(F);
-#endif
+      safeRegMap = policy.regSafe ? new SafeRegMap(F) : NULL;
+      curSafeRegs = NULL;
 
       //apply redundant analysis
       RedundAnalysis redundAnalysisPass;
+      redundAnalysisPass.setPolicy(policy);
+      redundAnalysisPass.setCalleeSummary(&getAnalysis<CheckSummary>());
+      if (policy.privateSlots)
+         redundAnalysisPass.setPrivateSlots(&privateSlots);
       redundAnalysisPass.SetUpTable(mycheckCodeMap, myvalueCheckedAtMap, F);
 
-#ifdef REG_SAFE
-      redundAnalysisPass.enableCheckADVRegSafe(&DT);
-#endif
+      if (policy.regSafe)
+         redundAnalysisPass.enableCheckADVRegSafe(&DT);
       // redundAnalysisPass.removeOverlap(mycheckCodeMap,myvalueCheckedAtMap,F,postDominSet);
-      // redundAnalysisPass.rmLoopIV(mycheckCodeMap,myvalueCheckedAtMap,F,loopinfo);
-
-#ifdef REG_SAFE
-      //this pass is only for stat purpose. This only counts the checks for
-      // loaded values.
-      // We don't need this pass any more. We will count checks here.
-      //redundAnalysisPass.rmSafeReg(mycheckCodeMap,myvalueCheckedAtMap,F);
-#endif
+      if (policy.loopSCEV)
+         redundAnalysisPass.rmLoopSCEV(mycheckCodeMap,myvalueCheckedAtMap,F,
+               getAnalysis<LoopInfo>(),getAnalysis<ScalarEvolution>());
+      //store checks to colder points, once loop checks have moved
+      if (policy.placeChecks)
+         redundAnalysisPass.placeChecks(mycheckCodeMap,myvalueCheckedAtMap,F,DT,BFI,
+               getAnalysis<BranchProbabilityInfo>());
+
+      //keep what fits in the overhead budget
+      costModel = NULL;
+      if (policy.budget > 0) {
+         costModel = new CostModel(F, BFI);
+         costModel->select(mycheckCodeMap, policy.budget);
+      }
+      if (profile)
+         redundAnalysisPass.countProfiledChecks(profile);
 
       //build the error-exit BB
       errorBlock = buildErrorBlock(F);
+      sites.beginFunction(F);
+
+      if (policy.sampleCheck)
+         setupSampling(F, getAnalysis<LoopInfo>());
+      //sampled loops keep their own accumulator
+      stVAtool = NULL;
+      if (policy.storeSig) {
+         stVAtool = new StoreVAtool(&getAnalysis<LoopInfo>(), F, &getAnalysis<Lock>(), &privateSlots);
+         if (!stVAtool->findInterestingLoop(policy.storeSigDensity, sampleBlocks)) {
+            delete stVAtool;
+            stVAtool = NULL;
+         }
+      }
 
       DuplicaAllBB (F);
 
+      if (policy.sampleCheck)
+         finishSampling(F);
+      if (stVAtool) {
+         stVAtool->addSigCheckers(errorBlock, sites);
+         localnumstsigloop = stVAtool->numLoops();
+         localnumstsigcal = stVAtool->numSigCal();
+         localnumstsigcheck = stVAtool->numSigChecker();
+         NumInsDup += 1 + 3*localnumstsigcheck;
+         localnuminsdup += 1 + 3*localnumstsigcheck;
+         delete stVAtool;
+         stVAtool = NULL;
+      }
+      sites.endFunction(F);
+      measureAfter(F);
+      OverheadEstimator::tagAdded(F, origInsts);
+
       //dump stat for checks
       redundAnalysisPass.printStatforTotal(F);
+      sites.printStat(F);
+      if (costModel) {
+         costModel->printStat(F);
+         delete costModel;
+         costModel = NULL;
+      }
 
       //delete redundant analysis tables
       delete mycheckCodeMap;
       delete myvalueCheckedAtMap;
-
-#ifdef REG_SAFE
       delete safeRegMap;
-#endif
+      delete ldAddr;
+      ldAddr = NULL;
+   } else {
+      //unprotected: report its size so the totals stay comparable
+      measureBefore(F, getAnalysis<LoopInfo>());
+      localstaticafter = localstaticbefore;
+      localdynafter = localdynbefore;
    }
 
    //dump local counters
    counterdump(F);
 
+   modulestaticbefore += localstaticbefore;
+   modulestaticafter += localstaticafter;
+   if (profile) {
+      moduleprofbefore += localdynbefore;
+      moduleprofafter += localdynafter;
+   } else {
+      moduleestbefore += localdynbefore;
+      moduleestafter += localdynafter;
+   }
+   delete profile;
+   profile = NULL;
+
 
    return true;
 }
 
 
+//the tier of F; subclasses may force parts of it
+ProtectPolicy InsDuplica::choosePolicy(Function &F) {
+   return ProtectPolicy::forFunction(F, selector.lookup(&F));
+}
+
 /////////////////////////////////////
 ///DuplicaAllBB()                  //
 /////////////////////////////////////
@@ -133,21 +281,21 @@ void InsDuplica::DuplicaAllBB(Function &F) {
    markedBB.insert(errorBlock); 
 
    //add all BBs to WorkList.
-#ifdef REG_SAFE
-   // Get the topological ordered tree.
-   ReversePostOrderTraversal<Function*> PROT(&F);
-   for (ReversePostOrderTraversal<Function*>::rpo_iterator
-         I = PROT.begin(), E = PROT.end(); I != E; ++I) {
-      BasicBlock *BB = *I;
-      WorkList.push_back(BB);
-   }
-#else
-   // We don't need to care the order.
-   for (Function::iterator BBi = F.begin(), BBE = F.end(); BBi!=BBE; ++BBi) {
-      BasicBlock *BB = BBi;
-      WorkList.push_back(BB);
+   if (policy.regSafe) {
+      // Get the topological ordered tree.
+      ReversePostOrderTraversal<Function*> PROT(&F);
+      for (ReversePostOrderTraversal<Function*>::rpo_iterator
+            I = PROT.begin(), E = PROT.end(); I != E; ++I) {
+         BasicBlock *BB = *I;
+         WorkList.push_back(BB);
+      }
+   } else {
+      // We don't need to care the order.
+      for (Function::iterator BBi = F.begin(), BBE = F.end(); BBi!=BBE; ++BBi) {
+         BasicBlock *BB = BBi;
+         WorkList.push_back(BB);
+      }
    }
-#endif
 
    //while working list is empty. Do.
    while (!(WorkList.empty())) {
@@ -159,7 +307,6 @@ void InsDuplica::DuplicaAllBB(Function &F) {
 #endif
       //if curBB has not been replicated, let's replicate it
       if (markedBB.count(curBB) == 0) {
-#ifdef REG_SAFE
 #ifdef Jing_DEBUG
          /* This part is only valid when DuplicaBB() is not called, because
          // the pred link will change after replication and checking.
@@ -188,21 +335,21 @@ void InsDuplica::DuplicaAllBB(Function &F) {
          ++PI;
          }
          */
-#endif
 #endif
          // mark curBB
          markedBB.insert(curBB);
 
-#ifdef REG_SAFE
          // Point curBB's childern's incoming blocks.
-         SafeRegforBB* saferegs = safeRegMap->getSafeRegsforBB(curBB);
-         std::set<Value*> *safeSet = saferegs->getSafeRegSet();
-         BranchInst *term = dyn_cast<BranchInst>(curBB->getTerminator());
-         if (term) {
+         // A switch may reach a successor on several edges; it is set once.
+         TerminatorInst *term = curBB->getTerminator();
+         if (policy.regSafe && (isa<BranchInst>(term) || isa<SwitchInst>(term))) {
+            SafeRegforBB* saferegs = safeRegMap->getSafeRegsforBB(curBB);
+            std::set<Value*> *safeSet = saferegs->getSafeRegSet();
+            std::set<BasicBlock*> sucSeen;
             int numS = term->getNumSuccessors();
             for ( int i = 0; i < numS; i++ ) {
                BasicBlock *suc = term->getSuccessor(i);
-               if (markedBB.count(suc) == 0) {
+               if (markedBB.count(suc) == 0 && sucSeen.insert(suc).second) {
                   SafeRegforBB *safeSucc = safeRegMap->getSafeRegsforBB(suc);
                   // If suc has PHI, we will make sure incoming safe reg set
                   // is inserted at correct place.
@@ -215,7 +362,6 @@ void InsDuplica::DuplicaAllBB(Function &F) {
                }
             }
          }
-#endif
          //replicate curBB
          DuplicaBB(curBB);
       }
@@ -228,16 +374,16 @@ void InsDuplica::DuplicaAllBB(Function &F) {
 ////////////////////////////////////
 void InsDuplica::DuplicaBB(BasicBlock *BB) {
 
-#ifdef REG_SAFE
-   // Get safe reg sets for current BB
-   curSafeRegs = safeRegMap->getSafeRegsforBB(BB);
-   // Calculate intersection from incoming safe reg sets
-   curSafeRegs->computeSafeRegSet();
+   if (policy.regSafe) {
+      // Get safe reg sets for current BB
+      curSafeRegs = safeRegMap->getSafeRegsforBB(BB);
+      // Calculate intersection from incoming safe reg sets
+      curSafeRegs->computeSafeRegSet();
 #ifdef Jing_DEBUG
-   std::cerr << "||IN||curSafeRegs:";
-   curSafeRegs->dumpSafeRegs();
-#endif
+      std::cerr << "||IN||curSafeRegs:";
+      curSafeRegs->dumpSafeRegs();
 #endif
+   }
 
    Instruction *nextI;
    //find last condition or terminator instruction
@@ -254,18 +400,38 @@ void InsDuplica::DuplicaBB(BasicBlock *BB) {
    while (I!=LastCond && I!=NULL) {
       nextI = I->getNextNode();
       //duplicate I and insert the duplicated instruction before I
-      if (duplicable(I)) {
-         //this version, we use load-move version for load
-         if (LoadInst *loadI = dyn_cast<LoadInst>(I)) {
+      if (ShadowCall::isShadowInst(I) && !isa<CallInst>(I)) {
+         DuplicaShadow(I);
+      } else if (privateSlots.isPrivateAlloca(I)) {
+         DuplicaSlot(I);
+      } else if (duplicable(I)) {
+         if (privateSlots.isPrivateAccess(I)) {
+            //the duplicate reads and writes the duplicated slot
+            localnumslotaccess++;
+            DuplicaInst(I,I);
+         } else if (LoadInst *loadI = dyn_cast<LoadInst>(I)) {
+            //this version, we use load-move version for load
             BB = DuplicaLoad(loadI,BB);
-         } else 
+         } else if (ldAddr && !ldAddr->needProtect(I)) {
+            //addrctl: no address or branch is computed from I
+            localnumdatakept++;
+            keepOriginal(I);
+         } else if (costModel && !costModel->isProtected(I)) {
+            //over budget: no check reads its duplicate
+            keepOriginal(I);
+         } else {
+            if (isa<CallInst>(I)) localnumcalldup++;
             DuplicaInst(I,I);
+         }
       } else{
+         if (CallClassify::isIgnoredCall(I)) localnumcallignore++;
+         else if (CallClassify::isSharedCall(I)) localnumcallshare++;
          if (isSynchPoint(I)) {
             //if I is synchpoint, check correcness before proceed
             //this may add new blocks.
             BB=newCheckerSynch(I,BB,nextI);
          };
+         if (CallClassify::isShadowCall(I)) patchShadowCall(cast<CallInst>(I));
 
          valueMap[I]=I;
       }
@@ -277,13 +443,20 @@ void InsDuplica::DuplicaBB(BasicBlock *BB) {
       //check branch
       //If terminator of BB is a conditional branch
       if (BranchInst *BI = hasConditionalBr(BB)) {
-         DuplicaBr(BB, LastCond, BI);
-      } else if (dyn_cast<ReturnInst>(LastCond)) 
+         if (costModel && costModel->isBranchDropped(BI)) {
+            if (LastCond != BI) keepOriginal(LastCond);
+         } else
+            DuplicaBr(BB, LastCond, BI);
+      } else if (SwitchInst *SI = dyn_cast<SwitchInst>(LastCond)) {
+         DuplicaSwitch(BB, SI);
+      } else if (dyn_cast<ReturnInst>(LastCond) || dyn_cast<BranchInst>(LastCond)) 
          newCheckerSynch(LastCond, BB, I);      
    }
 #ifdef Jing_DEBUG
-   std::cerr << "||OUT||curSafeRegs:";
-   curSafeRegs->dumpSafeRegs();
+   if (curSafeRegs) {
+      std::cerr << "||OUT||curSafeRegs:";
+      curSafeRegs->dumpSafeRegs();
+   }
 #endif
 
 }
@@ -310,6 +483,7 @@ void InsDuplicaTile::DuplicaBB(BasicBlock *BB) {
       while ((I!=LastCond) && (isSynchPoint(I))){
          //if I is synchpoint, check correcness before proceed
          BB=newCheckerSynch(I,BB,nextI);
+         if (CallClassify::isShadowCall(I)) patchShadowCall(cast<CallInst>(I));
          valueMap[I]=I;
          I = nextI;
       }
@@ -322,7 +496,11 @@ void InsDuplicaTile::DuplicaBB(BasicBlock *BB) {
       Instruction *lastI;
 
       do {
-         if (duplicable(I)){
+         if (ShadowCall::isShadowInst(I)) {
+            DuplicaShadow(I);
+         } else if (privateSlots.isPrivateAlloca(I)) {
+            DuplicaSlot(I);
+         } else if (duplicable(I)){
             //PHI node must be grouped at top of basic block!
             if (isa<PHINode>(I)) DuplicaInst(I,I);
             else DuplicaInst(I,nextSynI);
@@ -341,6 +519,12 @@ void InsDuplicaTile::DuplicaBB(BasicBlock *BB) {
    //If terminator of BB is a conditional branch
    if (BranchInst *BI = hasConditionalBr(BB)) {
       DuplicaBr(BB, LastCond, BI);  
+   } else if (SwitchInst *SI = dyn_cast<SwitchInst>(LastCond)) {
+      DuplicaSwitch(BB, SI);
+   } else if (isa<BranchInst>(LastCond)) {
+      //checks moved to a loop preheader
+      nextI = LastCond;
+      newCheckerSynch(LastCond, BB, nextI);
    }
 }
 
@@ -357,15 +541,18 @@ BasicBlock* InsDuplica::newCheckerSynch(Instruction* synchI, BasicBlock *BB, Ins
    } 
 
    //Remove redundant checks
-   if (isa<ReturnInst>(synchI) || isa<CallInst>(synchI)) {
+   //An unconditional branch carries the checks moved out of a loop.
+   if (isa<ReturnInst>(synchI) || isa<CallInst>(synchI) || isa<BranchInst>(synchI)) {
       BasicBlock *newBB = BB;
       std::set<Value*> *tocheck = mycheckCodeMap->getCheckElemList(synchI);
       if (tocheck && !tocheck->empty()) {
 
-         localnumfinalothercheck += tocheck->size();
          std::string nametag;
          if (isa<ReturnInst>(synchI)) nametag = "rV";
          else if (isa<CallInst>(synchI)) nametag = "cV";
+         else nametag = "hV";
+         if (isa<BranchInst>(synchI)) localnumfinalbrcheck += tocheck->size();
+         else localnumfinalothercheck += tocheck->size();
 
          for (std::set<Value*>::iterator ii = tocheck->begin(), e=tocheck->end(); ii!=e; ii++) 
             newBB = newOneValueChecker((*ii), synchI, newBB, nametag);	    
@@ -400,6 +587,9 @@ BasicBlock *InsDuplica::newCheckerStore(Instruction* synchI, BasicBlock *BB, Ins
       assert(tocheck->size() <=3 && "Do not allow to check too many checks" );
       localnumfinalstcheck += tocheck->size();
 
+      if (policy.storeCheck == STORECHECK_RELOAD && canReload(StoreI, tocheck, BB))
+         return newReloadChecker(StoreI, BB);
+
       std::string nametag = "A";
       for (std::set<Value*>::iterator ii = tocheck->begin(), e=tocheck->end(); ii!=e; ii++) 
          newBB = newOneValueChecker((*ii), StoreI, newBB, nametag);	    
@@ -408,6 +598,99 @@ BasicBlock *InsDuplica::newCheckerStore(Instruction* synchI, BasicBlock *BB, Ins
    return newBB;  
 }
 
+//the duplicate a check of v compares against; NULL if not known yet
+Value *InsDuplica::knownDup(Value *v) {
+   if (valueMap.count(v) > 0) return valueMap[v];
+   if (!duplicable(v)) return v;
+   return NULL;
+}
+
+//One branch after the store covers its address and value only if both
+//duplicates are known, the word can be compared and nothing cheaper
+//(sampling, store signatures) already takes the checks.
+bool InsDuplica::canReload(StoreInst *StoreI, std::set<Value*> *tocheck, BasicBlock *BB) {
+   if (!StoreI->isUnordered() || StoreI->isVolatile()) return false;
+   if (sampleAcc && sampleBlocks.count(BB)) return false;
+   if (stVAtool && stVAtool->isInteresting(BB)) return false;
+
+   Value *addr = StoreI->getPointerOperand();
+   Value *val = StoreI->getValueOperand();
+   Type *ty = val->getType();
+   if (!ty->isIntegerTy() && !ty->isPointerTy() && !ty->isFloatTy() && !ty->isDoubleTy())
+      return false;
+   Value *addrDup = knownDup(addr);
+   Value *valDup = knownDup(val);
+   if (!addrDup || !valDup) return false;
+   if (addrDup == addr && valDup == val) return false; //nothing to check
+
+   bool unsafe = false;
+   for (std::set<Value*>::iterator ii = tocheck->begin(), e=tocheck->end(); ii!=e; ii++) {
+      if (*ii != addr && *ii != val) return false; //decomposed address (l3)
+      if (!curSafeRegs || !curSafeRegs->isValueSafe(*ii)) unsafe = true;
+   }
+   return unsafe;
+}
+
+///////////////////////////////////
+//newReloadChecker()             //
+//after the store:               //
+//load addr_r == val_r &&        //
+//addr == addr_r ? next : error  //
+///////////////////////////////////
+BasicBlock *InsDuplica::newReloadChecker(StoreInst *StoreI, BasicBlock *BB) {
+   Lock& LockIns = getAnalysis<Lock>();
+   Value *addr = StoreI->getPointerOperand();
+   Value *val = StoreI->getValueOperand();
+   Value *addrDup = knownDup(addr);
+   Value *valDup = knownDup(val);
+
+   BasicBlock *newBB = BB->splitBasicBlock(StoreI->getNextNode(), BB->getName()+"R");
+   if (sampleBlocks.count(BB)) sampleBlocks.insert(newBB);
+   if (stVAtool) stVAtool->propSig(BB, newBB);
+   Instruction *oldBr = BB->getTerminator();
+
+   //locked, so -O2 does not forward the store into it
+   Instruction *reload = new LoadInst(addrDup, val->getName()+"_ld", false,
+         StoreI->getAlignment(), oldBr);
+   reload = LockIns.lock_inst(reload);
+   Value *a = reload;
+   Value *b = valDup;
+   if (val->getType()->isFloatTy() || val->getType()->isDoubleTy()) {
+      //compare the bits: a stored NaN is still the right word
+      a = asSampleInt(a, oldBr);
+      b = asSampleInt(b, oldBr);
+      localnuminsdup += 2;
+      NumInsDup += 2;
+   }
+   Instruction *same = new ICmpInst(oldBr, ICmpInst::ICMP_EQ, a, b, val->getName()+"R");
+   same = LockIns.lock_inst(same);
+   if (addrDup != addr) {
+      //the reload alone misses a wild store of a word the right location
+      //already held, so compare the addresses into the same branch
+      Instruction *sameAddr = new ICmpInst(oldBr, ICmpInst::ICMP_EQ, addr, addrDup, addr->getName()+"R");
+      sameAddr = LockIns.lock_inst(sameAddr);
+      same = BinaryOperator::CreateAnd(same, sameAddr, "", oldBr);
+      same = LockIns.lock_inst(same);
+      localnuminsdup += 2;
+      NumInsDup += 2;
+   }
+   Instruction *Term = BranchInst::Create(newBB, errorBlock, same, oldBr);
+   oldBr->eraseFromParent();
+   sites.addSite(cast<BranchInst>(Term), 0);
+   LockIns.lock_inst(Term);
+
+   if (curSafeRegs) {
+      curSafeRegs->insertValueSafe(addr);
+      curSafeRegs->insertValueSafe(val);
+   }
+   localnuminsdup += 3;
+   NumInsDup += 3;
+   localnumreload++;
+   localnumStorechecker++;
+   NumStoreChecker++;
+   return newBB;
+}
+
 
 ///////////////////////////////////
 //newOneValueChecker()           //
@@ -419,8 +702,7 @@ BasicBlock *InsDuplica::newOneValueChecker(Value *ValuetoCheck, Instruction *syn
    Lock& LockIns = getAnalysis<Lock>();
    assert (duplicable(ValuetoCheck) && "checked value must be duplicable");
 
-#ifdef REG_SAFE
-   //Register Safe  SafeReg
+   //Register Safe  SafeReg (curSafeRegs is NULL unless policy.regSafe)
    //if ValuetoCheck is a load or cast(load), do not check
    /*  -- We are generalizing the rule.
        if (isa<LoadInst>(ValuetoCheck)) return BBofSynchI;
@@ -429,19 +711,26 @@ BasicBlock *InsDuplica::newOneValueChecker(Value *ValuetoCheck, Instruction *syn
        return BBofSynchI;
        }
        */
-   if (curSafeRegs->isValueSafe(ValuetoCheck)) {
-      // Count the checks for reg safe
-      statRegRemove(synchI);
-      return BBofSynchI;
-   }
-   if (CastInst *castI = dyn_cast<CastInst>(ValuetoCheck)) {
-      if (curSafeRegs->isValueSafe(castI->getOperand(0))) {
+   if (curSafeRegs) {
+      if (curSafeRegs->isValueSafe(ValuetoCheck)) {
          // Count the checks for reg safe
          statRegRemove(synchI);
          return BBofSynchI;
       }
+      if (CastInst *castI = dyn_cast<CastInst>(ValuetoCheck)) {
+         if (curSafeRegs->isValueSafe(castI->getOperand(0))) {
+            // Count the checks for reg safe
+            statRegRemove(synchI);
+            return BBofSynchI;
+         }
+      }
+   }
+
+   //addrctl: a data value, nothing it reaches is an address or a branch
+   if (ldAddr && !ldAddr->needProtect(ValuetoCheck)) {
+      localnumdataskip++;
+      return BBofSynchI;
    }
-#endif
 
    Value *ValuetoCheckDup = ValuetoCheck; //by default
 
@@ -450,6 +739,29 @@ BasicBlock *InsDuplica::newOneValueChecker(Value *ValuetoCheck, Instruction *syn
       if (valueMap[ValuetoCheck] == ValuetoCheck) 
          return BBofSynchI;
 
+   //inside a sampled loop, only record the difference; not for store
+   //addresses, a wild store could overwrite the accumulator itself
+   if (policy.sampleCheck && isSampled(BBofSynchI, ValuetoCheck->getType()) && valueMap.count(ValuetoCheck) > 0
+         && !isStoreAddress(ValuetoCheck, synchI)) {
+      Value *a = asSampleInt(ValuetoCheck, synchI);
+      Value *b = asSampleInt(valueMap[ValuetoCheck], synchI);
+      Instruction *diff = BinaryOperator::CreateXor(a, b, ValuetoCheck->getName()+nameTag, synchI);
+      diff = LockIns.lock_inst(diff);
+      accumulateDiff(diff, synchI);
+      if (curSafeRegs) curSafeRegs->insertValueSafe(ValuetoCheck);
+      return BBofSynchI;
+   }
+
+   //a store in a store-dense loop: into the signature, checked at the exits
+   if (stVAtool && isa<StoreInst>(synchI) && stVAtool->isInteresting(BBofSynchI)
+         && stVAtool->canSign(ValuetoCheck->getType()) && valueMap.count(ValuetoCheck) > 0) {
+      int added = stVAtool->newOneSigCal(ValuetoCheck, valueMap[ValuetoCheck], synchI, nameTag);
+      NumInsDup += added;
+      localnuminsdup += added;
+      if (curSafeRegs) curSafeRegs->insertValueSafe(ValuetoCheck);
+      return BBofSynchI;
+   }
+
    //new SetEQ instruction and insert it before synchI
    Instruction* newSetEQ = NULL;
    Type* ty = ValuetoCheck->getType();
@@ -486,6 +798,8 @@ BasicBlock *InsDuplica::newOneValueChecker(Value *ValuetoCheck, Instruction *syn
 
    //split BBofSynchI to add conditional branch
    BasicBlock *newBB = BBofSynchI->splitBasicBlock(synchI, BBofSynchI->getName()+nameTag);
+   if (sampleBlocks.count(BBofSynchI)) sampleBlocks.insert(newBB);
+   if (stVAtool) stVAtool->propSig(BBofSynchI, newBB);
 
    //Now, the end of BBofSynchI is a branch to newBB. We have to replace this branch by a conditional branch based on newSetEQ
    BranchInst *BI = dyn_cast<BranchInst>(BBofSynchI->getTerminator());
@@ -508,6 +822,7 @@ BasicBlock *InsDuplica::newOneValueChecker(Value *ValuetoCheck, Instruction *syn
       newSetEQ = elemx;
    }
    Term = BranchInst::Create(newBB,errorBlock,newSetEQ,BBofSynchI);
+   sites.addSite(cast<BranchInst>(Term), 0);
    //FIXME: unknow setDUP
    //condBI->setDUP(); //set DUP attribute
 
@@ -524,13 +839,13 @@ BasicBlock *InsDuplica::newOneValueChecker(Value *ValuetoCheck, Instruction *syn
    std::cerr << "newOneValueChecker creates "<<newBB->getName()<<" inside "<< BBofSynchI->getName()<<"\n";
 #endif
 
-#ifdef REG_SAFE
-   // Now the value is safe.
-   curSafeRegs->insertValueSafe(ValuetoCheck);
+   if (curSafeRegs) {
+      // Now the value is safe.
+      curSafeRegs->insertValueSafe(ValuetoCheck);
 #ifdef Jing_DEBUG
-   std::cerr << "add_safe("<<ValuetoCheck->getName()<<"),";
-#endif
+      std::cerr << "add_safe("<<ValuetoCheck->getName()<<"),";
 #endif
+   }
    localnumStorechecker++;
    NumStoreChecker++;
    return newBB;
@@ -546,7 +861,7 @@ void InsDuplica::statRegRemove(Instruction *I) {
 #endif
    if (isa<LoadInst>(I)) localnumadvregcheckld ++;
    else if (isa<StoreInst>(I)) localnumadvregcheckst ++;
-   else if (isa<BranchInst>(I)) localnumadvregcheckbr ++;
+   else if (isa<BranchInst>(I) || isa<SwitchInst>(I)) localnumadvregcheckbr ++;
    else localnumadvregcheckother ++;
 }
 
@@ -564,6 +879,16 @@ void InsDuplica::DuplicaBr(BasicBlock *BB, Instruction *LastCond, BranchInst *BI
    Instruction *myCond = dyn_cast<Instruction>(BI->getCondition());
    assert (myCond && "Branch condition must not be trivial");
 
+   //checked by a shortcut replica (IfDuplica): it only needs the
+   //duplicate of the condition
+   if (coveredBr.count(BI)) {
+      if (LastCond != BI) {
+         if (duplicable(LastCond)) DuplicaInst(LastCond, LastCond);
+         else valueMap[LastCond] = LastCond;
+      }
+      return;
+   }
+
    /* -- below is to check the correctness of comparison operands --
    //Remove redundant checks
    //std::set<Value*> *tocheck = mycheckCodeMap->getCheckElemList(BI);
@@ -697,6 +1022,8 @@ if (CheckCode *checkcodeforbr = mycheckCodeMap->getCheckCode(BI)) {
    if (checkbr > 0) {
       //insert value checking to the beginning of newtrueTarg or newfalseTarg
       std::string dummy="";
+      //a check on one edge does not make the value safe on the other
+      SafeRegforBB *bbSafeRegs = curSafeRegs;
       for (unsigned int is = 0; is < propsize; is++) {
          Value *valuetocheck = checkbr->getPropCheckValue(is);
          bool propto = checkbr->getPropTo(is);
@@ -705,16 +1032,100 @@ if (CheckCode *checkcodeforbr = mycheckCodeMap->getCheckCode(BI)) {
             synBB = newtrueTarg;
          }
          Instruction *synII = synBB->begin();
+         if (bbSafeRegs && bbSafeRegs->isValueSafe(valuetocheck)) {
+            statRegRemove(synII);
+            continue;
+         }
          std::ostringstream isstream;
          isstream << is;
          std::string numstring = dummy+isstream.str()+"pV";
+         curSafeRegs = NULL;
          newOneValueChecker(valuetocheck, synII, synBB, numstring);
+         curSafeRegs = bbSafeRegs;
       }
    } //end of if >0
 }//end of  checkcode
 }
 
 
+///////////////////////////////////
+//DuplicaSwitch()               //
+///////////////////////////////////
+//The switch is kept, so the backend still emits its jump table.
+//With policy.switchCheck == SWITCH_SELECTOR the selector is compared
+//with its duplicate before the switch. With SWITCH_TARGET every
+//successor gets a checker block that switches on the duplicated
+//selector over the cases leading there: a wrong target, or a wrong
+//selector, goes to the error block.
+void InsDuplica::DuplicaSwitch(BasicBlock *BB, SwitchInst *SI) {
+   Value *sel = SI->getCondition();
+   if (policy.switchCheck == SWITCH_OFF || !duplicable(sel)) return;
+   //no duplicate to compare with
+   if (valueMap.count(sel) > 0 && valueMap[sel] == sel) return;
+   localnumswitch++;
+
+   if (policy.switchCheck == SWITCH_SELECTOR) {
+      std::string nametag = "sV";
+      localnumfinalbrcheck++;
+      newOneValueChecker(sel, SI, BB, nametag);
+      return;
+   }
+
+   std::vector<BasicBlock*> targets;
+   for (unsigned int i = 0; i < SI->getNumSuccessors(); i++) {
+      BasicBlock *T = SI->getSuccessor(i);
+      if (std::find(targets.begin(), targets.end(), T) == targets.end())
+         targets.push_back(T);
+   }
+   for (unsigned int i = 0; i < targets.size(); i++)
+      newSwitchChecker(SI, targets[i]);
+}
+
+///////////////////////////////////
+//newSwitchChecker()            //
+///////////////////////////////////
+//Every edge of SI to nextBB now goes through the new block, which has
+//as many edges to nextBB, so the PHIs of nextBB only change their block.
+BasicBlock *InsDuplica::newSwitchChecker(SwitchInst *SI, BasicBlock *nextBB) {
+   Lock& LockIns = getAnalysis<Lock>();
+   BasicBlock *thisBB = SI->getParent();
+   std::string newName = thisBB->getName().str()+"_S_"+nextBB->getName().str();
+   BasicBlock *newBB = BasicBlock::Create(thisBB->getContext(), newName, thisBB->getParent(), nextBB);
+
+   //the cases of nextBB go on. If nextBB is the default, the other
+   //cases are the errors, else the default is.
+   bool isDefault = (SI->getDefaultDest() == nextBB);
+   Value *sel = SI->getCondition();
+   SwitchInst *checkSI = SwitchInst::Create(sel, isDefault ? nextBB : errorBlock, 0, newBB);
+   for (SwitchInst::CaseIt i = SI->case_begin(), e = SI->case_end(); i != e; ++i) {
+      if (i.getCaseSuccessor() == nextBB) checkSI->addCase(i.getCaseValue(), nextBB);
+      else if (isDefault) checkSI->addCase(i.getCaseValue(), errorBlock);
+   }
+   if (valueMap.count(sel) > 0)
+      checkSI->setCondition(valueMap[sel]);
+   else
+      requestToMap(cast<Instruction>(sel), checkSI);
+
+   for (unsigned int i = 0; i < checkSI->getNumSuccessors(); i++) {
+      if (checkSI->getSuccessor(i) == nextBB) {
+         sites.addSite(checkSI, i);
+         break;
+      }
+   }
+   for (unsigned int i = 0; i < SI->getNumSuccessors(); i++)
+      if (SI->getSuccessor(i) == nextBB) SI->setSuccessor(i, newBB);
+   updatePHInodesBB(nextBB, thisBB, newBB);
+
+   LockIns.lock_inst(checkSI);
+   localnumfinalbrcheck++;
+   localnumBBchecker++;
+   NumBBChecker++;
+   NumInsDup++;
+   localnuminsdup++;
+   return newBB;
+}
+
+
 ///////////////////////////////////
 //newBBinsert()                  //
 ///////////////////////////////////
@@ -772,12 +1183,29 @@ BasicBlock* InsDuplica::newCheckerBB(Instruction *LastCond, BranchInst *BI, Basi
 
    }
 
+   //inside a sampled loop, record newCond != trueSide and go on. If the
+   //dup of the condition is not known yet, check it exactly.
+   if (policy.sampleCheck && isSampled(thisBB, newCond->getType()) && !((myCond != LastCond) && (newCond == myCond))) {
+      BranchInst *newBI = BranchInst::Create(nextBB,newBB);
+      Constant *expected = ConstantInt::get(newCond->getType(), trueSide);
+      Instruction *diff = BinaryOperator::CreateXor(newCond, expected, "", newBI);
+      diff = LockIns.lock_inst(diff);
+      accumulateDiff(diff, newBI);
+      updatePHInodesBB(nextBB, thisBB, newBB);
+
+      sampleBlocks.insert(newBB);
+      NumInsDup++;
+      localnuminsdup++;
+      return newBB;
+   }
+
    //duplicate branch
    BranchInst *newBI;
    if (trueSide) 
       newBI = BranchInst::Create(nextBB,errorBlock,newCond,newBB);
    else
       newBI = BranchInst::Create(errorBlock,nextBB,newCond,newBB);
+   sites.addSite(newBI, trueSide ? 0 : 1);
 
    //FIXME
    //newBI->setDUP(); // set DUP attribute
@@ -829,6 +1257,7 @@ void InsDuplica::DuplicaInst(Instruction *I, Instruction *insertBefore) {
 
       //Lock the newI. by haomeng
       newI = LockIns.lock_inst(newI);
+      InstDupMap::tagDup(I, newI);
 
       //update valueMap
       valueMap[I]=newI;
@@ -840,6 +1269,16 @@ void InsDuplica::DuplicaInst(Instruction *I, Instruction *insertBefore) {
    }
 }
 
+////////////////////////////////
+//keepOriginal()              //
+//the duplicate of I is I     //
+////////////////////////////////
+void InsDuplica::keepOriginal(Instruction *I) {
+   valueMap[I] = I;
+   updateUsersMap(I,I);
+   if (costModel) costModel->noteUnprotected();
+}
+
 ////////////////////////////////
 //DuplicaLoad()               //
 ///////////////////////////////
@@ -867,25 +1306,24 @@ BasicBlock* InsDuplica::DuplicaLoad(LoadInst *I, BasicBlock *BB) {
          newBB = newOneValueChecker((*ii), I, newBB, nametag);	    
    }
 
-#ifdef REG_SAFE
-   valueMap[I] = I;
-   updateUsersMap(I,I);
-   curSafeRegs->insertValueSafe(I);
-#else
-   // Comment for Register Safe
-   //dup I - backend generator will convert this load to a move
-   Instruction *newI = I->clone();
-   newI->setName(I->getName() + "_dup");
-   I->getParent()->getInstList().insert(I->getNext(),newI);
-
-   //Lock the newI. by haomeng
-   newI=LockIns.lock_inst(newI);
-   //cerr()<<"newI: "<<*newI<<"\n";
+   if (policy.regSafe) {
+      valueMap[I] = I;
+      updateUsersMap(I,I);
+      if (curSafeRegs) curSafeRegs->insertValueSafe(I);
+   } else {
+      //dup I - backend generator will convert this load to a move
+      Lock& LockIns = getAnalysis<Lock>();
+      Instruction *newI = I->clone();
+      newI->setName(I->getName() + "_dup");
+      I->getParent()->getInstList().insert(I->getNext(),newI);
 
-   valueMap[I]=newI;
-   updateUsersMap(I,newI);
+      //Lock the newI. by haomeng
+      newI=LockIns.lock_inst(newI);
+      InstDupMap::tagDup(I, newI);
 
-#endif
+      valueMap[I]=newI;
+      updateUsersMap(I,newI);
+   }
 
 
    NumInsDup++;
@@ -909,9 +1347,8 @@ void InsDuplica::replaceOperands(Instruction *newI) {
    for (unsigned int i=0; i<numOP; i+=stride) {
       Value *curOP = newI->getOperand(i);
 
-#ifdef REG_SAFE
       // If curOP is on safe reg set, we will not replace it.
-      if (curSafeRegs->isValueSafe(curOP)) {
+      if (curSafeRegs && curSafeRegs->isValueSafe(curOP)) {
 #ifdef Jing_DEBUG
          std::cerr << "safe(";
          if (newI->hasName()) std::cerr << newI->getName() <<":";
@@ -923,7 +1360,7 @@ void InsDuplica::replaceOperands(Instruction *newI) {
       }
 
       // For a PHINode, we will check the corresponding incoming edge.
-      if (isa<PHINode>(newI)) {
+      if (curSafeRegs && isa<PHINode>(newI)) {
          // The index for this incoming block is i/2
          if (curSafeRegs->isValueSafeonIncoming(i/2, curOP)) {
 #ifdef Jing_DEBUG
@@ -932,7 +1369,6 @@ void InsDuplica::replaceOperands(Instruction *newI) {
          }
          continue;
       }
-#endif
 
       if (valueMap.count(curOP) > 0) {
          //curOP has a replica (or dummy replica)
@@ -1014,10 +1450,12 @@ void InsDuplica::updateUsersMap(Instruction *I, Instruction *newI) {
 //  --alloca, malloca
 //  --va_arg
 // -- volatile load
+// -- ignored calls (debug, lifetime intrinsics)
 //////////////////////////////////////
 bool InsDuplica::duplicable (Value *V) {
    if (Instruction *Ins = dyn_cast<Instruction>(V)) {
       if (isSynchPoint(Ins) || isa<AllocaInst>(Ins) ||  isa<VAArgInst>(Ins))  return false;
+      if (CallClassify::isIgnoredCall(Ins)) return false;
    } else {
       return isFuncArgu(V);
    }
@@ -1044,11 +1482,12 @@ Instruction *InsDuplicaTile::findNextSynchPoint (Instruction *curI, Instruction*
 //////////////////////////////////////
 //isSynchPoint()
 //Test if this instruction is SynchPoint:
-//  -- call, rewind, invoke
-//  -- store
+//  -- call, rewind, invoke (pure and ignored calls excluded, see CallClassify)
+//  -- store (stores to private slots excluded, see PrivateSlot)
 //  -- terminator
 bool InsDuplica::isSynchPoint (Instruction *Ins) {
-   if (isa<CallInst>(Ins) || isa<TerminatorInst>(Ins) || isa<StoreInst>(Ins) /*||isa<FreeInst>(Ins) include in CallInst*/ ) return true;
+   if (privateSlots.isPrivateAccess(Ins)) return false;
+   if (CallClassify::isSynchCall(Ins) || isa<TerminatorInst>(Ins) || isa<StoreInst>(Ins) /*||isa<FreeInst>(Ins) include in CallInst*/ ) return true;
    return false;
 }
 
@@ -1058,7 +1497,6 @@ bool InsDuplica::isSynchPoint (Instruction *Ins) {
 //////////////////////////////////////
 bool InsDuplica::isBranchCond ( Instruction *Ins) {
    TerminatorInst * lastIns = Ins->getParent()->getTerminator();
-   assert(!(isa<SwitchInst>(lastIns)) && "Find a SwitchInst! You need to lower SwitchInst.");
    if (BranchInst* BI = dyn_cast<BranchInst>(lastIns)) 
       if (BI->isConditional()) {
          Instruction* Cond = dyn_cast<Instruction>(BI->getCondition());
@@ -1088,7 +1526,6 @@ BranchInst *InsDuplica::hasConditionalBr(BasicBlock *BB) {
 /////////////////////////////////////
 Instruction* InsDuplica::findLastCond (BasicBlock *BB) {
    TerminatorInst *lastIns = BB->getTerminator();
-   assert(!(isa<SwitchInst>(lastIns)) && "Find a SwitchInst! You need to lower SwitchInst.");
    BranchInst * BI = dyn_cast<BranchInst>(lastIns);
    if (BI && (BI->isConditional())) {
       Value *cond = BI->getCondition();
@@ -1133,24 +1570,10 @@ bool InsDuplica::notdummyFunc(Function &F) {
 ////////////////////////////////////
 //workFunc()                      //
 ////////////////////////////////////
+//The working set is chosen by PolicySelector (annotations,
+//-ifdup-policy-file, -ifdup-only and -ifdup-skip).
 bool InsDuplica::workFunc(Function &F) {
-#ifdef FUNC_DEBUG
-   std::set<std::string> notWorkingFunc;
-   //   notWorkingFunc.insert("CollectGarb");
-   //   notWorkingFunc.insert("ProdInt");
-   //   notWorkingFunc.insert("EvVar");
-   //   notWorkingFunc.insert("NewBag");
-   //   notWorkingFunc.insert("SumInt");
-
-   std::string funcname = F.getName();
-   if (notWorkingFunc.find(funcname) == notWorkingFunc.end()) {
-      //func name is not within notWorkingFunc
-      return true;
-   } else
-      return false;
-#else
-   return true;
-#endif  //FUNC_DEBUG
+   return policy.enabled;
 }
 
 
@@ -1224,26 +1647,260 @@ void InsDuplica::updatePHInodesBB(BasicBlock *myBB, BasicBlock *fromBB, BasicBlo
 void InsDuplica::dupFuncArgu(Function &F) {
    BasicBlock *firstBB = F.begin();
    Instruction *firstI = firstBB->begin();
+   Lock& LockIns = getAnalysis<Lock>();
+   arguSet.clear();
+
+   //A shadow clone receives the duplicates from its caller
+   int numOrig = ShadowCall::numOrigParams(&F);
+   if (numOrig >= 0) {
+      std::vector<Argument*> args;
+      for (Function::arg_iterator AI = F.arg_begin(), E = F.arg_end(); AI != E; ++AI)
+         args.push_back(AI);
+      for (int i = 0; i < numOrig; i++) {
+         arguSet.insert(args[i]);
+         valueMap[args[i]] = args[i+numOrig];
+         valueMap[args[i+numOrig]] = args[i+numOrig];
+      }
+      return;
+   }
+
    for (Function::arg_iterator AI = F.arg_begin(), E = F.arg_end();
          AI != E; ++AI) {
       arguSet.insert(AI);
 
       //if argument is used only once or all on the same block,
       //do not dup it.
-      if (AI->hasOneUse()) {
+      //A bitcast to its own type is only valid on first class,
+      //non-aggregate values.
+      Type *arguType = AI->getType();
+      if (AI->hasOneUse() || arguType->isAggregateType() || !arguType->isFirstClassType()) {
          valueMap[AI] = AI;
       } else {
-         //make copy of cast
-         Type *arguType = AI->getType();
-         //FIXME unknow signed or not
-         //haomeng find insert ???
-         CastInst* newCast = CastInst::CreateIntegerCast(AI, arguType, 1, AI->getName()+"_dup", firstI);
-         //CastInst *newCast = new CastInst(AI, arguType, AI->getName()+"_dup", firstI);
+         //make a locked copy, works for pointers and floats too
+         Instruction* newCast = CastInst::Create(Instruction::BitCast, AI, arguType, AI->getName()+"_dup", firstI);
+         newCast = LockIns.lock_inst(newCast);
          valueMap[AI] = newCast;
       }
    }
 }
 
+////////////////////////////////////////
+//getShadowDup()                      //
+//dup of v if known, v itself otherwise//
+////////////////////////////////////////
+Value *InsDuplica::getShadowDup(Value *v) {
+   if (curSafeRegs && curSafeRegs->isValueSafe(v)) return v;
+   if (valueMap.count(v) > 0) return valueMap[v];
+   return v;
+}
+
+////////////////////////////////////////
+//patchShadowCall()                   //
+//call f.shadow(a,a) => f.shadow(a,a') //
+//Operands dominate the call, so their //
+//dups are already in valueMap.        //
+////////////////////////////////////////
+void InsDuplica::patchShadowCall(CallInst *CI) {
+   unsigned int numArgs = CI->getNumArgOperands();
+   assert(numArgs % 2 == 0 && "shadow call takes every argument twice");
+   unsigned int numOrig = numArgs/2;
+   for (unsigned int i = 0; i < numOrig; i++)
+      CI->setArgOperand(i+numOrig, getShadowDup(CI->getArgOperand(i)));
+}
+
+////////////////////////////////////////
+//DuplicaShadow()                     //
+//Instructions built by ShadowCall are //
+//not duplicated; they carry the dups. //
+////////////////////////////////////////
+void InsDuplica::DuplicaShadow(Instruction *I) {
+   valueMap[I] = I;
+   if (ExtractValueInst *EV = dyn_cast<ExtractValueInst>(I)) {
+      //r = extractvalue %pair, 0 : its dup is extractvalue %pair, 1
+      if (*EV->idx_begin() != 0) return;
+      Value *pair = EV->getAggregateOperand();
+      for (Value::use_iterator UI = pair->use_begin(), UE = pair->use_end(); UI != UE; ++UI) {
+         ExtractValueInst *other = dyn_cast<ExtractValueInst>(*UI);
+         if (other && *other->idx_begin() == 1) {
+            valueMap[I] = other;
+            updateUsersMap(I, other);
+            return;
+         }
+      }
+   } else if (InsertValueInst *IV = dyn_cast<InsertValueInst>(I)) {
+      //ret {r, r} : the second slot returns the dup of r
+      if (*IV->idx_begin() == 1)
+         IV->setOperand(1, getShadowDup(IV->getInsertedValueOperand()));
+   }
+}
+
+////////////////////////////////////////
+//DuplicaSlot()                       //
+//A private alloca gets its own copy; //
+//the duplicated stream works on it.  //
+////////////////////////////////////////
+void InsDuplica::DuplicaSlot(Instruction *I) {
+   assert(isa<AllocaInst>(I) && "only allocas have slots");
+   Instruction *newI = I->clone();
+   if (I->hasName())
+      newI->setName(I->getName() + "_dup");
+   I->getParent()->getInstList().insert(I, newI);
+
+   valueMap[I] = newI;
+   updateUsersMap(I, newI);
+
+   localnumslot++;
+   NumInsDup++;
+   localnuminsdup++;
+}
+
+////////////////////////////////////////
+//setupSampling()                     //
+//pick the loops whose checks are     //
+//sampled (policy.sampleCheck)        //
+////////////////////////////////////////
+void InsDuplica::setupSampling(Function &F, LoopInfo &LI) {
+   sampleAcc = NULL;
+   sampleBlocks.clear();
+   sampleHeaders.clear();
+   sampleExits.clear();
+
+   //"ifdup-sample-rate" is already folded in by ProtectPolicy
+   int rate = policy.sampleRate;
+   if (rate <= 1) return;
+
+   std::list<Loop*> worklist(LI.begin(), LI.end());
+   while (!worklist.empty()) {
+      Loop *L = worklist.front();
+      worklist.pop_front();
+      const std::vector<Loop*>&subloops = L->getSubLoops();
+      worklist.insert(worklist.end(), subloops.begin(), subloops.end());
+      if (!canSampleLoop(L)) continue;
+
+      sampleHeaders.push_back(L->getHeader());
+      sampleBlocks.insert(L->block_begin(), L->block_end());
+      SmallVector<BasicBlock*,8> exits;
+      L->getUniqueExitBlocks(exits);
+      sampleExits.insert(exits.begin(), exits.end());
+   }
+   if (sampleHeaders.empty()) return;
+
+   localsamplerate = rate;
+   //initialised to 0 by finishSampling()
+   sampleAcc = new AllocaInst(Type::getInt64Ty(F.getContext()), "ifdup.acc", F.begin()->begin());
+}
+
+//A difference must be flushed before it can be observed outside the
+//loop, so loops that call functions keep exact checks.
+bool InsDuplica::canSampleLoop(Loop *L) {
+   //with a profile, only loops that run at least a sample period per
+   //call are worth it; the others keep their exact checks
+   if (profile) {
+      uint64_t entry = profile->entryCount();
+      if (profile->count(L->getHeader()) < (uint64_t)policy.sampleRate * (entry ? entry : 1))
+         return false;
+   }
+   for (Loop::block_iterator bi = L->block_begin(), be = L->block_end(); bi != be; ++bi) {
+      BasicBlock *BB = *bi;
+      if (!isa<BranchInst>(BB->getTerminator())) return false;
+      for (BasicBlock::iterator I = BB->begin(), E = BB->end(); I != E; ++I)
+         if (CallClassify::isSynchCall(I) && !privateSlots.isPrivateAccess(I)) return false;
+   }
+   return true;
+}
+
+//checks of BB are sampled; ty must fit into the 64-bit accumulator
+bool InsDuplica::isSampled(BasicBlock *BB, Type *ty) {
+   if (!sampleAcc || sampleBlocks.count(BB) == 0) return false;
+   if (ty->isPointerTy() || ty->isFloatTy() || ty->isDoubleTy()) return true;
+   return (ty->isIntegerTy() && ty->getIntegerBitWidth() <= 64);
+}
+
+//v is (part of) the address synchI stores to
+bool InsDuplica::isStoreAddress(Value *v, Instruction *synchI) {
+   StoreInst *StoreI = dyn_cast<StoreInst>(synchI);
+   return StoreI && v != StoreI->getValueOperand();
+}
+
+//v as an integer of the same size
+Value *InsDuplica::asSampleInt(Value *v, Instruction *insertBefore) {
+   LLVMContext &C = insertBefore->getContext();
+   Type *ty = v->getType();
+   if (ty->isPointerTy())
+      return new PtrToIntInst(v, Type::getInt64Ty(C), v->getName()+"_si", insertBefore);
+   if (ty->isFloatTy())
+      return new BitCastInst(v, Type::getInt32Ty(C), v->getName()+"_si", insertBefore);
+   if (ty->isDoubleTy())
+      return new BitCastInst(v, Type::getInt64Ty(C), v->getName()+"_si", insertBefore);
+   return v;
+}
+
+////////////////////////////////////////
+//accumulateDiff()                    //
+//acc |= zext(diff)                   //
+////////////////////////////////////////
+void InsDuplica::accumulateDiff(Value *diff, Instruction *insertBefore) {
+   Type *i64 = Type::getInt64Ty(insertBefore->getContext());
+   Value *wide = diff;
+   if (diff->getType() != i64)
+      wide = new ZExtInst(diff, i64, "", insertBefore);
+   LoadInst *acc = new LoadInst(sampleAcc, "", insertBefore);
+   Instruction *newacc = BinaryOperator::CreateOr(acc, wide, "", insertBefore);
+   new StoreInst(newacc, sampleAcc, insertBefore);
+
+   localnumsampled++;
+   NumInsDup += 4;
+   localnuminsdup += 4;
+}
+
+//at the end of BB: acc == 0 ? next : error
+void InsDuplica::flushSample(BasicBlock *BB, BasicBlock *next) {
+   LoadInst *acc = new LoadInst(sampleAcc, "", BB);
+   Instruction *ok = new ICmpInst(*BB, ICmpInst::ICMP_EQ, acc,
+         ConstantInt::get(Type::getInt64Ty(BB->getContext()), 0), "acc_ok");
+   sites.addSite(BranchInst::Create(next, errorBlock, ok, BB), 0);
+   NumInsDup += 3;
+   localnuminsdup += 3;
+}
+
+////////////////////////////////////////
+//finishSampling()                    //
+//countdown at each sampled header,   //
+//flush at each loop exit             //
+////////////////////////////////////////
+void InsDuplica::finishSampling(Function &F) {
+   if (!sampleAcc) return;
+   LLVMContext &C = F.getContext();
+   Type *i32 = Type::getInt32Ty(C);
+   Instruction *initPos = sampleAcc->getNextNode();
+   new StoreInst(ConstantInt::get(Type::getInt64Ty(C), 0), sampleAcc, initPos);
+
+   for (unsigned int i = 0; i < sampleHeaders.size(); i++) {
+      BasicBlock *H = sampleHeaders[i];
+      AllocaInst *cnt = new AllocaInst(i32, H->getName()+".cnt", sampleAcc);
+      new StoreInst(ConstantInt::get(i32, localsamplerate), cnt, initPos);
+
+      //H: if (--cnt == 0) goto H_sample; H_sample: cnt = rate, flush
+      BasicBlock *rest = H->splitBasicBlock(H->getFirstNonPHI(), H->getName()+"_body");
+      H->getTerminator()->eraseFromParent();
+      LoadInst *c = new LoadInst(cnt, "", H);
+      Instruction *c1 = BinaryOperator::CreateSub(c, ConstantInt::get(i32, 1), "", H);
+      new StoreInst(c1, cnt, H);
+      Instruction *due = new ICmpInst(*H, ICmpInst::ICMP_EQ, c1, ConstantInt::get(i32, 0), "sample_due");
+      BasicBlock *sampleBB = BasicBlock::Create(C, H->getName()+"_sample", &F, rest);
+      BranchInst::Create(sampleBB, rest, due, H);
+      new StoreInst(ConstantInt::get(i32, localsamplerate), cnt, sampleBB);
+      flushSample(sampleBB, rest);
+   }
+
+   for (std::set<BasicBlock*>::iterator i = sampleExits.begin(), e = sampleExits.end(); i != e; ++i) {
+      BasicBlock *E = *i;
+      BasicBlock *rest = E->splitBasicBlock(E->getFirstInsertionPt(), E->getName()+"_flushed");
+      E->getTerminator()->eraseFromParent();
+      flushSample(E, rest);
+   }
+}
+
 ///////////////////////////
 //isFuncArgu()           //
 ///////////////////////////
@@ -1252,13 +1909,86 @@ bool InsDuplica::isFuncArgu(Value *v) {
    else return false;
 }
 
+////////////////////////////////////////
+//measureBefore()                     //
+//size of F, plain and weighted by the//
+//profile counts or 8^loop depth      //
+////////////////////////////////////////
+static uint64_t depthWeight(unsigned int depth) {
+   if (depth > 6) depth = 6;
+   return (uint64_t)1 << (3*depth);
+}
+
+void InsDuplica::measureBefore(Function &F, LoopInfo &LI) {
+   for (Function::iterator BBi = F.begin(), BBE = F.end(); BBi!=BBE; ++BBi) {
+      BasicBlock *BB = BBi;
+      uint64_t weight = profile ? profile->count(BB) : depthWeight(LI.getLoopDepth(BB));
+      blockWeight[BB] = weight;
+      localstaticbefore += BB->size();
+      localdynbefore += BB->size() * weight;
+   }
+}
+
+////////////////////////////////////////
+//measureAfter()                      //
+//a block added during duplication    //
+//runs as often as its predecessors,  //
+//at most as often as the original    //
+//block it leads to (checker blocks   //
+//on one side of a branch)            //
+////////////////////////////////////////
+void InsDuplica::measureAfter(Function &F) {
+   for (Function::iterator BBi = F.begin(), BBE = F.end(); BBi!=BBE; ++BBi)
+      localstaticafter += BBi->size();
+
+   ReversePostOrderTraversal<Function*> RPOT(&F);
+   for (ReversePostOrderTraversal<Function*>::rpo_iterator
+         I = RPOT.begin(), E = RPOT.end(); I != E; ++I) {
+      BasicBlock *BB = *I;
+      //the error block only runs once a fault is detected
+      if (BB == errorBlock) continue;
+
+      if (blockWeight.count(BB) == 0) {
+         uint64_t weight = 0;
+         for (pred_iterator PI = pred_begin(BB), PE = pred_end(BB); PI != PE; ++PI)
+            if (blockWeight.count(*PI) && blockWeight[*PI] > weight) weight = blockWeight[*PI];
+         TerminatorInst *T = BB->getTerminator();
+         if (T->getNumSuccessors() == 1 && blockWeight.count(T->getSuccessor(0)))
+            weight = std::min(weight, blockWeight[T->getSuccessor(0)]);
+         blockWeight[BB] = weight;
+      }
+      localdynafter += BB->size() * blockWeight[BB];
+   }
+}
+
 ////////////////////////////
 //counterdump()           //
 ////////////////////////////
 void InsDuplica::counterdump(Function&F) {
+   errs() << "local policy: " << policy.str() << " (" << F.getName() <<")\n";
+   errs() << "local static size: " << localstaticbefore << " -> " << localstaticafter
+      << ", overhead " << overheadPercent(localstaticbefore, localstaticafter) << "% (" << F.getName() <<")\n";
+   errs() << (profile ? "local profiled dynamic size: " : "local estimated dynamic size: ")
+      << localdynbefore << " -> " << localdynafter
+      << ", overhead " << overheadPercent(localdynbefore, localdynafter) << "% (" << F.getName() <<")\n";
    errs() << "local generated branch checker BBs: " << localnumBBchecker <<" ("<< F.getName() <<")\n";
    errs() << "local generated store checker BBs: " << localnumStorechecker <<" ("<<F.getName() <<")\n";
    errs() << "local generated instructions: " << localnuminsdup << " (" << F.getName() <<")\n";
+   errs() << "local duplicated pure calls: " << localnumcalldup << " (" << F.getName() <<")\n";
+   errs() << "local shared pure calls: " << localnumcallshare << " (" << F.getName() <<")\n";
+   errs() << "local ignored calls: " << localnumcallignore << " (" << F.getName() <<")\n";
+   errs() << "local promoted allocas: " << localnumpromoted << " (" << F.getName() <<")\n";
+   errs() << "local duplicated private slots: " << localnumslot << " (" << F.getName() <<")\n";
+   errs() << "local duplicated private slot accesses: " << localnumslotaccess << " (" << F.getName() <<")\n";
+   errs() << "local sampled checks: " << localnumsampled << " (" << F.getName() <<")\n";
+   errs() << "local reloaded stores: " << localnumreload << " (" << F.getName() <<")\n";
+   errs() << "local data instructions kept: " << localnumdatakept << " (" << F.getName() <<")\n";
+   errs() << "local data checks dropped: " << localnumdataskip << " (" << F.getName() <<")\n";
+   errs() << "local checked switches: " << localnumswitch << " (" << F.getName() <<")\n";
+   errs() << "local store signature loops: " << localnumstsigloop << " (" << F.getName() <<")\n";
+   errs() << "local store signature updates: " << localnumstsigcal << " (" << F.getName() <<")\n";
+   errs() << "local store signature checks: " << localnumstsigcheck << " (" << F.getName() <<")\n";
+   errs() << "local sample rate: " << localsamplerate << ", latency bound " << localsamplerate << " iterations (" << F.getName() <<")\n";
 
    //for redundant checkings
 
@@ -1282,6 +2012,28 @@ void InsDuplica::initLocalCounter() {
    localnuminsdup = 0;
    localnumStorechecker=0;
    localnumBBchecker = 0;
+   localnumcalldup = 0;
+   localnumcallignore = 0;
+   localnumcallshare = 0;
+   localnumpromoted = 0;
+   localnumslot = 0;
+   localnumslotaccess = 0;
+   localnumsampled = 0;
+   localnumswitch = 0;
+   localnumreload = 0;
+   localnumdatakept = 0;
+   localnumdataskip = 0;
+   ldAddr = NULL;
+   localsamplerate = 0;
+   localnumstsigloop = 0;
+   localnumstsigcal = 0;
+   localnumstsigcheck = 0;
+   stVAtool = NULL;
+   sampleAcc = NULL;
+   sampleBlocks.clear();
+   localstaticbefore = localstaticafter = 0;
+   localdynbefore = localdynafter = 0;
+   blockWeight.clear();
 
 
    //for redundant checkings
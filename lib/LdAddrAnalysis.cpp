@@ -0,0 +1,269 @@
+//---Developed by Jing Yu ---- //
+//LdAddrAnalysis.cpp          //
+//============================//
+//Values that reach a load    //
+//address or a branch         //
+//============================//
+
+#include "LdAddrAnalysis.h"
+#include "OverheadEstimator.h"
+#include "CallClassify.h"
+#include <llvm/IR/Metadata.h>
+#include <llvm/Support/raw_ostream.h>
+
+using namespace llvm;
+
+char LdAddr::ID = 0;
+static RegisterPass<LdAddr> X("LdAddr", "Report the values reaching load addresses and branches", false, true);
+
+////////////////////////////////////
+//InstDupMap                      //
+////////////////////////////////////
+void InstDupMap::tagDup(Instruction *origI, Instruction *dupI) {
+   Value *orig = origI;
+   dupI->setMetadata("ifdup.dupof", MDNode::get(origI->getContext(), orig));
+}
+
+Instruction *InstDupMap::dupOf(Instruction *I) {
+   MDNode *md = I->getMetadata("ifdup.dupof");
+   if (!md || md->getNumOperands() == 0) return NULL;
+   return dyn_cast_or_null<Instruction>(md->getOperand(0));
+}
+
+void InstDupMap::buildMap(Instruction *I) {
+   Instruction *origI = dupOf(I);
+   if (!origI || InstMap.count(origI)) return;
+   InstPair *pair = new InstPair(origI, I);
+   InstMap[origI] = pair;
+   InstMap[I] = pair;
+}
+
+bool InstDupMap::isdup(Instruction *I) {
+   std::map<Instruction*, InstPair*>::iterator it = InstMap.find(I);
+   return (it != InstMap.end() && it->second->getdupI() == I);
+}
+
+bool InstDupMap::hasDup(Instruction *I) {
+   std::map<Instruction*, InstPair*>::iterator it = InstMap.find(I);
+   return (it != InstMap.end() && it->second->getorigI() == I);
+}
+
+void InstDupMap::clear() {
+   for (std::map<Instruction*, InstPair*>::iterator it = InstMap.begin(), e = InstMap.end(); it != e; ++it)
+      if (it->first == it->second->getorigI()) delete it->second;
+   InstMap.clear();
+}
+
+////////////////////////////////////
+//runOnFunction()                 //
+////////////////////////////////////
+bool LdAddr::runOnFunction(Function &F) {
+   analyze(F);
+
+   //what the slice of each condition goes through
+   for (std::set<Instruction*>::iterator ci = condset.begin(), ce = condset.end(); ci != ce; ++ci) {
+      Value *cond = isa<BranchInst>(*ci) ? cast<BranchInst>(*ci)->getCondition()
+         : cast<SwitchInst>(*ci)->getCondition();
+      int from = scanValue(cond);
+      if (from & 1) localbrconduseload++;
+      if (from == 1) localbrcondduetold++;
+      else if (from == 2) localbrcondduetoiv++;
+      else if (from == 3) localbrcondduetoldiv++;
+   }
+   printStat(F);
+   return false;
+}
+
+////////////////////////////////////
+//analyze()                       //
+////////////////////////////////////
+void LdAddr::analyze(Function &F) {
+   initLocalCounter();
+   needprotectset.clear();
+   needprotectslots.clear();
+   needprotectIV.clear();
+   condset.clear();
+   loadlist.clear();
+   setupmap(F);
+
+   for (Function::iterator BBi = F.begin(), BBE = F.end(); BBi != BBE; ++BBi) {
+      for (BasicBlock::iterator I = BBi->begin(), E = BBi->end(); I != E; ++I) {
+         //checks and duplicates of an earlier -InsDup
+         if (instmap.isdup(I) || OverheadEstimator::isAdded(I)) continue;
+
+         if (LoadInst *LI = dyn_cast<LoadInst>(I)) {
+            loadlist.push_back(LI);
+         } else if (StoreInst *SI = dyn_cast<StoreInst>(I)) {
+            needprotect(SI->getPointerOperand());
+         } else if (BranchInst *BI = dyn_cast<BranchInst>(I)) {
+            if (BI->isConditional()) condset.insert(BI);
+         } else if (isa<SwitchInst>(I)) {
+            condset.insert(I);
+         } else if (IndirectBrInst *IBI = dyn_cast<IndirectBrInst>(I)) {
+            needprotect(IBI->getAddress());
+         } else if (CallInst *CI = dyn_cast<CallInst>(I)) {
+            if (!CI->getCalledFunction()) needprotect(CI->getCalledValue());
+            //the callee dereferences what it is passed, memset(p + off, ...)
+            if (CallClassify::isSynchCall(CI))
+               for (unsigned int i = 0; i < CI->getNumArgOperands(); i++)
+                  if (CI->getArgOperand(i)->getType()->isPointerTy())
+                     needprotect(CI->getArgOperand(i));
+         }
+      }
+   }
+   scanLoadList();
+   scanCondset();
+   localindphi = needprotectIV.size();
+}
+
+void LdAddr::setupmap(Function &F) {
+   instmap.clear();
+   for (Function::iterator BBi = F.begin(), BBE = F.end(); BBi != BBE; ++BBi)
+      for (BasicBlock::iterator I = BBi->begin(), E = BBi->end(); I != E; ++I)
+         instmap.buildMap(I);
+}
+
+void LdAddr::scanLoadList() {
+   for (std::list<LoadInst*>::iterator li = loadlist.begin(), le = loadlist.end(); li != le; ++li) {
+      Value *addr = (*li)->getPointerOperand();
+      localtotalload++;
+      Instruction *addrI = dyn_cast<Instruction>(addr);
+      //globals and locals are constant addresses
+      if (addrI && !isa<AllocaInst>(addrI)) {
+         localloadaddr++;
+         if (instmap.hasDup(addrI)) localprotectedload++;
+         else localunprotectedload++;
+      }
+      needprotect(addr);
+   }
+}
+
+void LdAddr::scanCondset() {
+   for (std::set<Instruction*>::iterator ci = condset.begin(), ce = condset.end(); ci != ce; ++ci) {
+      Value *cond = isa<BranchInst>(*ci) ? cast<BranchInst>(*ci)->getCondition()
+         : cast<SwitchInst>(*ci)->getCondition();
+      localtotalcond++;
+      if (Instruction *condI = dyn_cast<Instruction>(cond))
+         if (!instmap.hasDup(condI)) localnumcondnodup++;
+      needprotect(cond);
+   }
+}
+
+////////////////////////////////////
+//needprotect()                   //
+//V and everything it is computed //
+//from                            //
+////////////////////////////////////
+void LdAddr::needprotect(Value *V) {
+   std::list<Value*> worklist(1, V);
+   while (!worklist.empty()) {
+      Value *v = worklist.front();
+      worklist.pop_front();
+      if (!isa<Instruction>(v) && !isa<Argument>(v)) continue;
+      Instruction *I = dyn_cast<Instruction>(v);
+      if (I && OverheadEstimator::isAdded(I)) continue;
+      if (!needprotectset.insert(v).second) continue;
+      if (!I) continue;
+
+      if (PHINode *PN = dyn_cast<PHINode>(I))
+         if (isInductionPHI(PN)) needprotectIV.insert(PN);
+      //a value read back from a local slot, idx[0] = f(x); a[idx[0]]:
+      //a duplicated private slot gets f(x) twice, so f(x) is in the slice
+      if (LoadInst *LI = dyn_cast<LoadInst>(I))
+         if (AllocaInst *AI = slotOf(LI->getPointerOperand()))
+            if (needprotectslots.insert(AI).second)
+               storedInto(AI, worklist);
+      for (User::op_iterator oi = I->op_begin(), oe = I->op_end(); oi != oe; ++oi)
+         worklist.push_back(*oi);
+   }
+}
+
+//the alloca addr points into, through GEPs and casts; NULL if none
+AllocaInst *LdAddr::slotOf(Value *addr) {
+   while (true) {
+      if (AllocaInst *AI = dyn_cast<AllocaInst>(addr)) return AI;
+      if (GetElementPtrInst *GEP = dyn_cast<GetElementPtrInst>(addr)) addr = GEP->getPointerOperand();
+      else if (BitCastInst *BC = dyn_cast<BitCastInst>(addr)) addr = BC->getOperand(0);
+      else return NULL;
+   }
+}
+
+//the values stored anywhere into AI
+void LdAddr::storedInto(AllocaInst *AI, std::list<Value*> &worklist) {
+   std::list<Value*> ptrs(1, AI);
+   while (!ptrs.empty()) {
+      Value *p = ptrs.front();
+      ptrs.pop_front();
+      for (Value::use_iterator ui = p->use_begin(), ue = p->use_end(); ui != ue; ++ui) {
+         if (StoreInst *SI = dyn_cast<StoreInst>(*ui)) {
+            if (SI->getPointerOperand() == p) worklist.push_back(SI->getValueOperand());
+         } else if (isa<GetElementPtrInst>(*ui) || isa<BitCastInst>(*ui)) {
+            if (cast<Instruction>(*ui)->getOperand(0) == p) ptrs.push_back(*ui);
+         }
+      }
+   }
+}
+
+//a PHI stepped by an operation on itself
+bool LdAddr::isInductionPHI(PHINode *PN) {
+   for (unsigned int i = 0; i < PN->getNumIncomingValues(); i++) {
+      BinaryOperator *step = dyn_cast<BinaryOperator>(PN->getIncomingValue(i));
+      if (step && (step->getOperand(0) == PN || step->getOperand(1) == PN)) return true;
+   }
+   return false;
+}
+
+//1 if a load computes V, 2 if an induction variable does, 3 for both
+int LdAddr::scanValue(Value *V) {
+   int from = 0;
+   std::set<Value*> visited;
+   std::list<Value*> worklist(1, V);
+   while (!worklist.empty()) {
+      Instruction *I = dyn_cast<Instruction>(worklist.front());
+      worklist.pop_front();
+      if (!I || OverheadEstimator::isAdded(I) || !visited.insert(I).second) continue;
+      if (isa<LoadInst>(I)) {
+         from |= 1;
+         continue;
+      }
+      if (needprotectIV.count(I)) {
+         from |= 2;
+         continue;
+      }
+      for (User::op_iterator oi = I->op_begin(), oe = I->op_end(); oi != oe; ++oi)
+         worklist.push_back(*oi);
+   }
+   return from;
+}
+
+void LdAddr::initLocalCounter() {
+   localtotalload = 0;
+   localprotectedload = 0;
+   localunprotectedload = 0;
+   localindphi = 0;
+   localloadaddr = 0;
+
+   localbrconduseload = 0;
+   localnumcondnodup = 0;
+   localtotalcond = 0;
+   localbrcondduetoiv = 0;
+   localbrcondduetold = 0;
+   localbrcondduetoldiv = 0;
+}
+
+void LdAddr::printStat(Function &F) {
+   errs() << "local loads: " << localtotalload << " (" << F.getName() <<")\n";
+   errs() << "local loads from computed addresses: " << localloadaddr << " (" << F.getName() <<")\n";
+   errs() << "local loads from duplicated addresses: " << localprotectedload << " (" << F.getName() <<")\n";
+   errs() << "local loads from unduplicated addresses: " << localunprotectedload << " (" << F.getName() <<")\n";
+   errs() << "local induction variables in slices: " << localindphi << " (" << F.getName() <<")\n";
+   errs() << "local conditions: " << localtotalcond << " (" << F.getName() <<")\n";
+   errs() << "local conditions without duplicate: " << localnumcondnodup << " (" << F.getName() <<")\n";
+   errs() << "local conditions using loads: " << localbrconduseload << " (" << F.getName() <<")\n";
+   errs() << "local conditions from loads only: " << localbrcondduetold << " (" << F.getName() <<")\n";
+   errs() << "local conditions from induction variables only: " << localbrcondduetoiv << " (" << F.getName() <<")\n";
+   errs() << "local conditions from loads and induction variables: " << localbrcondduetoldiv << " (" << F.getName() <<")\n";
+   errs() << "local values reaching addresses or branches: " << needprotectset.size() << " (" << F.getName() <<")\n";
+}
+
+// vim: ts=3 sts=3 sw=3 et
@@ -49,6 +49,11 @@ static std::string judgeType(Type* ty)
    if(tyid==Type::IntegerTyID){
       name=name+getString(tyid)+getString(tmp->getPrimitiveSizeInBits());
    }
+   else if(tyid==Type::VectorTyID){
+      //lanes and element type, or <2 x i32> and <2 x i64> share a name
+      name=name+getString(tyid)+"x"+getString(tmp->getVectorNumElements())
+         +judgeType(tmp->getVectorElementType());
+   }
    else if(tyid==Type::StructTyID){
       name=name+getString(tyid)+tmp->getStructName().str();
    }
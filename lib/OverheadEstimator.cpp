@@ -0,0 +1,166 @@
+////////////////////////////////////////
+//OverheadEstimator.cpp               //
+////////////////////////////////////////
+//Frequency weighted size of original //
+//and added code, per function and    //
+//module                              //
+////////////////////////////////////////
+
+#include "OverheadEstimator.h"
+#include "BlockProfile.h"
+#include <llvm/Analysis/BlockFrequencyInfo.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Metadata.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/Format.h>
+
+using namespace llvm;
+
+static cl::opt<std::string> CostFileOpt("ifdup-cost-file",
+      cl::desc("Write the IFDUP_COST lines of -IFDupCost to this file"),
+      cl::value_desc("filename"), cl::init(""));
+
+char OverheadEstimator::ID = 0;
+static RegisterPass<OverheadEstimator> X("IFDupCost", "Estimate the dynamic overhead of the duplication", false, true);
+
+void OverheadEstimator::getAnalysisUsage(AnalysisUsage &AU) const {
+   AU.addRequired<BlockFrequencyInfo>();
+   AU.setPreservesAll();
+}
+
+////////////////////////////////////
+//tagging                         //
+////////////////////////////////////
+void OverheadEstimator::recordOriginal(Function &F, std::set<Instruction*> &orig) {
+   orig.clear();
+   for (Function::iterator BBi = F.begin(), BBE = F.end(); BBi!=BBE; ++BBi)
+      for (BasicBlock::iterator I = BBi->begin(), E = BBi->end(); I != E; ++I)
+         orig.insert(I);
+}
+
+void OverheadEstimator::tagAdded(Function &F, std::set<Instruction*> &orig) {
+   LLVMContext &C = F.getContext();
+   MDNode *tag = MDNode::get(C, MDString::get(C, "IFDup"));
+   for (Function::iterator BBi = F.begin(), BBE = F.end(); BBi!=BBE; ++BBi)
+      for (BasicBlock::iterator I = BBi->begin(), E = BBi->end(); I != E; ++I)
+         if (orig.count(I) == 0) I->setMetadata("ifdup.added", tag);
+   orig.clear();
+}
+
+bool OverheadEstimator::isAdded(Instruction *I) {
+   return I->getMetadata("ifdup.added") != NULL;
+}
+
+////////////////////////////////////
+//Amounts                         //
+////////////////////////////////////
+void OverheadEstimator::Amounts::clear() {
+   insts = addedInsts = 0;
+   branches = addedBranches = 0;
+   blocks = addedBlocks = 0;
+}
+
+void OverheadEstimator::Amounts::add(Amounts &a, double times) {
+   insts += a.insts * times;
+   addedInsts += a.addedInsts * times;
+   branches += a.branches * times;
+   addedBranches += a.addedBranches * times;
+   blocks += a.blocks * times;
+   addedBlocks += a.addedBlocks * times;
+}
+
+////////////////////////////////////
+//doInitialization()              //
+////////////////////////////////////
+bool OverheadEstimator::doInitialization(Module &M) {
+   module.clear();
+   moduleCalls = 0;
+   out = &errs();
+   file = NULL;
+   if (!CostFileOpt.empty()) {
+      std::string err;
+      file = new raw_fd_ostream(CostFileOpt.c_str(), err);
+      if (err.empty()) out = file;
+      else {
+         errs() << "IFDup: cannot write " << CostFileOpt << ": " << err << "\n";
+         delete file;
+         file = NULL;
+      }
+   }
+   printHeader();
+   return false;
+}
+
+////////////////////////////////////
+//runOnFunction()                 //
+////////////////////////////////////
+bool OverheadEstimator::runOnFunction(Function &F) {
+   BlockFrequencyInfo &BFI = getAnalysis<BlockFrequencyInfo>();
+   double entry = BFI.getBlockFreq(&F.getEntryBlock()).getFrequency();
+   if (entry == 0) entry = 1;
+
+   Amounts a;
+   a.clear();
+   for (Function::iterator BBi = F.begin(), BBE = F.end(); BBi!=BBE; ++BBi) {
+      BasicBlock *BB = BBi;
+      //executions per call of F
+      double f = BFI.getBlockFreq(BB).getFrequency() / entry;
+      bool addedBB = true;
+      for (BasicBlock::iterator I = BB->begin(), E = BB->end(); I != E; ++I) {
+         if (isAdded(I)) a.addedInsts += f;
+         else {
+            a.insts += f;
+            addedBB = false;
+         }
+      }
+      if (addedBB) a.addedBlocks += f;
+      else a.blocks += f;
+
+      TerminatorInst *T = BB->getTerminator();
+      if (T->getNumSuccessors() > 1) {
+         if (isAdded(T)) a.addedBranches += f;
+         else a.branches += f;
+      }
+   }
+
+   double calls = 1;
+   if (BlockProfile::hasProfile(F)) {
+      BlockProfile profile(F, BFI);
+      if (profile.valid()) calls = profile.entryCount();
+   }
+   printLine("IFDUP_COST", F.getName(), calls, a);
+   module.add(a, calls);
+   moduleCalls += calls;
+   return false;
+}
+
+bool OverheadEstimator::doFinalization(Module &M) {
+   printLine("IFDUP_COST_MODULE", M.getModuleIdentifier(), moduleCalls, module);
+   out->flush();
+   delete file;
+   file = NULL;
+   out = NULL;
+   return false;
+}
+
+////////////////////////////////////
+//output                          //
+////////////////////////////////////
+//growth in percent, 0 if there was nothing
+static double inflation(double orig, double added) {
+   return orig > 0 ? 100.0 * added / orig : 0;
+}
+
+void OverheadEstimator::printHeader() {
+   *out << "# IFDUP_COST name calls insts added_insts branches added_branches"
+      << " blocks added_blocks inst_inflation% branch_inflation%\n";
+}
+
+void OverheadEstimator::printLine(StringRef kind, StringRef name, double calls, Amounts &a) {
+   *out << kind << " " << name
+      << format(" %.0f %.2f %.2f %.2f %.2f %.2f %.2f %.2f %.2f\n", calls,
+            a.insts, a.addedInsts, a.branches, a.addedBranches, a.blocks, a.addedBlocks,
+            inflation(a.insts, a.addedInsts), inflation(a.branches, a.addedBranches));
+}
+
+// vim: ts=3 sts=3 sw=3 et
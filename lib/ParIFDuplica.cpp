@@ -10,27 +10,43 @@
 #include <llvm/IR/Module.h>
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/ADT/Statistic.h>
+#include <llvm/Support/CommandLine.h>
 #include <llvm/Support/raw_ostream.h>
 
 #include <list>
+#include <iterator>
 #include "ShortcutDetector.h"
+#include "SiteCounters.h"
+#include "OverheadEstimator.h"
 
 using namespace llvm;
 
 STATISTIC(NumReplicatedBB, "Number of replicated BBs");
+STATISTIC(NumSharedBB, "Number of replicas shared by several edges");
+
+static cl::opt<unsigned> ReplicaBudgetOpt("parifdup-replica-budget",
+      cl::desc("Instructions ParIFDup may replicate for one nested-if set; "
+         "bigger sets only check each branch, 0 for no limit"),
+      cl::init(1000));
+
+//a replica: its base block, its side, and what follows it on the edge
+typedef std::pair<std::pair<BasicBlock*, bool>, const void*> ReplicaKey;
+typedef std::map<ReplicaKey, BasicBlock*> ReplicaMap;
 
 namespace {
    class ParIFDuplica : public FunctionPass{ 
+      bool doInitialization(Module &M);
       bool runOnFunction(Function &F);
+      bool doFinalization(Module &M);
       void getAnalysisUsage(AnalysisUsage &AU) const;
 
       private:
-      void IFDupPar(std::list<ChildrenSet*>*);
-      void DupImplement(std::list<ChildrenSet*>*);
-      bool inEdgesMarked(ChildrenSet *, std::set<Edge*>&);
-      void IFDupforNode(ChildrenSet *);
+      void DupImplement(const std::list<ChildrenSet*>*);
       Instruction *findPosin(ChildrenSet *);
-      bool ImplementonEdge(Edge *,unsigned int,std::map<Value*,Value*>&,Instruction*);
+      bool ImplementonEdge(Edge *,unsigned int,std::map<Value*,Value*>&,Instruction*,ReplicaMap&);
+      unsigned int replicaCost(ChildrenSet*, Instruction*);
+      unsigned int replicaSize(BasicBlock*, Instruction*);
+      void checkBranchesOnly(ChildrenSet*);
       BasicBlock* RepBlock(BasicBlock*,std::map<Value*,Value*>&,Instruction*,BasicBlock *);
       void preRepBlock(BasicBlock*,std::map<Value*,Value*>&,Instruction*);
       bool noEffect(Instruction*);
@@ -39,8 +55,12 @@ namespace {
       BasicBlock * buildErrorBlock(Function&);
       void UpdateIncomeSource(BasicBlock *,BasicBlock *,BasicBlock*);
       int localnumreplicatedBB;
+      int localnumsharedBB;
+      int localnumoverbudget;
       bool canbecopied(Instruction*);
       BasicBlock *errorBlock;
+      SiteCounters sites; //the checking branches of the replicas
+      ShortcutDetectorPass *SCDetector; //owns the graph and the Reps
 
       public:
       static char ID;
@@ -67,18 +87,35 @@ void ParIFDuplica::getAnalysisUsage(AnalysisUsage &AU) const
    AU.addRequired<DominatorTree>();
    AU.addRequired<ShortcutDetectorPass>();
 }
+
+bool ParIFDuplica::doInitialization(Module &M) {
+   sites.beginModule(M, "ParIFDup");
+   return false;
+}
+
+bool ParIFDuplica::doFinalization(Module &M) {
+   sites.endModule();
+   return false;
+}
+
 bool ParIFDuplica::runOnFunction(Function &F) 
 {
    localnumreplicatedBB = 0;
+   localnumsharedBB = 0;
+   localnumoverbudget = 0;
    ShortcutDetectorPass& SCDetectorPass = getAnalysis<ShortcutDetectorPass>();
 
+   SCDetector = &SCDetectorPass;
+
    //get SCHeadNodeList
-   std::list<ChildrenSet*> HeadNodeList_ = SCDetectorPass.getHeadNodeList();
-   std::list<ChildrenSet*> *HeadNodeList = &HeadNodeList_;
+   const std::list<ChildrenSet*> *HeadNodeList = &SCDetectorPass.getHeadNodeList();
 
    if (!HeadNodeList->empty()) {
+      std::set<Instruction*> origInsts;
+      OverheadEstimator::recordOriginal(F, origInsts);
+
       //Partially duplicate IF
-      IFDupPar(HeadNodeList);
+      SCDetectorPass.propagateReps();
 
       //we can check what's going on on the edges
       SCDetectorPass.dumpShortcut(*HeadNodeList);
@@ -88,7 +125,10 @@ bool ParIFDuplica::runOnFunction(Function &F)
 #ifdef Jing_DEBUG
       //std::cerr << "errorBlock was set to be " << errorBlock->getName() <<"\n";
 #endif
+      sites.beginFunction(F);
       DupImplement(HeadNodeList);
+      sites.endFunction(F);
+      OverheadEstimator::tagAdded(F, origInsts);
 
 #ifdef Jing_DEBUG_EXIT
       //==========================test exit===========
@@ -106,7 +146,10 @@ bool ParIFDuplica::runOnFunction(Function &F)
       ///////=========end of test exit===========
 #endif
 
-      errs() << "local replicated BB: " << localnumreplicatedBB<<"\n\n";
+      sites.printStat(F);
+      errs() << "local replicated BB: " << localnumreplicatedBB<<"\n";
+      errs() << "local shared replicas: " << localnumsharedBB<<"\n";
+      errs() << "local sets over the replica budget: " << localnumoverbudget<<"\n\n";
    } 
 #ifdef Jing_DEBUG
    else { errs() << "no change was made to " << F.getName()<<"\n";}
@@ -158,134 +201,6 @@ BasicBlock *ParIFDuplica::buildErrorBlock(Function &F) {
    return EB;
 }
 
-void ParIFDuplica::IFDupPar(std::list<ChildrenSet*> *HeadNodeList){
-   std::list<ChildrenSet*>::iterator iter;
-   ChildrenSet *SCHead;
-   for (iter=HeadNodeList->begin(); iter!=HeadNodeList->end(); iter++) {
-      SCHead=*iter;
-      std::set<ChildrenSet*> *midnodeset = SCHead->getSCmidnodeset();
-      std::list<ChildrenSet*> WorkList;
-      std::set<Edge*> MarkedEdge;
-      WorkList.push_front(SCHead);
-#ifdef Jing_DEBUG
-      //DEBUG_outputsethead(SCHead, midnodeset);
-#endif
-      //use this variable to verify if every midnode was touched
-      unsigned int worked_number=0;
-
-      while (!WorkList.empty()) {
-         ChildrenSet *curNode = WorkList.front();
-         WorkList.pop_front();
-         worked_number++;
-
-#ifdef Jing_DEBUG
-         //std::cerr << "IFDupPar workon "<< curNode->getBB()->getName() <<"\n";
-#endif
-         //work on curNode
-         //This is the function that complicated duplication algorithm should modify
-         IFDupforNode(curNode);
-
-         //marked out0 and out1
-         MarkedEdge.insert(curNode->out0);
-         MarkedEdge.insert(curNode->out1);
-
-         //if target of out0 is within midnodeset &&
-         //all its incoming edges are marked, insert that node to WorkList
-         if (ChildrenSet *leftchild=curNode->leftchildrenset) {
-            if ((midnodeset->count(leftchild)>0) && (inEdgesMarked(leftchild,MarkedEdge)))
-               WorkList.push_back(leftchild);
-         }
-
-         //if target of out1 is within midnodeset &&
-         //all its incoming edges are marked, insert that node to WorkList
-         if (ChildrenSet *rightchild = curNode->rightchildrenset) {
-            if ((midnodeset->count(rightchild)>0) && (inEdgesMarked(rightchild,MarkedEdge))) {
-               WorkList.push_back(rightchild);
-            }
-         }
-
-      } //end of while
-
-      //check if every midnode has been touched
-      assert((worked_number==(midnodeset->size()+1)) && "Error:not all midnodes were touched!");
-   } //end of for
-}
-
-
-
-//check if node's incoming edges have an entry in MarkedEdge
-//This function is called when one incoming edge of this node was just accessed.
-bool ParIFDuplica::inEdgesMarked(ChildrenSet *node, std::set<Edge*>& MarkedEdge) {
-   //If this node has only one incoming edge, it means all its incoming edge has been accessed.
-   if (node->inEdges->size()<=1) return true;
-   //FIXME : xiehuc node->inEdges is Edge; while iter is Edge*
-   //which is correct?
-   std::list<Edge*>::iterator iter;
-
-   for (iter = node->inEdges->begin(); iter != node->inEdges->end(); iter++) {
-      Edge *inedge = *iter; 
-      if(MarkedEdge.count(inedge) == 0) 
-         return false;
-   } 
-   return true;
-}
-
-
-//this is partial propagation algorithm
-void ParIFDuplica::IFDupforNode(ChildrenSet *curNode) {
-
-   assert(curNode->out0->isnoRep() && "Error: the edge should not have Reps");
-   assert(curNode->out1->isnoRep() && "Error: the edge should not have Reps");
-
-   if (curNode->inEdges) {
-      ////////deal with incoming edges////////////////
-      //if there are more than one incoming edge
-      //fix their Reps. We will not propagate them. - may be optimized later - Jing
-      if (curNode->inEdges->size()>1) {
-         std::list<Edge*>::iterator iter,iterend;
-         for (iter=curNode->inEdges->begin(),iterend=curNode->inEdges->end(); iter!=iterend; iter++) 
-            (*iter)->fixAllReps();
-      }
-      //if there is only one incoming edge
-      //propagate its Reps
-      else {
-         Edge *inEdge = curNode->inEdges->front();
-
-         while (!inEdge->isPRepEmpty()) {
-            //thie popFirstRep() will pop out the first element
-            Rep *curRep = inEdge->popFirstRep();
-            //propagateTo() will check if curRep is allowed to be prpagated to that node
-            curNode->out0->propagateTo(curRep);
-            curNode->out1->propagateTo(curRep);
-         }
-      }
-   }
-   /////////////////////////////////////////////////
-   //replicate myself and propagate to outgoing edges
-   if (!curNode->haveSC) {
-      Rep *replica0 = new Rep(curNode->getBB(),true);
-      curNode->out0->insertRep(replica0);
-      Rep *replica1 = new Rep(curNode->getBB(),false);
-      curNode->out1->insertRep(replica1);
-   } else {
-      BasicBlock *leftB = curNode->out0->getTo();
-      BasicBlock *rightB = curNode->out1->getTo();
-
-      if (curNode->isleftSC) {
-         Rep *replica0 = new Rep(curNode->getBB(), true);
-         curNode->out0->insertRep(replica0);
-         Rep *replica1 = new Rep(curNode->getBB(),false,leftB);
-         curNode->out1->propagateTo(replica1);
-      } else {
-         Rep *replica0 = new Rep(curNode->getBB(),true, rightB);
-         curNode->out0->propagateTo(replica0);
-         Rep *replica1 = new Rep(curNode->getBB(), false);
-         curNode->out1->insertRep(replica1);
-      }
-   }
-}
-
-
 //for debug purpose
 void ParIFDuplica::DEBUG_outputsethead(ChildrenSet *SCHead, std::set<ChildrenSet*> *midnodeset){
    errs() << "===output sethead for " << SCHead->getBB()->getName() <<"===\n";
@@ -300,7 +215,7 @@ void ParIFDuplica::DEBUG_outputsethead(ChildrenSet *SCHead, std::set<ChildrenSet
 
 ///////////////////////////////////////////////
 //DupImplement.h is to implement this method
-//void ParIFDuplica::DupImplement(std::list<ChildrenSet*> *HeadNodeList){
+//void ParIFDuplica::DupImplement(const std::list<ChildrenSet*> *HeadNodeList){
 ///////////////////////////////////////////////
 #include "DupImplement.h"
 
@@ -0,0 +1,132 @@
+////////////////////////////////////////
+//PrivateSlot.cpp                     //
+////////////////////////////////////////
+//Non-escaping allocas for -O0 input  //
+////////////////////////////////////////
+
+#include "PrivateSlot.h"
+#include "CallClassify.h"
+#include <llvm/Transforms/Utils/PromoteMemToReg.h>
+
+#include <vector>
+#include <list>
+
+using namespace llvm;
+
+////////////////////////////////////
+//promoteAllocas()                //
+//mem2reg on the entry block      //
+////////////////////////////////////
+int PrivateSlots::promoteAllocas(Function &F, DominatorTree &DT) {
+   std::vector<AllocaInst*> allocas;
+   BasicBlock &entry = F.getEntryBlock();
+   for (BasicBlock::iterator Ii = entry.begin(), Ie = entry.end(); Ii != Ie; ++Ii)
+      if (AllocaInst *AI = dyn_cast<AllocaInst>(Ii))
+         if (isAllocaPromotable(AI))
+            allocas.push_back(AI);
+
+   if (!allocas.empty())
+      PromoteMemToReg(allocas, DT);
+   return allocas.size();
+}
+
+////////////////////////////////////
+//collect()                       //
+////////////////////////////////////
+void PrivateSlots::collect(Function &F) {
+   allocaSet.clear();
+   addrSet.clear();
+
+   BasicBlock &entry = F.getEntryBlock();
+   for (BasicBlock::iterator Ii = entry.begin(), Ie = entry.end(); Ii != Ie; ++Ii) {
+      AllocaInst *AI = dyn_cast<AllocaInst>(Ii);
+      if (!AI || !AI->isStaticAlloca()) continue;
+
+      std::set<Value*> derived;
+      if (noEscape(AI, derived)) {
+         allocaSet.insert(AI);
+         addrSet.insert(derived.begin(), derived.end());
+      }
+   }
+}
+
+////////////////////////////////////
+//noEscape()                      //
+//derived collects AI and every   //
+//pointer computed from it        //
+////////////////////////////////////
+bool PrivateSlots::noEscape(AllocaInst *AI, std::set<Value*> &derived) {
+   std::list<Value*> worklist;
+   worklist.push_back(AI);
+   derived.insert(AI);
+
+   while (!worklist.empty()) {
+      Value *ptr = worklist.front();
+      worklist.pop_front();
+
+      for (Value::use_iterator UI = ptr->use_begin(), UE = ptr->use_end(); UI != UE; ++UI) {
+         User *U = *UI;
+         if (LoadInst *LI = dyn_cast<LoadInst>(U)) {
+            if (LI->isVolatile()) return false;
+         } else if (StoreInst *SI = dyn_cast<StoreInst>(U)) {
+            //storing the address itself lets it escape
+            if (SI->isVolatile() || SI->getValueOperand() == ptr) return false;
+         } else if (GetElementPtrInst *GEP = dyn_cast<GetElementPtrInst>(U)) {
+            if (GEP->getPointerOperand() != ptr) return false;
+            if (derived.insert(GEP).second) worklist.push_back(GEP);
+         } else if (BitCastInst *BC = dyn_cast<BitCastInst>(U)) {
+            if (derived.insert(BC).second) worklist.push_back(BC);
+         } else if (CallInst *CI = dyn_cast<CallInst>(U)) {
+            if (CallClassify::isIgnoredCall(CI)) continue;
+            if (!isMemIntrinsicOnSlot(CI, ptr)) return false;
+         } else {
+            return false;
+         }
+      }
+   }
+   return true;
+}
+
+////////////////////////////////////
+//isMemIntrinsicOnSlot()          //
+//memset/memcpy/memmove writing   //
+//ptr, reading nothing private    //
+////////////////////////////////////
+bool PrivateSlots::isMemIntrinsicOnSlot(CallInst *CI, Value *ptr) {
+   Function *callee = CI->getCalledFunction();
+   if (!callee || CI->getNumArgOperands() < 2) return false;
+   if (CI->getArgOperand(0) != ptr) return false;
+   //a volatile memory intrinsic must stay a synch point
+   Value *isVolatile = CI->getArgOperand(CI->getNumArgOperands() - 1);
+   if (!isa<ConstantInt>(isVolatile) || !cast<ConstantInt>(isVolatile)->isZero())
+      return false;
+
+   StringRef name = callee->getName();
+   if (name.startswith("llvm.memset.")) return true;
+   if (name.startswith("llvm.memcpy.") || name.startswith("llvm.memmove."))
+      return (CI->getArgOperand(1) != ptr);
+   return false;
+}
+
+bool PrivateSlots::isPrivateAlloca(Instruction *I) {
+   return (allocaSet.count(I) > 0);
+}
+
+bool PrivateSlots::isPrivateAddr(Value *ptr) {
+   return (addrSet.count(ptr) > 0);
+}
+
+bool PrivateSlots::isPrivateAccess(Instruction *I) {
+   if (LoadInst *LI = dyn_cast<LoadInst>(I))
+      return isPrivateAddr(LI->getPointerOperand());
+   if (StoreInst *SI = dyn_cast<StoreInst>(I))
+      return isPrivateAddr(SI->getPointerOperand());
+   if (CallInst *CI = dyn_cast<CallInst>(I)) {
+      if (CI->getNumArgOperands() < 1) return false;
+      Value *dest = CI->getArgOperand(0);
+      return (isPrivateAddr(dest) && isMemIntrinsicOnSlot(CI, dest));
+   }
+   return false;
+}
+
+// vim: ts=3 sts=3 sw=3 et
@@ -0,0 +1,370 @@
+////////////////////////////////////////
+//ProtectPolicy.cpp                   //
+////////////////////////////////////////
+//Command line defaults and per       //
+//function overrides of the tiers     //
+////////////////////////////////////////
+
+#include "ProtectPolicy.h"
+#include "BlockProfile.h"
+#include "ShadowCall.h"
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/OwningPtr.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/system_error.h>
+
+#include <algorithm>
+#include <cstring>
+
+using namespace llvm;
+
+static cl::opt<enum STORELEVEL> StoreLevelOpt("ifdup-store-level",
+      cl::desc("How stores are checked"),
+      cl::init(STORE_L1),
+      cl::values(
+         clEnumValN(STORE_L1, "l1", "stores are synch points"),
+         clEnumValN(STORE_L3, "l3", "only calls are synch points"),
+         clEnumValEnd));
+
+static cl::opt<bool> RegSafeOpt("ifdup-reg-safe",
+      cl::desc("Do not check loaded or already checked values again"),
+      cl::init(true));
+
+static cl::opt<bool> CheckBrOperandsOpt("ifdup-check-br-operands",
+      cl::desc("Check the operands of branch conditions"),
+      cl::init(false));
+
+static cl::opt<bool> PrivateSlotsOpt("ifdup-private-slots",
+      cl::desc("Promote allocas and duplicate the non-escaping ones"),
+      cl::init(true));
+
+static cl::opt<bool> LoopSCEVOpt("ifdup-loop-scev",
+      cl::desc("Move loop checks to preheaders and exits"),
+      cl::init(true));
+
+static cl::opt<bool> PlaceChecksOpt("ifdup-place-checks",
+      cl::desc("Move store checks to the coldest points that still cover them"),
+      cl::init(false));
+
+static cl::opt<enum SWITCHCHECK> SwitchCheckOpt("ifdup-switch",
+      cl::desc("How switch instructions are checked"),
+      cl::init(SWITCH_SELECTOR),
+      cl::values(
+         clEnumValN(SWITCH_OFF, "off", "not checked"),
+         clEnumValN(SWITCH_SELECTOR, "selector", "the selector, before the switch"),
+         clEnumValN(SWITCH_TARGET, "target", "the selector again, at every target"),
+         clEnumValEnd));
+
+static cl::opt<enum STORECHECK> StoreCheckOpt("ifdup-store-check",
+      cl::desc("How checked stores are checked"),
+      cl::init(STORECHECK_COMPARE),
+      cl::values(
+         clEnumValN(STORECHECK_COMPARE, "compare", "address and value, before the store"),
+         clEnumValN(STORECHECK_RELOAD, "reload", "the stored word, read back after the store"),
+         clEnumValEnd));
+
+static cl::opt<bool> SampleCheckOpt("ifdup-sample",
+      cl::desc("Check loops every -ifdup-sample-rate iterations only"),
+      cl::init(false));
+
+static cl::opt<int> SampleRateOpt("ifdup-sample-rate",
+      cl::desc("Iterations between two sampled checks"),
+      cl::init(16));
+
+static cl::opt<bool> AddrCtlOpt("ifdup-addr-ctl",
+      cl::desc("Protect only the values reaching addresses and branches"),
+      cl::init(false));
+
+static cl::opt<bool> StoreSigOpt("ifdup-store-sig",
+      cl::desc("Check the stores of store-dense loops at the loop exits"),
+      cl::init(false));
+
+static cl::opt<float> StoreSigDensityOpt("ifdup-store-sig-density",
+      cl::desc("Stores per block that make a loop store-dense"),
+      cl::init(1.0f));
+
+static cl::opt<unsigned> BudgetOpt("ifdup-budget",
+      cl::desc("Maximum estimated slowdown in percent, 0 for full protection"),
+      cl::init(0));
+
+static cl::opt<std::string> PolicyFileOpt("ifdup-policy-file",
+      cl::desc("File of '<regex> <tier>' lines selecting the tier of functions"),
+      cl::value_desc("filename"), cl::init(""));
+
+static cl::opt<std::string> OnlyOpt("ifdup-only",
+      cl::desc("Protect only the functions whose name matches this regex"),
+      cl::value_desc("regex"), cl::init(""));
+
+static cl::opt<std::string> SkipOpt("ifdup-skip",
+      cl::desc("Do not protect the functions whose name matches this regex"),
+      cl::value_desc("regex"), cl::init(""));
+
+static cl::opt<bool> ProfileTiersOpt("ifdup-profile-tiers",
+      cl::desc("Pick the tier of each function from its profile counts"),
+      cl::init(false));
+
+static cl::opt<unsigned> HotFractionOpt("ifdup-hot-fraction",
+      cl::desc("Percent of all counts covered by the hot functions"),
+      cl::init(90));
+
+static cl::opt<std::string> HotTierOpt("ifdup-hot-tier",
+      cl::desc("Tier of hot functions: deferred and coalesced checks"),
+      cl::init("l3,scev,sample"));
+
+static cl::opt<std::string> ColdTierOpt("ifdup-cold-tier",
+      cl::desc("Tier of functions the profile never saw run"),
+      cl::init("l1,brops"));
+
+ProtectPolicy::ProtectPolicy() {
+   enabled = true;
+   storeLevel = StoreLevelOpt;
+   regSafe = RegSafeOpt;
+   checkBrOperands = CheckBrOperandsOpt;
+   privateSlots = PrivateSlotsOpt;
+   loopSCEV = LoopSCEVOpt;
+   placeChecks = PlaceChecksOpt;
+   sampleCheck = SampleCheckOpt;
+   addrCtl = AddrCtlOpt;
+   storeSig = StoreSigOpt;
+   storeSigDensity = StoreSigDensityOpt;
+   switchCheck = SwitchCheckOpt;
+   storeCheck = StoreCheckOpt;
+   sampleRate = SampleRateOpt;
+   budget = BudgetOpt;
+}
+
+////////////////////////////////////
+//forFunction()                   //
+////////////////////////////////////
+ProtectPolicy ProtectPolicy::forFunction(Function &F, StringRef tier) {
+   ProtectPolicy policy;
+   AttributeSet attrs = F.getAttributes();
+
+   policy.applyList(tier, F);
+   Attribute tiers = attrs.getAttribute(AttributeSet::FunctionIndex, "ifdup-policy");
+   if (tiers.isStringAttribute())
+      policy.applyList(tiers.getValueAsString(), F);
+
+   Attribute rate = attrs.getAttribute(AttributeSet::FunctionIndex, "ifdup-sample-rate");
+   if (rate.isStringAttribute()) {
+      int r;
+      if (!rate.getValueAsString().getAsInteger(10, r)) policy.sampleRate = r;
+   }
+   return policy;
+}
+
+void ProtectPolicy::applyList(StringRef tier, Function &F) {
+   SmallVector<StringRef, 8> tokens;
+   tier.split(tokens, ",");
+   for (unsigned int i = 0; i < tokens.size(); i++) {
+      if (!apply(tokens[i].trim()))
+         errs() << "IFDup: unknown policy '" << tokens[i] << "' (" << F.getName() << ")\n";
+   }
+}
+
+bool ProtectPolicy::apply(StringRef token) {
+   if (token.empty()) return true;
+   if (token == "on") enabled = true;
+   else if (token == "off") enabled = false;
+   else if (token == "l1") storeLevel = STORE_L1;
+   else if (token == "l3") storeLevel = STORE_L3;
+   else if (token == "regsafe") regSafe = true;
+   else if (token == "noregsafe") regSafe = false;
+   else if (token == "brops") checkBrOperands = true;
+   else if (token == "nobrops") checkBrOperands = false;
+   else if (token == "slots") privateSlots = true;
+   else if (token == "noslots") privateSlots = false;
+   else if (token == "scev") loopSCEV = true;
+   else if (token == "noscev") loopSCEV = false;
+   else if (token == "place") placeChecks = true;
+   else if (token == "noplace") placeChecks = false;
+   else if (token == "sample") sampleCheck = true;
+   else if (token == "nosample") sampleCheck = false;
+   else if (token == "addrctl") addrCtl = true;
+   else if (token == "noaddrctl") addrCtl = false;
+   else if (token == "stsig") storeSig = true;
+   else if (token == "nostsig") storeSig = false;
+   else if (token.startswith("budget=")) {
+      if (token.substr(7).getAsInteger(10, budget)) return false;
+   }
+   else if (token == "switch=off") switchCheck = SWITCH_OFF;
+   else if (token == "switch=selector") switchCheck = SWITCH_SELECTOR;
+   else if (token == "switch=target") switchCheck = SWITCH_TARGET;
+   else if (token == "stcheck=compare") storeCheck = STORECHECK_COMPARE;
+   else if (token == "stcheck=reload") storeCheck = STORECHECK_RELOAD;
+   else return false;
+   return true;
+}
+
+std::string ProtectPolicy::str() {
+   if (!enabled) return "off";
+   std::string s = (storeLevel == STORE_L1) ? "l1" : "l3";
+   s += regSafe ? ",regsafe" : ",noregsafe";
+   s += checkBrOperands ? ",brops" : ",nobrops";
+   s += privateSlots ? ",slots" : ",noslots";
+   s += loopSCEV ? ",scev" : ",noscev";
+   s += placeChecks ? ",place" : ",noplace";
+   s += sampleCheck ? ",sample" : ",nosample";
+   s += addrCtl ? ",addrctl" : ",noaddrctl";
+   s += storeSig ? ",stsig" : ",nostsig";
+   if (switchCheck == SWITCH_OFF) s += ",switch=off";
+   else if (switchCheck == SWITCH_SELECTOR) s += ",switch=selector";
+   else s += ",switch=target";
+   s += (storeCheck == STORECHECK_RELOAD) ? ",stcheck=reload" : ",stcheck=compare";
+   if (budget > 0) s += ",budget=" + utostr(budget);
+   return s;
+}
+
+//a shadow clone is chosen by the name of the function it replaces
+static StringRef sourceName(Function *F) {
+   StringRef name = F->getName();
+   if (ShadowCall::numOrigParams(F) >= 0 && name.endswith(".shadow"))
+      return name.drop_back(strlen(".shadow"));
+   return name;
+}
+
+////////////////////////////////////
+//PolicySelector::build()         //
+////////////////////////////////////
+void PolicySelector::build(Module &M) {
+   tiers.clear();
+   readAnnotations(M);
+
+   if (!PolicyFileOpt.empty()) readPolicyFile(PolicyFileOpt);
+   Regex only(OnlyOpt), skip(SkipOpt);
+   std::string err;
+   if (!OnlyOpt.empty() && !only.isValid(err))
+      errs() << "IFDup: bad -ifdup-only regex: " << err << "\n";
+   if (!SkipOpt.empty() && !skip.isValid(err))
+      errs() << "IFDup: bad -ifdup-skip regex: " << err << "\n";
+
+   for (Module::iterator Fi = M.begin(), Fe = M.end(); Fi != Fe; ++Fi) {
+      Function *F = Fi;
+      if (F->isDeclaration() || tiers.count(F)) continue;
+      std::string tier;
+      StringRef name = sourceName(F);
+      if (matchRules(name, tier)) tiers[F] = tier;
+      else if (!SkipOpt.empty() && skip.match(name)) tiers[F] = "off";
+      else if (!OnlyOpt.empty() && !only.match(name)) tiers[F] = "off";
+   }
+   clearRules();
+   if (ProfileTiersOpt) applyProfileTiers(M);
+}
+
+////////////////////////////////////
+//applyProfileTiers()             //
+////////////////////////////////////
+//clang adds 1 to every edge count, so a two-way branch that never ran
+//weighs 2
+#define COLD_COUNT 2
+
+static bool hotterFirst(const std::pair<uint64_t, Function*> &a, const std::pair<uint64_t, Function*> &b) {
+   return a.first > b.first;
+}
+
+void PolicySelector::applyProfileTiers(Module &M) {
+   std::vector<std::pair<uint64_t, Function*> > counts;
+   uint64_t total = 0;
+   for (Module::iterator Fi = M.begin(), Fe = M.end(); Fi != Fe; ++Fi) {
+      Function *F = Fi;
+      //straight-line functions carry no weights: nothing is known
+      if (F->isDeclaration() || !BlockProfile::hasProfile(*F)) continue;
+      uint64_t hot = BlockProfile::functionHotness(*F);
+      counts.push_back(std::make_pair(hot, F));
+      total += hot;
+   }
+   //no profile at all: nothing was measured, keep the defaults
+   if (total == 0) return;
+
+   std::stable_sort(counts.begin(), counts.end(), hotterFirst);
+   uint64_t covered = 0;
+   for (unsigned int i = 0; i < counts.size(); i++) {
+      Function *F = counts[i].second;
+      bool hot = (double)covered < (double)total * HotFractionOpt / 100.0;
+      covered += counts[i].first;
+      //explicit choices win
+      if (tiers.count(F)) continue;
+      if (counts[i].first <= COLD_COUNT) tiers[F] = ColdTierOpt;
+      else if (hot) tiers[F] = HotTierOpt;
+   }
+}
+
+StringRef PolicySelector::lookup(Function *F) {
+   std::map<const Function*, std::string>::iterator i = tiers.find(F);
+   if (i == tiers.end()) return "";
+   return (*i).second;
+}
+
+//clang lowers annotate("...") on functions to llvm.global.annotations,
+//an array of {i8* function, i8* string, i8* file, i32 line}.
+void PolicySelector::readAnnotations(Module &M) {
+   GlobalVariable *GA = M.getGlobalVariable("llvm.global.annotations");
+   if (!GA || !GA->hasInitializer()) return;
+   ConstantArray *CA = dyn_cast<ConstantArray>(GA->getInitializer());
+   if (!CA) return;
+
+   for (unsigned int i = 0; i < CA->getNumOperands(); i++) {
+      ConstantStruct *CS = dyn_cast<ConstantStruct>(CA->getOperand(i));
+      if (!CS || CS->getNumOperands() < 2) continue;
+      Function *F = dyn_cast<Function>(CS->getOperand(0)->stripPointerCasts());
+      GlobalVariable *GS = dyn_cast<GlobalVariable>(CS->getOperand(1)->stripPointerCasts());
+      if (!F || !GS || !GS->hasInitializer()) continue;
+      ConstantDataArray *CD = dyn_cast<ConstantDataArray>(GS->getInitializer());
+      if (!CD || !CD->isCString()) continue;
+
+      StringRef note = CD->getAsCString();
+      if (!note.startswith("ifdup=")) continue;
+      std::string &tier = tiers[F];
+      if (!tier.empty()) tier += ",";
+      tier += note.substr(6);
+   }
+}
+
+void PolicySelector::readPolicyFile(StringRef path) {
+   OwningPtr<MemoryBuffer> buf;
+   if (error_code ec = MemoryBuffer::getFile(path, buf)) {
+      errs() << "IFDup: cannot read " << path << ": " << ec.message() << "\n";
+      return;
+   }
+
+   SmallVector<StringRef, 32> lines;
+   buf->getBuffer().split(lines, "\n");
+   for (unsigned int l = 0; l < lines.size(); l++) {
+      StringRef line = lines[l].split('#').first.trim();
+      if (line.empty()) continue;
+      std::pair<StringRef, StringRef> fields = line.split(' ');
+      StringRef tier = fields.second.trim();
+      if (tier.empty()) tier = "on";
+
+      Regex *re = new Regex(fields.first);
+      std::string err;
+      if (!re->isValid(err)) {
+         errs() << "IFDup: " << path << ":" << l+1 << ": " << err << "\n";
+         delete re;
+         continue;
+      }
+      rules.push_back(std::make_pair(re, tier.str()));
+   }
+}
+
+bool PolicySelector::matchRules(StringRef name, std::string &tier) {
+   for (unsigned int i = 0; i < rules.size(); i++) {
+      if (rules[i].first->match(name)) {
+         tier = rules[i].second;
+         return true;
+      }
+   }
+   return false;
+}
+
+void PolicySelector::clearRules() {
+   for (unsigned int i = 0; i < rules.size(); i++) delete rules[i].first;
+   rules.clear();
+}
+
+// vim: ts=3 sts=3 sw=3 et
@@ -7,27 +7,24 @@
 //Optimization will be done on other  //
 //objects.                            //
 ////////////////////////////////////////
-//Option: L1, L3(L2)
-//        Check or do not check br operands.
+//Option: L1, L3(L2) and br operands are
+//        chosen by ProtectPolicy.
 /////////////////////////////////////////
 
 #include "RedundOPT.h"
+#include "CallClassify.h"
+#include "ShadowCall.h"
+#include "CheckSummary.h"
+#include "PrivateSlot.h"
+#include "BlockProfile.h"
 
 #include <llvm/ADT/SmallPtrSet.h>
 #include <llvm/Analysis/PostDominators.h>
+#include <llvm/Analysis/ScalarEvolution.h>
+#include <llvm/Analysis/ScalarEvolutionExpressions.h>
 
-#define L1_CHECK 1
-//#define L3_CHECK 1
-
-//#define CHECK_BRANCH_OPERANDS 1
 #define DECOMPOSE_ADDR 1
 
-#ifdef L1_CHECK
-#undef L3_CHECK
-#else
-#define L3_CHECK 1
-#endif
-
 #define R_DEBUG 1
 
 
@@ -76,6 +73,7 @@ CheckCode::dump() {
 CheckLoad::CheckLoad(Instruction *I)
    : CheckCode(I) {
       computeFinal = false;
+      family = false;
       finalElems.clear();
    }
 
@@ -116,7 +114,7 @@ CheckLoad::ComputeFinal() {
       //addrP not in CheckElem. ok. do not check anything
       if (CheckElem.find(addrP) != CheckElem.end()) {
          //see what are other options
-         if (CheckElem.size()-1 >1) {
+         if (CheckElem.size()-1 >1 && !family) {
             //after decompose, we still need to check at least 2.
             //then we just check the original addrP
             finalElems.insert(addrP);
@@ -153,6 +151,7 @@ CheckLoad::dump() {
 CheckStore::CheckStore(Instruction *I)
    : CheckCode(I) {
       computeFinal = false;
+      family = false;
       finalElems.clear();
    }
 
@@ -203,7 +202,7 @@ CheckStore::ComputeFinal() {
          //addrP not in CheckElem. ok. do not check anything
          if (CheckElem.find(addrP) != CheckElem.end()) {
             //see what are other options
-            if ((CheckElem.size()-1-valuecheck) >1) {
+            if ((CheckElem.size()-1-valuecheck) >1 && !family) {
                //after decompose, we still need to check at least 2.
                //then we just check the original addrP
                finalElems.insert(addrP);
@@ -311,12 +310,10 @@ CheckCodeMap::newCheckCode(Instruction *I) {
    else if (isa<BranchInst>(I))
       checkcode = new CheckBranch(I);
    else if (isa<StoreInst>(I))  {
-#ifdef L3_CHECK
-      checkcode = new CheckStore(I);  //- L3
-#endif
-#ifdef L1_CHECK
-      checkcode = new CheckCode(I);   //L1
-#endif
+      if (storeLevel == STORE_L3)
+         checkcode = new CheckStore(I);  //- L3
+      else
+         checkcode = new CheckCode(I);   //L1
    }
    else if (isa<CallInst>(I) || isa <ReturnInst>(I))
       checkcode = new CheckCode(I);
@@ -532,6 +529,16 @@ RedundAnalysis::RedundAnalysis()
    localnumtotalothercheck=0;
 
    reg_safe = false;
+   MyCalleeSummary = NULL;
+   localnumsummaryskip = 0;
+   MyPrivateSlots = NULL;
+   localnumaddrfamily = 0;
+   profiled = false;
+   localdynorigcheck = 0;
+   localdynfinalcheck = 0;
+   MyDT = NULL;
+   MyBFI = NULL;
+   MyBPI = NULL;
 
    BBtotalN = 0;
    BBIDmap.clear();
@@ -565,7 +572,14 @@ RedundAnalysis::SetUpTable(CheckCodeMap *checkCodeMap, ValueCheckedAtMap *valueC
 
    ToUpdateList.clear();
 
-   ScanAllCheckCodes(F);
+   //the store level is fixed for the whole scan
+   if (MyPolicy.storeLevel == STORE_L3)
+      ScanAllCheckCodes<StoreL3>(F);
+   else
+      ScanAllCheckCodes<StoreL1>(F);
+#ifdef DECOMPOSE_ADDR
+   markAddressFamilies();
+#endif
 #ifdef R_DEBUG
    errs() << "\n\n==== Function "<< F.getName() <<" ====\n";
    errs() << "After ScanAllCheckCodes() inside RedundAnalysis--\n";
@@ -605,6 +619,7 @@ RedundAnalysis::addtoUpdateList(Value *v) {
 bool
 RedundAnalysis::canPropErrorInst(Instruction *I) {
    if (isCheckPoint(I) || isa<AllocaInst>(I) || isa<VAArgInst>(I) ) return false;
+   if (CallClassify::isIgnoredCall(I)) return false;
    if (CallInst* CI = dyn_cast<CallInst>(I))
       if( CI->getCalledValue()->getName() == "free") 
          return false;
@@ -615,14 +630,18 @@ RedundAnalysis::canPropErrorInst(Instruction *I) {
 
 bool 
 RedundAnalysis::isCheckPoint(Instruction *Ins) {
-   if (isa<CallInst>(Ins) || isa<TerminatorInst>(Ins) || isa<StoreInst>(Ins) ||isa<LoadInst>(Ins) ) return true;
+   //calls to shadow clones take the duplicates along: nothing to check
+   if (CallClassify::isShadowCall(Ins)) return false;
+   //accesses to private slots are duplicated, not checked
+   if (isPrivateAccess(Ins)) return false;
+   if (CallClassify::isSynchCall(Ins) || isa<TerminatorInst>(Ins) || isa<StoreInst>(Ins) ||isa<LoadInst>(Ins) ) return true;
    return false;
 }
 
 
 //This function scans all BBs. But it will reorder some intructions inside BB,
 //to make condition next to branch.
-   void 
+template <class Level> void 
 RedundAnalysis::ScanAllCheckCodes(Function &F) 
 {
 
@@ -635,8 +654,8 @@ RedundAnalysis::ScanAllCheckCodes(Function &F)
       while (&*I!=LastCond) {
          nextI = I;
          ++nextI;
-         if (isCheckPoint(I)) { SetupTablewithCheckPoint(I, BB);}
-         if (isSynchPoint(I)) isSynchpoint = true;
+         if (isCheckPoint(I)) { SetupTablewithCheckPoint<Level>(I, BB);}
+         if (isSynchPointAt<Level>(I)) isSynchpoint = true;
          I = nextI;
       }
 
@@ -644,12 +663,12 @@ RedundAnalysis::ScanAllCheckCodes(Function &F)
       //do with branch
       //FIXME : xiehuc I couldn't be null
       //if (I!=NULL) {
-#ifdef CHECK_BRANCH_OPERANDS
-      if (BranchInst *BI = hasConditionalBr(BB)) {
-         //Check branch operands
-         SetupTablewithBranch(LastCond, BI, BB);
+      if (MyPolicy.checkBrOperands) {
+         if (BranchInst *BI = hasConditionalBr(BB)) {
+            //Check branch operands
+            SetupTablewithBranch(LastCond, BI, BB);
+         }
       }
-#endif
       if (ReturnInst *RI = dyn_cast<ReturnInst>(LastCond)) {
          SetupTablewithReturn(RI, BB);
       }
@@ -666,7 +685,7 @@ RedundAnalysis::ScanAllCheckCodes(Function &F)
 /////////////////////////////////////////////////////////////////////
 //////    Set up Table with check points                           //
 /////////////////////////////////////////////////////////////////////
-void 
+template <class Level> void 
 RedundAnalysis::SetupTablewithCheckPoint(Instruction*I, BasicBlock*BB) {
 #ifdef R_DEBUG
    errs() << "SetupCP(";
@@ -679,12 +698,7 @@ RedundAnalysis::SetupTablewithCheckPoint(Instruction*I, BasicBlock*BB) {
    if (LoadInst *LoadI = dyn_cast<LoadInst>(I)) {
       SetupTablewithLoad(LoadI, BB);
    } else if (StoreInst *StoreI = dyn_cast<StoreInst>(I)) {
-#ifdef L3_CHECK
-      SetupTablewithStore(StoreI, BB,  CHECKEDAT); //L3 CHECKEDAT
-#endif
-#ifdef L1_CHECK
-      SetupTablewithStore(StoreI, BB, PROPORFINAL); //L1 PROPORFINAL
-#endif
+      SetupTablewithStore<Level>(StoreI, BB);
    } else if (CallInst *CallI = dyn_cast<CallInst>(I)) {
       SetupTablewithCall(CallI, BB, PROPORFINAL);
    } else {
@@ -749,6 +763,9 @@ RedundAnalysis::SetupTablewithReturn(ReturnInst *returnI, BasicBlock* BB){
    Value *retV = returnI->getReturnValue();
    LLVMContext& C = BB->getContext();
    if (retV && (retV->getType() != Type::getVoidTy(C))) {
+      //a shadow clone returns {orig, dup}: the caller checks it
+      if (Instruction *retI = dyn_cast<Instruction>(retV))
+         if (ShadowCall::isShadowInst(retI)) return;
       if (duplicable(retV)) {
          CheckCode *checkcodeEntry = MycheckCodeMap->newCheckCode(returnI);
          assert(checkcodeEntry && "Must not be null");
@@ -784,8 +801,10 @@ RedundAnalysis::SetupTablewithLoad (LoadInst *loadI, BasicBlock *BB) {
    }
 }
 
-void 
-RedundAnalysis::SetupTablewithStore(StoreInst *storeI, BasicBlock *BB, enum CHECKTYPE checktype) {
+//L3 CHECKEDAT, L1 PROPORFINAL
+template <class Level> void 
+RedundAnalysis::SetupTablewithStore(StoreInst *storeI, BasicBlock *BB) {
+   enum CHECKTYPE checktype = Level::storeCheckedAt ? CHECKEDAT : PROPORFINAL;
    Value *addrP = storeI->getPointerOperand();
    Value *StoreValue = storeI->getOperand(0);
 
@@ -809,18 +828,14 @@ RedundAnalysis::SetupTablewithStore(StoreInst *storeI, BasicBlock *BB, enum CHEC
 
          //Jing - ugly ----!!!!! Do not decompose address 
          //if store is synchpoint
-#ifdef L1_CHECK
-         localnumtotalstcheck++; //L1
-#endif
-
-#ifdef L3_CHECK
-         // L3
+         if (Level::decomposeStore) {
 #ifdef DECOMPOSE_ADDR
-         DecomposeAddress(deValues,addrP);  //L3
-#endif
-         if (deValues.empty()) localnumtotalstcheck++; //L3
-         else localnumtotalstcheck+=deValues.size(); //L3
+            DecomposeAddress(deValues,addrP);  //L3
 #endif
+            if (deValues.empty()) localnumtotalstcheck++; //L3
+            else localnumtotalstcheck+=deValues.size(); //L3
+         } else
+            localnumtotalstcheck++; //L1
 
          //insert decomposedValues to tables
          if (!deValues.empty()) {
@@ -835,13 +850,19 @@ RedundAnalysis::SetupTablewithStore(StoreInst *storeI, BasicBlock *BB, enum CHEC
 
 void 
 RedundAnalysis::SetupTablewithCall(CallInst *callI, BasicBlock *BB, enum CHECKTYPE checktype) {
-   //parameter starts from 1 to NumOperands-1
-   int numParam = callI->getNumOperands() - 1;
+   //arguments are operands 0 to NumArgOperands-1, the callee comes last
+   unsigned int numParam = callI->getNumArgOperands();
    CheckCode *checkcodeEntry = MycheckCodeMap->newCheckCode(callI);
    assert(checkcodeEntry && "Must not be null");
 
-   for (int i = 1; i <= numParam; i++ ) {
-      Value *param = callI->getOperand(i);
+   for (unsigned int i = 0; i < numParam; i++ ) {
+      Value *param = callI->getArgOperand(i);
+
+      //the callee never observes this argument
+      if (MyCalleeSummary && MyCalleeSummary->canSkipArgCheck(callI, i)) {
+         if (duplicable(param)) localnumsummaryskip++;
+         continue;
+      }
 
       if ( duplicable(param)) {
          SetUpTablewithOP(checkcodeEntry, param, callI, checktype);
@@ -862,13 +883,43 @@ RedundAnalysis::SetUpTablewithOP(CheckCode *checkcodeEntry, Value *v, Instructio
    addtoUpdateList(v);
 }
 
+////////////////////////////////////
+//countProfiledChecks()           //
+////////////////////////////////////
+//Checks each check point would execute without and with the redundancy
+//removal, from the measured block counts. Checks moved to loop exits are
+//counted at the exiting branch.
+void RedundAnalysis::countProfiledChecks(BlockProfile *profile) {
+   profiled = true;
+   std::map<Instruction*,CheckCode*>&codes = MycheckCodeMap->getMap();
+   for (std::map<Instruction*,CheckCode*>::iterator i=codes.begin(), e=codes.end(); i!=e; i++) {
+      uint64_t count = profile->count((*i).first->getParent());
+      CheckCode *checkcode = (*i).second;
+      unsigned int final = checkcode->getFinalNumElem();
+      if (isa<BranchInst>((*i).first)) final += ((CheckBranch*)checkcode)->PropCheckSize();
+      localdynorigcheck += count * checkcode->getOrigNumElem();
+      localdynfinalcheck += count * final;
+   }
+}
+
 void RedundAnalysis::printStatforTotal(Function &F){
    errs() << "LOCAL_REDUND_CHECK "<< localnumtotalldcheck <<" localnumtotalldcheck ("<<F.getName()<<")\n";
    errs() << "LOCAL_REDUND_CHECK "<< localnumtotalstcheck <<" localnumtotalstcheck ("<<F.getName()<<")\n";
    errs() << "LOCAL_REDUND_CHECK "<< localnumtotalbrcheck <<" localnumtotalbrcheck ("<<F.getName()<<")\n";
    errs() << "LOCAL_REDUND_CHECK "<< localnumtotalothercheck <<" localnumtotalothercheck ("<<F.getName()<<")\n";
+   errs() << "LOCAL_REDUND_CHECK "<< localnumsummaryskip <<" localnumsummaryskip ("<<F.getName()<<")\n";
+   errs() << "LOCAL_REDUND_CHECK "<< localnumaddrfamily <<" localnumaddrfamily ("<<F.getName()<<")\n";
+   if (profiled) {
+      errs() << "LOCAL_REDUND_CHECK "<< localdynorigcheck <<" localdynorigcheck ("<<F.getName()<<")\n";
+      errs() << "LOCAL_REDUND_CHECK "<< localdynfinalcheck <<" localdynfinalcheck ("<<F.getName()<<")\n";
+   }
 
    //clear counters
+   profiled = false;
+   localdynorigcheck = 0;
+   localdynfinalcheck = 0;
+   localnumsummaryskip=0;
+   localnumaddrfamily=0;
    localnumtotalldcheck=0;
    localnumtotalstcheck=0;
    localnumtotalbrcheck=0;
@@ -917,16 +968,17 @@ RedundAnalysis::PropagateChecks() {
 ///////////////////////////////////////////////////////
 bool 
 RedundAnalysis::isSynchPoint(Instruction *I) {
-#ifdef L1_CHECK
-   //  L1
-   if (isa<StoreInst>(I) || isa<CallInst>(I))
-      return true;
-   else
-      return false;
-#endif
-#ifdef L3_CHECK
-   return (isa<CallInst>(I));  //L3
-#endif
+   if (MyPolicy.storeLevel == STORE_L3) return isSynchPointAt<StoreL3>(I);
+   return isSynchPointAt<StoreL1>(I);
+}
+
+template <class Level> bool 
+RedundAnalysis::isSynchPointAt(Instruction *I) {
+   if (isPrivateAccess(I)) return false;
+   //L1: stores synchronise too
+   if (Level::storeIsSynch && isa<StoreInst>(I)) return true;
+   //shared pure calls check their arguments but write nothing
+   return (CallClassify::isSynchCall(I) && !CallClassify::isSharedCall(I));
 }
 
 
@@ -1251,47 +1303,97 @@ void
 RedundAnalysis::DecomposeAddress(std::set<Value*>&valueSet, Value *addrP) {
    valueSet.clear();
    assert(duplicable(addrP) && "addr of load must be duplicable here");
-   Instruction *addrI = dyn_cast<Instruction>(addrP);
    //only instruction is able to be decomposed
-   if (addrI) {
-      if (Value *castOperand = scanCast(addrI)) {
-         if (Instruction *addr = dyn_cast<Instruction>(castOperand)) {
-            if (GetElementPtrInst *pointer = 
-                  dyn_cast<GetElementPtrInst>(addr)) {
-               //GetElementPtr
-               for (unsigned int i = 0; i< pointer->getNumOperands(); i++) {
-                  Value *op = pointer->getOperand(i);
-                  Value *castop = scanCast(op);
-                  if (castop) valueSet.insert(castop);
-               }
-            } else
-               if (addr->getOpcode() == Instruction::Add ||
-                     addr->getOpcode() == Instruction::Sub) {
-                  for (unsigned int i = 0; i<addr->getNumOperands(); i++) {
-                     Value *op = addr->getOperand(i);
-                     Value *castop = scanCast(op);
-                     if (castop) valueSet.insert(castop);
-                  }
-
-               } else {
-                  //normal inst
-                  if (castOperand != addrI) //has been casted
-                     valueSet.insert(castOperand);
-               }
-         } else {//end of inst-cast
-            //duplicable value. In this case, castOperand != addrI
-            valueSet.insert(castOperand);
-         } //not duplicable addrI or casted value
-
+   if (isa<Instruction>(addrP)) {
+      if (Value *castOperand = scanCast(addrP)) {
+         //normal inst: check what has been casted
+         if (!decomposeInto(valueSet, castOperand, 4)) 
+            if (castOperand != addrP) valueSet.insert(castOperand);
       } //end of scancast
    } //end of addrI
 }
 
+//Split v into the values its address arithmetic starts from, through
+//GEPs of GEPs, casts and add/sub/mul/shl. Constants and non-duplicable
+//operands drop out. Return false if v is not address arithmetic.
+bool
+RedundAnalysis::decomposeInto(std::set<Value*>&leaves, Value *v, int depth) {
+   Instruction *addr = dyn_cast<Instruction>(v);
+   if (!addr || depth == 0 || !isAddressArith(addr)) return false;
+
+   for (unsigned int i = 0; i < addr->getNumOperands(); i++) {
+      Value *castop = scanCast(addr->getOperand(i));
+      if (castop && !decomposeInto(leaves, castop, depth-1)) 
+         leaves.insert(castop);
+   }
+   return true;
+}
+
+bool
+RedundAnalysis::isAddressArith(Instruction *I) {
+   if (isa<GetElementPtrInst>(I)) return true;
+   switch (I->getOpcode()) {
+      case Instruction::Add:
+      case Instruction::Sub:
+      case Instruction::Mul:
+      case Instruction::Shl:
+         return true;
+      default:
+         return false;
+   }
+}
+
+//the pointer a chain of GEPs and casts starts from
+Value*
+RedundAnalysis::addressBase(Value *addrP) {
+   Value *base = addrP;
+   while (true) {
+      while (CastInst *castI = dyn_cast<CastInst>(base)) 
+         base = castI->getOperand(0);
+      GetElementPtrInst *pointer = dyn_cast<GetElementPtrInst>(base);
+      if (!pointer) return base;
+      base = pointer->getPointerOperand();
+   }
+}
+
+////////////////////////////////
+//markAddressFamilies()       //
+////////////////////////////////
+//Loads (and stores under L3) in one BB whose addresses start from the same
+//base form a family. Members check the decomposed base and indices even if
+//there are several of them: the first member checks the shared ones and
+//reg safe skips them for the others (a[i], a[i+1] check a and i once).
+void
+RedundAnalysis::markAddressFamilies() {
+   std::map<std::pair<BasicBlock*,Value*>, std::vector<Instruction*> > families;
+   std::map<Instruction*,CheckCode*>&codes = MycheckCodeMap->getMap();
+   for (std::map<Instruction*,CheckCode*>::iterator i=codes.begin(), e=codes.end(); i!=e; i++) {
+      Instruction *I = (*i).first;
+      Value *addrP = NULL;
+      if (isa<LoadInst>(I)) addrP = I->getOperand(0);
+      else if (isa<StoreInst>(I) && MyPolicy.storeLevel == STORE_L3) addrP = I->getOperand(1);
+      if (!addrP || !(*i).second->getCheckElems().count(addrP)) continue;
+      families[std::make_pair(I->getParent(), addressBase(addrP))].push_back(I);
+   }
+
+   std::map<std::pair<BasicBlock*,Value*>, std::vector<Instruction*> >::iterator fi, fe;
+   for (fi = families.begin(), fe = families.end(); fi != fe; fi++) {
+      std::vector<Instruction*> &members = (*fi).second;
+      if (members.size() < 2) continue;
+      for (unsigned int m = 0; m < members.size(); m++) {
+         CheckCode *checkcode = MycheckCodeMap->getCheckCode(members[m]);
+         if (isa<LoadInst>(members[m])) ((CheckLoad*)checkcode)->setFamily();
+         else ((CheckStore*)checkcode)->setFamily();
+      }
+      localnumaddrfamily += members.size();
+   }
+}
+
 Value*
 RedundAnalysis::scanCast(Value *I) {
    //remove scan wrap. return null if not duplicable
    Value *returnV = I;
-   if (CastInst *castI = dyn_cast<CastInst>(I)) {
+   while (CastInst *castI = dyn_cast<CastInst>(returnV)) {
       returnV = castI->getOperand(0);
    }
    if (duplicable(returnV)) return returnV;
@@ -1382,7 +1484,8 @@ RedundAnalysis::statRegRemove(Instruction *I, int num) {
 bool
 RedundAnalysis::isSafeReg(Value*v) {
    Value *beforeCast = scanCast(v);
-   if (beforeCast && isa<LoadInst>(beforeCast)) 
+   //a load from a private slot has a real duplicate
+   if (beforeCast && isa<LoadInst>(beforeCast) && !isPrivateAccess(cast<Instruction>(beforeCast))) 
       return true;
    else return false;
 }
@@ -1396,6 +1499,21 @@ RedundAnalysis::printSafeRegPassStat(Function &F) {
 }
 
 
+void
+RedundAnalysis::setCalleeSummary(CheckSummary *summary) {
+   MyCalleeSummary = summary;
+}
+
+void
+RedundAnalysis::setPrivateSlots(PrivateSlots *slots) {
+   MyPrivateSlots = slots;
+}
+
+bool
+RedundAnalysis::isPrivateAccess(Instruction *I) {
+   return (MyPrivateSlots && MyPrivateSlots->isPrivateAccess(I));
+}
+
 void
 RedundAnalysis::enableCheckADVRegSafe(DominatorTree *dominset) {
    reg_safe = true;
@@ -1436,7 +1554,6 @@ LoopIVInfo::~LoopIVInfo() {
 void
 LoopIVInfo::addExitingBlocks(std::vector<BasicBlock*>&blocks) {
    assert(ExitingBranch.empty() && "ExitingBranch set has been polluted");
-   assert (blocks.size() <= 2 && "num of exiting blocks must be less than 3");
    if (!blocks.empty()) {
       for (int i = 0, bsize = blocks.size(); i < bsize; i++) {
          addExitingBlock(blocks[i]);
@@ -1476,15 +1593,6 @@ LoopIVInfo::addBranch(BranchInst *br, bool toout) {
    ExitingBranch[br]=toout;
 }
 
-void
-LoopIVInfo::addIVset(std::vector<PHINode*>&IVs) {
-   assert(IVset.empty() && "IVset has been polluted");
-   int Isize = IVs.size();
-   assert (Isize > 0 && "num of IVs must be positive");
-   for (int i = 0; i< Isize; i++) 
-      IVset.insert(IVs[i]);
-}
-
 void
 LoopIVInfo::dump() {
    errs() << "Loop-Head("<<myloop->getHeader()->getName()<<")";
@@ -1506,13 +1614,19 @@ LoopIVInfo::dump() {
 
 
 /////////////////////////////////
-//rmLoopIV                     //
+//rmLoopSCEV                   //
 /////////////////////////////////
-//remove redundant loop inductin variable
-//For this loops, also remove checks on constant.
-//After this pass, check(i) are moved from normal tables to checkbranch's propToList.
+//Move checks out of loops with ScalarEvolution.
+//Loops are visited inner first. A checked value that is invariant in the
+//loop is checked once before the preheader's branch. A value that is an
+//affine recurrence of the loop is checked through its header PHI: an error
+//in start, step or any iteration stays in the recurrence, so the PHI is
+//checked on every exit edge (checkbranch's propToList) instead of in each
+//iteration. Addresses (GEP/add/sub/mul/shl/cast of such values) are
+//covered by their leaves, like DECOMPOSE_ADDR does.
+//Stores may stay inside the loop; calls and returns may not.
 void 
-RedundAnalysis::rmLoopIV(CheckCodeMap *checkCodeMap, ValueCheckedAtMap *valueCheckedAtMap, Function &F, LoopInfo &loopinfo) {
+RedundAnalysis::rmLoopSCEV(CheckCodeMap *checkCodeMap, ValueCheckedAtMap *valueCheckedAtMap, Function &F, LoopInfo &loopinfo, ScalarEvolution &SE) {
    assert(&F == MyF && "Function changed");
    assert(checkCodeMap == MycheckCodeMap && "MycheckCodeMap changed");
    assert(valueCheckedAtMap == MyvalueCheckedAtMap 
@@ -1522,27 +1636,20 @@ RedundAnalysis::rmLoopIV(CheckCodeMap *checkCodeMap, ValueCheckedAtMap *valueChe
    localnumloopst=0;
    localnumloopbr=0;
    localnumloopother=0;
-
+   localnumloophoist=0;
+   localnumloopexit=0;
 
    bool changed = false;
 #ifdef R_DEBUG
-   errs() << "\n============Remove redundant loopIV ("<< F.getName();
+   errs() << "\n============Move loop checks with SCEV ("<< F.getName();
    errs() <<") ==============\n";
 #endif
 
-   std::list<Loop*> potentialLoops;
-   potentialLoops.clear();
-
-   getInnermostLoop(potentialLoops, F, loopinfo);
-   if (!potentialLoops.empty()) {
-      for (std::list<Loop*>::iterator i=potentialLoops.begin(), e=potentialLoops.end(); i!=e; i++) {
-         if (LoopIVInfo * loopIvInfo = getLoopIV(*i)) {
-            if (optimizeOnIV(*i,loopIvInfo)) changed = true;
-
-            delete loopIvInfo;
-         }
-      }
-   } //end of if empty
+   std::list<Loop*> loops;
+   getLoopsInnerFirst(loops, loopinfo);
+   for (std::list<Loop*>::iterator i=loops.begin(), e=loops.end(); i!=e; i++) {
+      if (optimizeLoopSCEV(*i, loopinfo, SE)) changed = true;
+   }
 
    if (changed) {
       printLoopOptPassStat(F);
@@ -1553,132 +1660,176 @@ RedundAnalysis::rmLoopIV(CheckCodeMap *checkCodeMap, ValueCheckedAtMap *valueChe
    }
 }
 
-//if not satisfy, return NULL
-LoopIVInfo*
-RedundAnalysis::getLoopIV(Loop* loop) {
-   //# of Exiting block  <= 2
+bool
+RedundAnalysis::optimizeLoopSCEV(Loop *loop, LoopInfo &loopinfo, ScalarEvolution &SE) {
+   BasicBlock *preheader = loop->getLoopPreheader();
+   if (!preheader || !isa<BranchInst>(preheader->getTerminator())) return false;
+   if (!canMoveLoopChecks(loop)) return false;
+
    SmallVector<BasicBlock*,8> Eblocks;
-   Eblocks.clear();
    loop->getExitingBlocks(Eblocks);
-   if (Eblocks.size() <= 2) {
-      //has IV
-      std::vector<PHINode*> IVs;
-      IVs.clear();
-      getAllInductionVariable(loop, IVs);
-
-      if (IVs.size() > 0) {
-         //no func call or store
-         if (!hasSynchPoint(loop)) {
-            //add loopinfo to LoopIVInfo object
-            LoopIVInfo *info = new LoopIVInfo(loop);
-            std::vector<BasicBlock*> Eblocks__(Eblocks.begin(),Eblocks.end());
-            info->addExitingBlocks(Eblocks__);
-            info->addIVset(IVs);
-#ifdef R_DEBUG
-            std::cerr << "LoopSatisfy^^^";
-            info->dump();
-            std::cerr <<"^^^\n";
-#endif
-            return info;
+   if (Eblocks.empty()) return false;
+   LoopIVInfo info(loop);
+   std::vector<BasicBlock*> Eblocks__(Eblocks.begin(),Eblocks.end());
+   info.addExitingBlocks(Eblocks__);
+
+   //check points directly inside this loop. Checks placed at the
+   //preheaders of inner loops are among them.
+   std::vector<Instruction*> checkpoints;
+   std::map<Instruction*,CheckCode*>&codes = MycheckCodeMap->getMap();
+   for (std::map<Instruction*,CheckCode*>::iterator i=codes.begin(), e=codes.end(); i!=e; i++) {
+      Instruction *I = (*i).first;
+      if (loopinfo.getLoopFor(I->getParent()) == loop) checkpoints.push_back(I);
+   }
+
+   bool changed = false;
+   for (unsigned int c = 0; c < checkpoints.size(); c++) {
+      Instruction *checkI = checkpoints[c];
+      std::set<Value*> &checkElem = MycheckCodeMap->getCheckCode(checkI)->getCheckElems();
+      if (checkElem.empty()) continue;
+      //l1 checks the value and address at every store, before it writes
+      if (isa<StoreInst>(checkI) && MyPolicy.storeLevel == STORE_L1) continue;
+
+      //a load checks its address or all decomposed parts of it, so the
+      //address is moved as a whole (and the store address under L3).
+      Value *addrP = NULL;
+      Value *valueP = NULL;
+      if (isa<LoadInst>(checkI)) {
+         addrP = checkI->getOperand(0);
+      } else if (isa<StoreInst>(checkI) && MyPolicy.storeLevel == STORE_L3) {
+         valueP = checkI->getOperand(0);
+         addrP = checkI->getOperand(1);
+      }
+
+      std::vector<Value*> heads;
+      if (addrP) {
+         if (checkElem.count(addrP)) heads.push_back(addrP);
+         if (valueP && checkElem.count(valueP)) heads.push_back(valueP);
+      } else {
+         heads.assign(checkElem.begin(), checkElem.end());
+      }
+
+      for (unsigned int h = 0; h < heads.size(); h++) {
+         std::set<Value*> atPreheader, atExit;
+         if (!coverInLoop(heads[h], loop, loopinfo, SE, atPreheader, atExit, 4))
+            continue;
+
+         std::vector<Value*> toremove;
+         if (heads[h] == addrP) {
+            for (std::set<Value*>::iterator i=checkElem.begin(), e=checkElem.end(); i!=e; i++)
+               if ((*i) != valueP) toremove.push_back(*i);
+         } else {
+            toremove.push_back(heads[h]);
+         }
+         for (unsigned int r = 0; r < toremove.size(); r++) {
+            MycheckCodeMap->deleteElem(checkI, toremove[r]);
+            if (MyvalueCheckedAtMap->contain(toremove[r])) {
+               ValueCheckedAt *table = MyvalueCheckedAtMap->getValueCheckedTable(toremove[r]);
+               table->CheckedAtList.erase(checkI);
+               table->PropOrFinalList.erase(checkI);
+            }
+            statLoopOpt(toremove[r], checkI);
          }
+
+         for (std::set<Value*>::iterator i=atPreheader.begin(), e=atPreheader.end(); i!=e; i++)
+            moveToPreheader(*i, preheader);
+         for (std::set<Value*>::iterator i=atExit.begin(), e=atExit.end(); i!=e; i++) {
+            if (info.IVset.insert(*i).second) {
+               moveOutofLoop(*i, &info);
+               localnumloopexit++;
+            }
+         }
+         changed = true;
       }
    }
-   return NULL;
+   return changed;
 }
 
+//v is covered if it is constant, loop invariant (checked at preheader), a
+//header PHI with an affine recurrence (checked at exits), or address
+//arithmetic inside this loop over covered values.
 bool
-RedundAnalysis::optimizeOnIV(Loop* loop, LoopIVInfo *loopIVinfo) {
-   bool changed = false;
-   std::set<Value*>::iterator i = loopIVinfo->IVset.begin(), 
-      e = loopIVinfo->IVset.end();
-   for (; i!=e; i++) {
-      Value *iv = (*i);
-      if (MyvalueCheckedAtMap->contain(iv)) {
-         ValueCheckedAt *checkedTable = 
-            MyvalueCheckedAtMap->getValueCheckedTable(iv);
-         if (!checkedTable->notRemovable()) {
-            //pick inst that is inside loop
-            std::set<Instruction*>removed;
-            removed.clear();
-
-            std::set<Instruction*>::iterator ii = 
-               checkedTable->CheckedAtList.begin(), ie =
-               checkedTable->CheckedAtList.end();
-            for (; ii!= ie; ii++) {
-               Instruction *byInst = *ii;
-               if (insideLoop(loop, byInst)) {
-                  //remove iv from byInst's check-elem list
-                  MycheckCodeMap->deleteElem(byInst, iv);
-#ifdef R_DEBUG
-                  std::cerr<<"\n";
-#endif
-                  //remove byInst from iv's checkedTable
-                  removed.insert(byInst);
-                  statLoopOpt(iv, byInst);
-
-                  //check if there is checking on constant
-                  optConstantCheck(iv, loop,byInst, loopIVinfo);
-
-                  changed = true;
-               }//end of inside if
-            }//end of for
-
-            if (!removed.empty()) {
-               //copy the check outside of loop
-               moveOutofLoop(iv, loopIVinfo);
-               for (ii = removed.begin(), ie = removed.end(); ii != ie; ii++) 
-                  checkedTable->CheckedAtList.erase(*ii);
-            }
-         } //end of removable
-      } //end of inside loop
-   } //end of IVset
+RedundAnalysis::coverInLoop(Value *v, Loop *loop, LoopInfo &loopinfo, ScalarEvolution &SE, std::set<Value*>&atPreheader, std::set<Value*>&atExit, int depth) {
+   //never checked
+   if (!duplicable(v)) return true;
 
-   return changed;
+   if (loop->isLoopInvariant(v)) {
+      atPreheader.insert(v);
+      return true;
+   }
+
+   Instruction *I = cast<Instruction>(v);
+   if (loopinfo.getLoopFor(I->getParent()) != loop) return false;
+
+   if (isa<PHINode>(I)) {
+      if (I->getParent() != loop->getHeader()) return false;
+      if (!SE.isSCEVable(I->getType())) return false;
+      const SCEVAddRecExpr *AR = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(I));
+      if (!AR || AR->getLoop() != loop || !AR->isAffine()) return false;
+      atExit.insert(I);
+      return true;
+   }
+
+   //address arithmetic, same as DecomposeAddress
+   if (depth == 0) return false;
+   if (!isa<CastInst>(I) && !isAddressArith(I)) return false;
+
+   for (unsigned int i = 0; i < I->getNumOperands(); i++) {
+      if (!coverInLoop(I->getOperand(i), loop, loopinfo, SE, atPreheader, atExit, depth-1))
+         return false;
+   }
+   return true;
 }
 
+//Every exit must be a conditional branch, so exit checks run before
+//anything leaves the loop. Stores may stay: under l3 a wrong store is
+//detected at the exit, before a call or return could observe it; under
+//l1 the stores keep their own checks and only the others move.
 bool
-RedundAnalysis::insideLoop(Loop *loop, Instruction *I) {
-   return (loop->contains(I->getParent()));
+RedundAnalysis::canMoveLoopChecks(Loop *loop) {
+   std::vector<BasicBlock*>::const_iterator blockI = loop->block_begin(),
+      blockE = loop->block_end();
+   for (; blockI != blockE; blockI++) {
+      BasicBlock *BB = *blockI;
+      BranchInst *BI = dyn_cast<BranchInst>(BB->getTerminator());
+      if (!BI) return false;
+      if (BI->isUnconditional() && !loop->contains(BI->getSuccessor(0))) return false;
+
+      for (BasicBlock::iterator I = BB->begin(), E = BB->end(); I != E; ++I) {
+         if (StoreInst *SI = dyn_cast<StoreInst>(I)) {
+            if (SI->isVolatile()) return false;
+         } else if (isSynchPoint(I)) 
+            return false;
+      }
+   }
+   return true;
 }
 
+//place a check on v before the preheader's branch
+void
+RedundAnalysis::moveToPreheader(Value *v, BasicBlock *preheader) {
+   BranchInst *BI = cast<BranchInst>(preheader->getTerminator());
+   assert(BI->isUnconditional() && "preheader must end with an unconditional branch");
 
-//check if checkI checks loop invariants
-void 
-RedundAnalysis::optConstantCheck(Value *iv, Loop *loop, Instruction *checkI, LoopIVInfo *info) {
-   //TODO
-   CheckCode *checkcodeforI = MycheckCodeMap->getCheckCode(checkI);
-   assert(checkcodeforI && "checkcode must be not null");
-   std::set<Value*>&checkElem = checkcodeforI->getCheckElems();
-   if (!checkElem.empty()) {
-      std::set<Value*> toremove;
-      toremove.clear();
-
-      std::set<Value*>::iterator  i=checkElem.begin(), e=checkElem.end();
-      for (; i!=e;i++) {
-         if (loop->isLoopInvariant(*i)) {
-            //copy checking on loop invariant to outsie
-            moveOutofLoop(*i, info);
-            //remove checkI from (*i)'s list
-            MyvalueCheckedAtMap->getValueCheckedTable(*i)->CheckedAtList.erase(checkI);
-            //remove *i from checkI's list
-            toremove.insert(checkI);
-#ifdef R_DEBUG
-            errs() << "Move checking on loop invariant " << (*i)->getName() 
-               << " for I(";
-            if (checkI->hasName()) errs() << checkI->getName();
-            else errs() << checkI->getParent()->getName() <<":"<<checkI->getOpcodeName();
-            errs() <<")\n";
+   CheckCode *checkcode = MycheckCodeMap->getCheckCode(BI);
+   if (!checkcode) 
+      checkcode = MycheckCodeMap->newCheckCode(BI);
+   if (checkcode->getCheckElems().count(v)) return;
+
+   checkcode->insertOrigElement(v);
+   MyvalueCheckedAtMap->insertPropOrFinal(v, BI);
+   localnumloophoist++;
 
+#ifdef R_DEBUG
+   errs() << "Hoist check on " << v->getName() << " to preheader BB(" <<
+      preheader->getName()<<")\n";
 #endif
-            statLoopOpt(*i, checkI);
-         } //end of if
-      }//end of for
-
-      //do actual remove
-      if (!toremove.empty()) 
-         for (i=toremove.begin(), e=toremove.end(); i!=e; i++)
-            checkElem.erase(*i);
-   }
+}
+
+
+bool
+RedundAnalysis::insideLoop(Loop *loop, Instruction *I) {
+   return (loop->contains(I->getParent()));
 }
 
 
@@ -1729,73 +1880,29 @@ RedundAnalysis::printLoopOptPassStat(Function &F) {
    errs() << "LOCAL_REDUND_CHECK "<< localnumloopst <<" localnumloopst ("<<F.getName()<<")\n";
    errs() << "LOCAL_REDUND_CHECK "<< localnumloopbr <<" localnumloopbr ("<<F.getName()<<")\n";
    errs() << "LOCAL_REDUND_CHECK "<< localnumloopother <<" localnumloopother ("<<F.getName()<<")\n";   
+   errs() << "LOCAL_REDUND_CHECK "<< localnumloophoist <<" localnumloophoist ("<<F.getName()<<")\n";
+   errs() << "LOCAL_REDUND_CHECK "<< localnumloopexit <<" localnumloopexit ("<<F.getName()<<")\n";
 }
 
 
 
 
-///IV: an integer recurrence that increments by a constant
-///each time through the loop. If so, return the phi node that corresponds
-///to it.
+//loops in post order: inner loops come before the loops containing them
 void
-RedundAnalysis::getAllInductionVariable(Loop*loop, std::vector<PHINode*>&IVs) {
-   IVs.clear();
-
-   BasicBlock *H = loop->getHeader();
-
-   BasicBlock *Incoming = 0, *Backedge = 0;
-   pred_iterator PI = pred_begin(H);
-   assert(PI != pred_end(H) && "Loop must have at least one backedge!");
-   Backedge = *PI++;
-   if (PI == pred_end(H)) return;  // dead loop
-   Incoming = *PI++;
-   if (PI != pred_end(H)) return;  // multiple backedges?
-
-   if (loop->contains(Incoming)) {
-      if (loop->contains(Backedge))
-         return ;
-      std::swap(Incoming, Backedge);
-   } else if (!(loop->contains(Backedge)))
-      return ;
-
-   // Loop over all of the PHI nodes, looking for a canonical indvar.
-
-   for (BasicBlock::iterator I = H->begin(); isa<PHINode>(I); ++I) {
-      PHINode *PN = cast<PHINode>(I);
-      if (Instruction *Inc =
-            dyn_cast<Instruction>(PN->getIncomingValueForBlock(Backedge)))
-         if (Inc->getOpcode() == Instruction::Add ||
-               Inc->getOpcode() == Instruction::Sub)
-            if (Inc->getOperand(0) == PN)
-               if (isa<ConstantInt>(Inc->getOperand(1)))
-                  IVs.push_back(PN);
-   }//end of for
-
-}
-
-//get inner most loops
-void
-RedundAnalysis::getInnermostLoop(std::list<Loop*>&innerLoops, Function&F, LoopInfo &loopinfo) {
+RedundAnalysis::getLoopsInnerFirst(std::list<Loop*>&loops, LoopInfo &loopinfo) {
    std::list<Loop*> worklist;
-   worklist.clear();
+   for (LoopInfo::iterator LoopI = loopinfo.begin(), LoopE = loopinfo.end(); LoopI!=LoopE; LoopI++)
+      worklist.push_back(*LoopI);
 
-   LoopInfo::iterator LoopI = loopinfo.begin(), LoopE = loopinfo.end();
-   for (;LoopI!=LoopE; LoopI++) {
-      Loop * curloop = *LoopI;
-      worklist.push_back(curloop);
-   }
+   //a loop is pushed to the front after its parent
    while (!worklist.empty()) {
       Loop *thisLoop = worklist.front();
       worklist.pop_front();
+      loops.push_front(thisLoop);
       const std::vector<Loop*>&subloops = thisLoop->getSubLoops();
-      if (subloops.size() == 0) {
-         innerLoops.push_back(thisLoop);
-      } else {//not innermost loop
-         for (int i=0, loopsize=subloops.size(); i < loopsize; i++) 
-            worklist.push_back(subloops[i]);
-      }
+      for (int i=0, loopsize=subloops.size(); i < loopsize; i++) 
+         worklist.push_back(subloops[i]);
    } //end of while empty
-
 }
 
 
@@ -1810,7 +1917,8 @@ RedundAnalysis::getInnermostLoop(std::list<Loop*>&innerLoops, Function&F, LoopIn
 bool
 RedundAnalysis::duplicable(Value* V) {
    if (Instruction *Ins = dyn_cast<Instruction>(V)) {
-      if ( isa<CallInst>(Ins) || isa<TerminatorInst>(Ins) 
+      if ( (isa<CallInst>(Ins) && !CallClassify::isDuplicableCall(Ins))
+            || isa<TerminatorInst>(Ins) 
             || isa<StoreInst>(Ins) /*||isa<FreeInst>(Ins) //included in callinst  */
             || isa<AllocaInst>(Ins) ||  isa<VAArgInst>(Ins))  
          return false;
@@ -1830,7 +1938,6 @@ RedundAnalysis::isFuncArgu(Value *v) {
 Instruction* 
 RedundAnalysis::findLastCond (BasicBlock *BB) {
    TerminatorInst *lastIns = BB->getTerminator();
-   assert(!(isa<SwitchInst>(lastIns)) && "Find a SwitchInst! You need to lower SwitchInst.");
    BranchInst * BI = dyn_cast<BranchInst>(lastIns);
    if (BI && (BI->isConditional())) {
       Value *cond = BI->getCondition();
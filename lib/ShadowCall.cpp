@@ -0,0 +1,238 @@
+////////////////////////////////////////
+//ShadowCall.cpp                      //
+////////////////////////////////////////
+//Clone internal functions with shadow//
+//parameters and an {orig, dup} return//
+////////////////////////////////////////
+
+#define DEBUG_TYPE "shadow_call"
+
+#include "ShadowCall.h"
+#include "InsDuplica.h"
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Metadata.h>
+#include <llvm/ADT/Statistic.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
+#include <llvm/Support/raw_ostream.h>
+
+STATISTIC(NumShadowFunc, "Number of functions cloned with shadow parameters");
+STATISTIC(NumShadowCall, "Number of call sites using shadow parameters");
+
+using namespace llvm;
+
+static const char *ShadowMD = "ifdup.shadow";
+
+char ShadowCall::ID = 0;
+static RegisterPass<ShadowCall> X("ShadowCC", "Pass duplicated values across internal calls");
+
+////////////////////////////////////
+//runOnModule()                   //
+////////////////////////////////////
+bool ShadowCall::runOnModule(Module &M) {
+   //the same choice of functions as -InsDup
+   selector.build(M);
+
+   std::list<Function*> candidates;
+   for (Module::iterator Fi = M.begin(), Fe = M.end(); Fi != Fe; ++Fi) {
+      Function *F = Fi;
+      if (canShadow(F)) candidates.push_back(F);
+   }
+   if (candidates.empty()) return false;
+
+   //clone all candidates first: calls inside the clones still refer to the
+   //original functions and are rewritten together with the other callers.
+   std::map<Function*, Function*> shadowMap;
+   for (std::list<Function*>::iterator i = candidates.begin(), e = candidates.end(); i != e; ++i)
+      shadowMap[*i] = cloneWithShadow(*i);
+
+   for (std::map<Function*, Function*>::iterator i = shadowMap.begin(), e = shadowMap.end(); i != e; ++i) {
+      Function *F = i->first;
+      std::list<CallInst*> callers;
+      for (Value::use_iterator UI = F->use_begin(), UE = F->use_end(); UI != UE; ++UI)
+         callers.push_back(cast<CallInst>(*UI));
+      for (std::list<CallInst*>::iterator ci = callers.begin(), ce = callers.end(); ci != ce; ++ci)
+         rewriteCall(*ci, i->second);
+   }
+
+   //originals are dead now
+   for (std::map<Function*, Function*>::iterator i = shadowMap.begin(), e = shadowMap.end(); i != e; ++i) {
+      Function *F = i->first;
+      assert(F->use_empty() && "all callers must have been rewritten");
+      F->eraseFromParent();
+   }
+   return true;
+}
+
+////////////////////////////////////
+//canShadow()                     //
+//Only internal, non-address-taken//
+//functions called directly that  //
+//-InsDup protects                //
+////////////////////////////////////
+bool ShadowCall::canShadow(Function *F) {
+   if (F->isDeclaration() || !F->hasLocalLinkage() || F->isVarArg()) return false;
+   if (F->hasAddressTaken()) return false;
+   if (F->arg_empty() && F->getReturnType()->isVoidTy()) return false;
+
+   //an unprotected callee would never read its shadows, and its callers
+   //would no longer check the arguments
+   if (!ProtectPolicy::forFunction(*F, selector.lookup(F)).enabled) return false;
+   if (!InsDuplica::notdummyFunc(*F)) return false;
+
+   //the return value is packed into a struct
+   Type *retTy = F->getReturnType();
+   if (!retTy->isVoidTy() && !retTy->isFirstClassType()) return false;
+   if (retTy->isAggregateType()) return false;
+
+   //byval and friends change the meaning of a pointer parameter
+   for (Function::arg_iterator AI = F->arg_begin(), E = F->arg_end(); AI != E; ++AI) {
+      if (AI->hasByValAttr() || AI->hasStructRetAttr() || AI->hasNestAttr()) return false;
+      if (AI->getType()->isAggregateType()) return false;
+   }
+
+   //invokes are not rewritten
+   for (Value::use_iterator UI = F->use_begin(), UE = F->use_end(); UI != UE; ++UI) {
+      CallInst *CI = dyn_cast<CallInst>(*UI);
+      if (!CI || CI->getCalledFunction() != F) return false;
+   }
+   return true;
+}
+
+//function attributes, the parameter attributes on the originals and on
+//their shadows, no return attributes: the return is {r, r} now
+AttributeSet ShadowCall::shadowAttributes(LLVMContext &C, AttributeSet PAL, unsigned int numParams) {
+   AttributeSet NewPAL = PAL.getFnAttributes();
+   for (unsigned int i = 1; i <= numParams; i++) {
+      if (!PAL.hasAttributes(i)) continue;
+      AttrBuilder B(PAL.getParamAttributes(i), i);
+      NewPAL = NewPAL.addAttributes(C, i, AttributeSet::get(C, i, B));
+      NewPAL = NewPAL.addAttributes(C, i + numParams, AttributeSet::get(C, i + numParams, B));
+   }
+   return NewPAL;
+}
+
+////////////////////////////////////
+//cloneWithShadow()               //
+////////////////////////////////////
+Function *ShadowCall::cloneWithShadow(Function *F) {
+   Module *M = F->getParent();
+   LLVMContext &C = M->getContext();
+
+   //parameters: originals followed by their shadows
+   std::vector<Type*> params;
+   for (Function::arg_iterator AI = F->arg_begin(), E = F->arg_end(); AI != E; ++AI)
+      params.push_back(AI->getType());
+   unsigned int numParams = params.size();
+   for (unsigned int i = 0; i < numParams; i++)
+      params.push_back(params[i]);
+
+   Type *retTy = F->getReturnType();
+   Type *newRetTy = retTy;
+   if (!retTy->isVoidTy()) {
+      Type *pair[2] = {retTy, retTy};
+      newRetTy = StructType::get(C, pair);
+   }
+
+   FunctionType *FTy = FunctionType::get(newRetTy, params, false);
+   Function *NF = Function::Create(FTy, F->getLinkage(), F->getName() + ".shadow", M);
+   NF->setCallingConv(F->getCallingConv());
+
+   ValueToValueMapTy VMap;
+   Function::arg_iterator NAI = NF->arg_begin();
+   for (Function::arg_iterator AI = F->arg_begin(), E = F->arg_end(); AI != E; ++AI, ++NAI) {
+      NAI->setName(AI->getName());
+      VMap[AI] = NAI;
+   }
+   for (Function::arg_iterator AI = F->arg_begin(), E = F->arg_end(); AI != E; ++AI, ++NAI)
+      NAI->setName(AI->getName() + "_shadow");
+
+   SmallVector<ReturnInst*, 8> Returns;
+   CloneFunctionInto(NF, F, VMap, false, Returns, "");
+   //the clone has more arguments than F, so CloneFunctionInto copied the
+   //return attributes (zeroext on a struct fails the verifier) and the
+   //parameter attributes of the originals only
+   NF->setAttributes(shadowAttributes(C, F->getAttributes(), numParams));
+
+   //return {r, r}; InsDup replaces the second r with its duplicate
+   if (!retTy->isVoidTy()) {
+      for (unsigned int i = 0; i < Returns.size(); i++) {
+         ReturnInst *RI = Returns[i];
+         Value *retV = RI->getReturnValue();
+         InsertValueInst *p0 = InsertValueInst::Create(UndefValue::get(newRetTy), retV, 0, "", RI);
+         InsertValueInst *p1 = InsertValueInst::Create(p0, retV, 1, "", RI);
+         markShadow(p0);
+         markShadow(p1);
+         ReturnInst::Create(C, p1, RI);
+         RI->eraseFromParent();
+      }
+   }
+
+   //record the clone and its number of original parameters
+   NamedMDNode *NMD = M->getOrInsertNamedMetadata(ShadowMD);
+   Value *ops[2] = {NF, ConstantInt::get(Type::getInt32Ty(C), numParams)};
+   NMD->addOperand(MDNode::get(C, ops));
+
+   NumShadowFunc++;
+   return NF;
+}
+
+////////////////////////////////////
+//rewriteCall()                   //
+//call f(a) ==> call f.shadow(a,a)//
+////////////////////////////////////
+void ShadowCall::rewriteCall(CallInst *CI, Function *NF) {
+   std::vector<Value*> args;
+   unsigned int numArgs = CI->getNumArgOperands();
+   for (unsigned int i = 0; i < numArgs; i++)
+      args.push_back(CI->getArgOperand(i));
+   for (unsigned int i = 0; i < numArgs; i++)
+      args.push_back(CI->getArgOperand(i));
+
+   CallInst *newCI = CallInst::Create(NF, args, "", CI);
+   newCI->setCallingConv(CI->getCallingConv());
+   newCI->setAttributes(shadowAttributes(CI->getContext(), CI->getAttributes(), numArgs));
+   newCI->setDebugLoc(CI->getDebugLoc());
+   if (CI->isTailCall()) newCI->setTailCall();
+   markShadow(newCI);
+
+   if (!CI->getType()->isVoidTy()) {
+      unsigned int idx0[1] = {0};
+      unsigned int idx1[1] = {1};
+      ExtractValueInst *r = ExtractValueInst::Create(newCI, idx0, CI->getName(), CI);
+      ExtractValueInst *rdup = ExtractValueInst::Create(newCI, idx1, CI->getName() + "_shadow", CI);
+      markShadow(r);
+      markShadow(rdup);
+      CI->replaceAllUsesWith(r);
+   }
+   CI->eraseFromParent();
+   NumShadowCall++;
+}
+
+void ShadowCall::markShadow(Instruction *I) {
+   LLVMContext &C = I->getContext();
+   I->setMetadata(ShadowMD, MDNode::get(C, MDString::get(C, "shadow")));
+}
+
+////////////////////////////////////
+//numOrigParams()                 //
+////////////////////////////////////
+int ShadowCall::numOrigParams(Function *F) {
+   NamedMDNode *NMD = F->getParent()->getNamedMetadata(ShadowMD);
+   if (!NMD) return -1;
+   for (unsigned int i = 0, e = NMD->getNumOperands(); i < e; i++) {
+      MDNode *N = NMD->getOperand(i);
+      if (N->getOperand(0) == F)
+         return cast<ConstantInt>(N->getOperand(1))->getZExtValue();
+   }
+   return -1;
+}
+
+bool ShadowCall::isShadowInst(Instruction *I) {
+   return (I->getMetadata(ShadowMD) != NULL);
+}
+
+// vim: ts=3 sts=3 sw=3 et
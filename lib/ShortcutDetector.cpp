@@ -18,6 +18,8 @@
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Analysis/Dominators.h>
 
+#include <algorithm>
+
 using namespace llvm;
 
 ////////////////////////////////
@@ -57,22 +59,20 @@ bool ShortcutDetectorPass::isTwowayBranch (BasicBlock *BB) {
  *  - There are no store */
 bool ShortcutDetectorPass::isOnlyBranch (BasicBlock *BB) {
    bool onlybranch = true;
-   std::set<Instruction *> InstMark;
    for (BasicBlock::iterator Inst = BB->begin(), E = BB->end(); Inst!=E; ++Inst) {
       Instruction *I = Inst;
-      InstMark.insert(I);
       /*do not write to memory*/
       if (I->mayWriteToMemory()) {onlybranch = false; break;}
 
       /*iterate over all uses of I*/
+      unsigned int myOrdinal = InstOrdinal[I];
       for (Value::use_iterator Inst_use = I->use_begin(), use_end=I->use_end(); Inst_use!=use_end; Inst_use++) {
          /*do not use by other blocks */
          Instruction *use_I = dyn_cast<Instruction>(*Inst_use);
-         BasicBlock *use_block = use_I->getParent();
-         if (use_block!=BB) {onlybranch = false; break;}
+         if (!use_I || use_I->getParent()!=BB) {onlybranch = false; break;}
 
          /*the use_I is not before I in current basicblock*/
-         if (InstMark.count(use_I)!=0) { 
+         if (InstOrdinal[use_I] <= myOrdinal) { 
             onlybranch=false; 
             break;
          }
@@ -92,6 +92,22 @@ bool ShortcutDetectorPass::isOnlyBranch (BasicBlock *BB) {
 }
 
 
+/*Number blocks in function order and instructions in program order*/
+void ShortcutDetectorPass::numberBlocks(Function &F) {
+   BBs.clear();
+   BBindex.clear();
+   InstOrdinal.clear();
+   unsigned int ordinal = 0;
+   for (Function::iterator iBB = F.begin(), E=F.end(); iBB != E; ++iBB) {
+      BasicBlock *BB = iBB;
+      BBindex[BB] = BBs.size();
+      BBs.push_back(BB);
+      for (BasicBlock::iterator I = BB->begin(), IE = BB->end(); I != IE; ++I)
+         InstOrdinal[I] = ordinal++;
+   }
+}
+
+
 
 /*Check if BB jumps back to its ancestors*/
 
@@ -110,8 +126,8 @@ bool ShortcutDetectorPass::isJumpBack (BasicBlock *BB, BasicBlock *Target ) {
  *   /   BB2    *
  *  /   /  \    *
  *  BB3     BB4 */
-void ShortcutDetectorPass::dumpShortcut (std::list<ChildrenSet*> &headlist) {
-   std::list<ChildrenSet*>::iterator nodesetI, nodesetE;
+void ShortcutDetectorPass::dumpShortcut (const std::list<ChildrenSet*> &headlist) {
+   std::list<ChildrenSet*>::const_iterator nodesetI, nodesetE;
    for (nodesetI = headlist.begin(), nodesetE = headlist.end() ; nodesetI!=nodesetE; nodesetI++) {
       ChildrenSet *thisnode = *nodesetI;
       //assert (SCSetMap.count(thisnode)>0 && "ERROR: thisnode should have an entry on SCSetMap!"); - old
@@ -148,6 +164,8 @@ bool ShortcutDetectorPass::hasBackEdge(BasicBlock *BB) {
 /** runOnFunction*/
 bool ShortcutDetectorPass::runOnFunction(Function &F) {
    DominatorTree& DT = getAnalysis<DominatorTree>();
+   //the graph of the last function, if nobody released it
+   releaseMemory();
 
    /*print the information for this function*/
    localshortcut=0;
@@ -166,42 +184,43 @@ nodeset: the set of basic blocks that satisfy all of the followings
 - no backward edge
 - reachable
     ***/
-   std::set<BasicBlock*> leafset, nodeset;
+   numberBlocks(F);
+   unsigned int n = BBs.size();
+   std::vector<char> leafset(n, 0), nodeset(n, 0);
 
 
    /*Scan all basic blocks in this function and classify them into leafset, nodeset and canOnlytopset*/
-   for (Function::iterator iBB = F.begin(), E=F.end(); iBB != E; ++iBB) {
-      BasicBlock *BB = iBB;
+   for (unsigned int i = 0; i < n; i++) {
+      BasicBlock *BB = BBs[i];
       if (!(DT.isReachableFromEntry(BB)) || !(isTwowayBranch(BB)) || (hasBackEdge(BB)) ) { 
-         leafset.insert(BB);
+         leafset[i] = 1;
       } else {
-         nodeset.insert(BB);
-         if (!isOnlyBranch(BB)) leafset.insert(BB);
+         nodeset[i] = 1;
+         if (!isOnlyBranch(BB)) leafset[i] = 1;
       }
    }
 
    //debug - let's see what are contents in leafset and nodeset
 #ifdef Jing_DEBUG
    errs() << "DEBUG::: let's dump leafset...\n";
-   std::set<BasicBlock*>::iterator setI;
-   for (setI = leafset.begin(); setI != leafset.end(); ++setI) {
-      errs() << (*setI)->getName() << "  ";
+   for (unsigned int i = 0; i < n; i++) {
+      if (leafset[i]) errs() << BBs[i]->getName() << "  ";
    }
    errs() << "\nDEBUG:: let's dump nodeset...\n";
-   for (setI = nodeset.begin(); setI != nodeset.end(); ++setI) {
-      errs() << (*setI)->getName() << "  ";
+   for (unsigned int i = 0; i < n; i++) {
+      if (nodeset[i]) errs() << BBs[i]->getName() << "  ";
    }
    errs() << "\n";
 #endif
    //end of debug
 
-   std::map<BasicBlock*, ChildrenSet*> SCSetMap;
+   std::vector<ChildrenSet*> SCSetMap;
 
    //call SCSetMap constructor
    conSCSetMap(leafset,nodeset, SCSetMap);
 
    //build HeadNodeList. Verify domination attribute
-   BuildHeadNodeList (SCSetMap, F);
+   BuildHeadNodeList (SCSetMap);
 
    //clear useless nodes in SCSetMap
    ClearUselessNodesin (SCSetMap,HeadNodeList);
@@ -217,21 +236,174 @@ nodeset: the set of basic blocks that satisfy all of the followings
    return false;
 }
 
+void
+ShortcutDetectorPass::releaseMemory() {
+   HeadNodeList.clear();
+   Arena.clear();
+   RepsPropagated = NoReps;
+}
+
+//Propagation over the edges of every head set: each node puts its Reps
+//on its outgoing edges and passes on those of its only incoming edge.
+//ParIFDup and the IfDuplica passes read the result; a pass that wants
+//the other mode throws the Reps away and starts again.
+void ShortcutDetectorPass::propagateReps(RepMode mode) {
+   if (RepsPropagated == mode) return;
+   std::list<ChildrenSet*>::iterator iter;
+   ChildrenSet *SCHead;
+   if (RepsPropagated != NoReps) {
+      for (iter=HeadNodeList.begin(); iter!=HeadNodeList.end(); iter++) {
+         std::set<ChildrenSet*> *midnodeset = (*iter)->getSCmidnodeset();
+         (*iter)->out0->clearReps();
+         (*iter)->out1->clearReps();
+         for (std::set<ChildrenSet*>::iterator mi = midnodeset->begin(); mi != midnodeset->end(); mi++) {
+            (*mi)->out0->clearReps();
+            (*mi)->out1->clearReps();
+         }
+      }
+   }
+   RepsPropagated = mode;
+   for (iter=HeadNodeList.begin(); iter!=HeadNodeList.end(); iter++) {
+      SCHead=*iter;
+      std::set<ChildrenSet*> *midnodeset = SCHead->getSCmidnodeset();
+      std::list<ChildrenSet*> WorkList;
+      std::set<Edge*> MarkedEdge;
+      WorkList.push_front(SCHead);
+#ifdef Jing_DEBUG
+      //DEBUG_outputsethead(SCHead, midnodeset);
+#endif
+      //use this variable to verify if every midnode was touched
+      unsigned int worked_number=0;
+
+      while (!WorkList.empty()) {
+         ChildrenSet *curNode = WorkList.front();
+         WorkList.pop_front();
+         worked_number++;
+
+#ifdef Jing_DEBUG
+         //std::cerr << "IFDupPar workon "<< curNode->getBB()->getName() <<"\n";
+#endif
+         //work on curNode
+         //This is the function that complicated duplication algorithm should modify
+         IFDupforNode(curNode, mode);
+
+         //marked out0 and out1
+         MarkedEdge.insert(curNode->out0);
+         MarkedEdge.insert(curNode->out1);
+
+         //if target of out0 is within midnodeset &&
+         //all its incoming edges are marked, insert that node to WorkList
+         if (ChildrenSet *leftchild=curNode->leftchildrenset) {
+            if ((midnodeset->count(leftchild)>0) && (inEdgesMarked(leftchild,MarkedEdge)))
+               WorkList.push_back(leftchild);
+         }
+
+         //if target of out1 is within midnodeset &&
+         //all its incoming edges are marked, insert that node to WorkList
+         if (ChildrenSet *rightchild = curNode->rightchildrenset) {
+            if ((midnodeset->count(rightchild)>0) && (inEdgesMarked(rightchild,MarkedEdge))) {
+               WorkList.push_back(rightchild);
+            }
+         }
+
+      } //end of while
+
+      //check if every midnode has been touched
+      assert((worked_number==(midnodeset->size()+1)) && "Error:not all midnodes were touched!");
+   } //end of for
+}
+
+
+
+//check if node's incoming edges have an entry in MarkedEdge
+//This function is called when one incoming edge of this node was just accessed.
+bool ShortcutDetectorPass::inEdgesMarked(ChildrenSet *node, std::set<Edge*>& MarkedEdge) {
+   //If this node has only one incoming edge, it means all its incoming edge has been accessed.
+   if (node->inEdges->size()<=1) return true;
+   //FIXME : xiehuc node->inEdges is Edge; while iter is Edge*
+   //which is correct?
+   std::list<Edge*>::iterator iter;
+
+   for (iter = node->inEdges->begin(); iter != node->inEdges->end(); iter++) {
+      Edge *inedge = *iter; 
+      if(MarkedEdge.count(inedge) == 0) 
+         return false;
+   } 
+   return true;
+}
+
+
+//this is partial propagation algorithm, or the full one
+void ShortcutDetectorPass::IFDupforNode(ChildrenSet *curNode, RepMode mode) {
+
+   assert(curNode->out0->isnoRep() && "Error: the edge should not have Reps");
+   assert(curNode->out1->isnoRep() && "Error: the edge should not have Reps");
+
+   if (curNode->inEdges) {
+      ////////deal with incoming edges////////////////
+      //if there are more than one incoming edge
+      //fix their Reps. We will not propagate them. - may be optimized later - Jing
+      if (curNode->inEdges->size()>1) {
+         std::list<Edge*>::iterator iter,iterend;
+         for (iter=curNode->inEdges->begin(),iterend=curNode->inEdges->end(); iter!=iterend; iter++) 
+            (*iter)->fixAllReps();
+      }
+      //if there is only one incoming edge
+      //propagate its Reps
+      else {
+         Edge *inEdge = curNode->inEdges->front();
+
+         while (!inEdge->isPRepEmpty()) {
+            //thie popFirstRep() will pop out the first element
+            Rep *curRep = inEdge->popFirstRep();
+            //propagateTo() will check if curRep is allowed to be prpagated to that node
+            curNode->out0->propagateTo(curRep);
+            curNode->out1->propagateTo(curRep);
+         }
+      }
+   }
+   /////////////////////////////////////////////////
+   //replicate myself and propagate to outgoing edges
+   if (mode == FullReps) {
+      curNode->out0->propagateTo(newRep(curNode->getBB(), true));
+      curNode->out1->propagateTo(newRep(curNode->getBB(), false));
+   } else if (!curNode->haveSC) {
+      Rep *replica0 = newRep(curNode->getBB(),true);
+      curNode->out0->insertRep(replica0);
+      Rep *replica1 = newRep(curNode->getBB(),false);
+      curNode->out1->insertRep(replica1);
+   } else {
+      BasicBlock *leftB = curNode->out0->getTo();
+      BasicBlock *rightB = curNode->out1->getTo();
+
+      if (curNode->isleftSC) {
+         Rep *replica0 = newRep(curNode->getBB(), true);
+         curNode->out0->insertRep(replica0);
+         Rep *replica1 = newRep(curNode->getBB(),false,leftB);
+         curNode->out1->propagateTo(replica1);
+      } else {
+         Rep *replica0 = newRep(curNode->getBB(),true, rightB);
+         curNode->out0->propagateTo(replica0);
+         Rep *replica1 = newRep(curNode->getBB(), false);
+         curNode->out1->insertRep(replica1);
+      }
+   }
+}
+
+
 //clear useless nodes in SCSetMap
 void 
-ShortcutDetectorPass::ClearUselessNodesin (std::map<BasicBlock*,ChildrenSet*>&SCSetMap, std::list<ChildrenSet*>&HeadNodeList) {
+ShortcutDetectorPass::ClearUselessNodesin (std::vector<ChildrenSet*>&SCSetMap, std::list<ChildrenSet*>&HeadNodeList) {
    //to do
 } 
 
 
 //build HeadNodeList. Verify domination attribute
    void
-ShortcutDetectorPass::BuildHeadNodeList(std::map<BasicBlock*,ChildrenSet*>&SCSetMap, Function &F) 
+ShortcutDetectorPass::BuildHeadNodeList(std::vector<ChildrenSet*>&SCSetMap) 
 {
-   for (Function::iterator iBB = F.begin(), E=F.end(); iBB != E; ++iBB) {
-      BasicBlock *BB = iBB;
-      if (SCSetMap.count(BB)>0) {
-         ChildrenSet *children =  (*(SCSetMap.find(BB))).second;
+   for (unsigned int i = 0; i < SCSetMap.size(); i++) {
+      if (ChildrenSet *children = SCSetMap[i]) {
          if (children->isHead()) {
             //verify this the head can dominate all its SCmidnodes
             if (verify_domination(children)) 
@@ -253,58 +425,63 @@ ShortcutDetectorPass::verify_domination(ChildrenSet* sethead) {
 ///////////////////////////////////
 ///construct ChildrenSet Map   ////
 ///////////////////////////////////
+//A node gets its ChildrenSet once each child is a leaf or has one. One
+//depth first walk over the nodes builds them in post order, children
+//first. A node on a cycle of nodes (irreducible code) never gets one.
 void 
-ShortcutDetectorPass::conSCSetMap(std::set<BasicBlock*> &leafset, std::set<BasicBlock*> &nodeset, std::map<BasicBlock*,ChildrenSet*> &SCSetMap) {
-
-   ChildrenSet *newChildrenSet;
-
-   /*Iterate over nodeset and seek for shortcut edges */
-   bool changed;
-   std::set<BasicBlock*>::iterator nodesetI, nodesetE;
-
-   do {
-      changed = false;
-
-      for (nodesetI = nodeset.begin(), nodesetE = nodeset.end() ; nodesetI!=nodesetE; nodesetI++) {
-         BasicBlock * thisNode = *nodesetI;
-         if (SCSetMap.count(thisNode)==0) {
-            //bool canOnlytop = leafset.count(thisNode)>0;
-            BranchInst *thisNodeBranchI = dyn_cast<BranchInst>(thisNode->getTerminator());
-            BasicBlock *leftChild = thisNodeBranchI ->getSuccessor(0);
-            BasicBlock *rightChild = thisNodeBranchI -> getSuccessor(1);
-
-            if ( (leafset.count(leftChild)) > 0 ) {
-               if ((leafset.count(rightChild)) > 0) {
-                  /*Two children are leaves */
-                  newChildrenSet = new ChildrenSet(thisNode,leftChild,rightChild);
-                  SCSetMap.insert(std::pair<BasicBlock*,ChildrenSet*>(thisNode,newChildrenSet));
-                  changed = true;
-               } else { 
-                  if ((SCSetMap.count(rightChild)) > 0) {
-                     /*one leaf, one intermediate node*/
-                     newChildrenSet = new ChildrenSet(thisNode,leftChild,(*(SCSetMap.find(rightChild))).second);
-                     SCSetMap.insert(std::pair<BasicBlock*,ChildrenSet*>(thisNode, newChildrenSet));
-                     changed = true;
-                  }
-               }  
-            }  else if (SCSetMap.count(leftChild)>0) {
-               if (leafset.count(rightChild)>0) {
-                  /*one leaf, one intermediate node*/
-                  newChildrenSet = new ChildrenSet(thisNode,(*(SCSetMap.find(leftChild))).second, rightChild);
-                  SCSetMap.insert(std::pair<BasicBlock*,ChildrenSet*>(thisNode, newChildrenSet));
-                  changed=true;
-               } else {
-                  if (SCSetMap.count(rightChild)>0) {
-                     /*two are intermediate nodes*/
-                     newChildrenSet = new ChildrenSet(thisNode,(*(SCSetMap.find(leftChild))).second,(*(SCSetMap.find(rightChild))).second );
-                     SCSetMap.insert(std::pair<BasicBlock*,ChildrenSet*>(thisNode, newChildrenSet));
-                     changed = true;
-                  }
-               }
-            } 
-         }  //if thisNode does not have an entry on SCSetMap  
-      } //end of for 
-   } while (changed);
+ShortcutDetectorPass::conSCSetMap(std::vector<char> &leafset, std::vector<char> &nodeset, std::vector<ChildrenSet*> &SCSetMap) {
+   unsigned int n = BBs.size();
+   SCSetMap.assign(n, NULL);
+   //0: not visited, 1: on the walk, 2: done
+   std::vector<char> state(n, 0);
+   //node, successor to look at next
+   std::vector<std::pair<unsigned int, unsigned int> > walk;
+
+   for (unsigned int root = 0; root < n; root++) {
+      if (!nodeset[root] || state[root]) continue;
+      state[root] = 1;
+      walk.push_back(std::make_pair(root, 0u));
+
+      while (!walk.empty()) {
+         unsigned int thisIdx = walk.back().first;
+         BasicBlock * thisNode = BBs[thisIdx];
+         BranchInst *thisNodeBranchI = cast<BranchInst>(thisNode->getTerminator());
+         unsigned int succ = walk.back().second++;
+         if (succ < 2) {
+            //every block that is not a leaf is a node
+            unsigned int childIdx = BBindex[thisNodeBranchI->getSuccessor(succ)];
+            if (!leafset[childIdx] && state[childIdx] == 0) {
+               state[childIdx] = 1;
+               walk.push_back(std::make_pair(childIdx, 0u));
+            }
+            continue;
+         }
+         walk.pop_back();
+         state[thisIdx] = 2;
+
+         BasicBlock *leftChild = thisNodeBranchI ->getSuccessor(0);
+         BasicBlock *rightChild = thisNodeBranchI -> getSuccessor(1);
+         unsigned int leftIdx = BBindex[leftChild], rightIdx = BBindex[rightChild];
+
+         if (leafset[leftIdx]) {
+            if (leafset[rightIdx]) {
+               /*Two children are leaves */
+               SCSetMap[thisIdx] = Arena.newChildrenSet(thisNode,leftChild,rightChild);
+            } else if (SCSetMap[rightIdx]) {
+               /*one leaf, one intermediate node*/
+               SCSetMap[thisIdx] = Arena.newChildrenSet(thisNode,leftChild,SCSetMap[rightIdx]);
+            }
+         } else if (SCSetMap[leftIdx]) {
+            if (leafset[rightIdx]) {
+               /*one leaf, one intermediate node*/
+               SCSetMap[thisIdx] = Arena.newChildrenSet(thisNode,SCSetMap[leftIdx], rightChild);
+            } else if (SCSetMap[rightIdx]) {
+               /*two are intermediate nodes*/
+               SCSetMap[thisIdx] = Arena.newChildrenSet(thisNode,SCSetMap[leftIdx],SCSetMap[rightIdx]);
+            }
+         }
+      } //end of walk
+   } //end of for root
 
 }
 
@@ -327,7 +504,7 @@ ShortcutDetectorPass::conEdgeGraph(std::list<ChildrenSet*> &HeadNodeList) {
          ChildrenSet* curNode = WorkList.front();
          WorkList.pop_front();
          if (Marked.count(curNode)==0) {
-            curNode->conEdgeGraph(midnodeset);
+            curNode->conEdgeGraph(midnodeset, Arena);
             Marked.insert(curNode);
             if (ChildrenSet *leftchild = curNode->leftchildrenset) 
                if (midnodeset->count(leftchild)>0) 
@@ -353,6 +530,7 @@ ChildrenSet::init(BasicBlock *thisBB, int leftlevel, int rightlevel) {
    uplink = NULL; 
    nummidnodes = 0;
    SCmidnodeset = NULL;
+   mySCpath = NULL;
    rightchildrenset=NULL;
    leftchildrenset =NULL;
    rightchildBB = NULL;
@@ -466,15 +644,15 @@ ChildrenSet::ChildrenSet (BasicBlock *thisBB, ChildrenSet *leftSet, ChildrenSet
 
  *****old version
  */
-/**union the two sets and put the result on the first one*/
+/**hand the set of an invalidated head over to sum. The bigger of the two
+  sets is kept and the smaller merged into it, so the heads of a chain
+  pass one set up instead of copying it at every level*/
 void
-ChildrenSet::ChildrenSetUnion (std::set<ChildrenSet*>* sum, std::set<ChildrenSet*>*operand) {
-   ChildrenSet * iterBB;
-   std::set<ChildrenSet*>::iterator iter;
-   for (iter=operand->begin(); iter != operand->end(); iter++) {
-      iterBB = *iter;
-      if (sum->count(iterBB)==0) sum->insert(iterBB);
-   } 
+ChildrenSet::ChildrenSetSplice (std::set<ChildrenSet*>* &sum, std::set<ChildrenSet*>*operand) {
+   if (!operand) return;
+   if (sum->size() < operand->size()) std::swap(sum, operand);
+   sum->insert(operand->begin(), operand->end());
+   delete operand;
 }
 
 /*insert the second argument into the first set*/
@@ -554,7 +732,8 @@ ChildrenSet::isShortcut(BasicBlock *key, ChildrenSet *root, int *lastLeft) {
 }
 
 
-/**collect all midnodeset for this midnode path. The side effect is that all heads were invalidated*/
+/**collect all midnodeset for this midnode path. The side effect is that all heads were invalidated
+  and handed their midnodesets over: only heads' sets are read later*/
 std::set<ChildrenSet*> *
 ChildrenSet::getallmidnodeset(ChildrenSet* findMidnode, ChildrenSet *pathstart, int*totalSCnum) {
    int totalSC = 0;
@@ -563,7 +742,7 @@ ChildrenSet::getallmidnodeset(ChildrenSet* findMidnode, ChildrenSet *pathstart,
       if (findMidnode->isHead()) {
          findMidnode->invalidateHead();
          totalSC += findMidnode->getSCnum();
-         ChildrenSetUnion(allmidnodeset, findMidnode->getSCmidnodeset());
+         ChildrenSetSplice(allmidnodeset, findMidnode->takeSCmidnodeset());
       }
       ChildrenSetInsert(allmidnodeset, findMidnode);
       findMidnode=findMidnode->getUplink();
@@ -572,7 +751,7 @@ ChildrenSet::getallmidnodeset(ChildrenSet* findMidnode, ChildrenSet *pathstart,
    totalSC ++; //add myself
    if (findMidnode->isHead()) {
       findMidnode->invalidateHead();
-      ChildrenSetUnion(allmidnodeset, findMidnode->getSCmidnodeset());
+      ChildrenSetSplice(allmidnodeset, findMidnode->takeSCmidnodeset());
       totalSC += findMidnode->getSCnum();
    }
    ChildrenSetInsert(allmidnodeset,findMidnode);
@@ -612,14 +791,14 @@ std::string itos(int i)
    static
 std::string listtos(std::list<bool> *path)
 {
-   std::string *s = new std::string();
+   std::string s;
    std::list<bool>::iterator pathiter,pathend;
    pathend = path->end();
    for (pathiter=path->begin(); pathiter!=pathend; pathiter++) {
-      if (*pathiter) { (*s)+="L";}
-      else {(*s)+="R";}
+      if (*pathiter) { s+="L";}
+      else {s+="R";}
    }
-   return *s;
+   return s;
 }
 
 std::string 
@@ -678,21 +857,21 @@ ChildrenSet::verify_domination(DominatorTree& DT){
 
 //construct outgoing edges for this node
 //also add likes of the new edges to their corresponding target nodes if their targets are within *midnodeset*
-void ChildrenSet::conEdgeGraph(std::set<ChildrenSet*>*midnodeset) {
+void ChildrenSet::conEdgeGraph(std::set<ChildrenSet*>*midnodeset, ShortcutArena &arena) {
    //#ifdef Jing_DEBUG
    //std::cerr<< "Debug:: come to conEdgeGraph for "<< myBB->getName()<<"\n";
    //#endif
-   if (leftchildBB) out0 = new Edge(this,leftchildBB); 
+   if (leftchildBB) out0 = arena.newEdge(this,leftchildBB); 
    else {
-      out0 = new Edge(this, leftchildrenset->getBB());
+      out0 = arena.newEdge(this, leftchildrenset->getBB());
       if (midnodeset->count(leftchildrenset)>0) {
          //left child is within the scope
          leftchildrenset->addinEdges(out0);
       }
    }
-   if (rightchildBB) out1 = new Edge(this,rightchildBB);
+   if (rightchildBB) out1 = arena.newEdge(this,rightchildBB);
    else {
-      out1 = new Edge(this, rightchildrenset->getBB());
+      out1 = arena.newEdge(this, rightchildrenset->getBB());
       if (midnodeset->count(rightchildrenset)>0) {
          //right child is within the scope
          rightchildrenset->addinEdges(out1);
@@ -706,6 +885,22 @@ void ChildrenSet::addinEdges(Edge *inEdge) {
 }
 
 
+/////////////////////////////////////
+///ShortcutArena class           ////
+/////////////////////////////////////
+//Reps need no destructor; the containers of the others live on the heap
+void
+ShortcutArena::clear() {
+   for (unsigned int i = 0; i < Nodes.size(); i++)
+      Nodes[i]->~ChildrenSet();
+   for (unsigned int i = 0; i < Edges.size(); i++)
+      Edges[i]->~Edge();
+   Nodes.clear();
+   Edges.clear();
+   Alloc.Reset();
+}
+
+
 /////////////////////////////////////
 ///Rep class                     ////
 ///Edge class                    ////
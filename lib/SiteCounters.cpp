@@ -0,0 +1,215 @@
+////////////////////////////////////////
+//SiteCounters.cpp                    //
+////////////////////////////////////////
+//Per-thread counters on check sites  //
+//and the profile they dump           //
+////////////////////////////////////////
+
+#include "SiteCounters.h"
+#include <llvm/ADT/OwningPtr.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/system_error.h>
+
+#include <string.h>
+
+using namespace llvm;
+
+static cl::opt<bool> SiteCountersOpt("ifdup-site-counters",
+      cl::desc("Count the executions of each check site (link with libifdup_rt.a)"),
+      cl::init(false));
+
+static cl::opt<std::string> SiteProfileOpt("ifdup-site-profile",
+      cl::desc("Check site counts dumped by a -ifdup-site-counters build"),
+      cl::value_desc("filename"), cl::init(""));
+
+#define SITE_MAGIC "IFDS"
+#define SITE_VERSION 1
+
+////////////////////////////////////
+//SiteProfile::load()             //
+////////////////////////////////////
+static bool readU32(StringRef buf, size_t &pos, uint32_t &v) {
+   if (pos + 4 > buf.size()) return false;
+   memcpy(&v, buf.data() + pos, 4);
+   pos += 4;
+   return true;
+}
+
+bool SiteProfile::load(StringRef path) {
+   OwningPtr<MemoryBuffer> mb;
+   if (error_code ec = MemoryBuffer::getFile(path, mb)) {
+      errs() << "IFDup: cannot read " << path << ": " << ec.message() << "\n";
+      return false;
+   }
+
+   StringRef buf = mb->getBuffer();
+   size_t pos = 4;
+   uint32_t version, nmodules;
+   if (!buf.startswith(SITE_MAGIC) || !readU32(buf, pos, version) || version != SITE_VERSION
+         || !readU32(buf, pos, nmodules)) {
+      errs() << "IFDup: " << path << " is not a check site profile\n";
+      return false;
+   }
+
+   for (uint32_t m = 0; m < nmodules; m++) {
+      uint32_t namelen, nsites;
+      if (!readU32(buf, pos, namelen) || pos + namelen > buf.size()) break;
+      std::string name = buf.substr(pos, namelen).str();
+      pos += namelen;
+      if (!readU32(buf, pos, nsites) || pos + 8*(uint64_t)nsites > buf.size()) break;
+      std::vector<uint64_t> &counts = modules[name];
+      counts.resize(nsites);
+      if (nsites) memcpy(&counts[0], buf.data() + pos, 8*(size_t)nsites);
+      pos += 8*(size_t)nsites;
+   }
+   if (pos != buf.size())
+      errs() << "IFDup: " << path << " is truncated\n";
+   return true;
+}
+
+std::vector<uint64_t> *SiteProfile::lookup(StringRef name) {
+   std::map<std::string, std::vector<uint64_t> >::iterator i = modules.find(name);
+   if (i == modules.end()) return NULL;
+   return &(*i).second;
+}
+
+////////////////////////////////////
+//SiteCounters                    //
+////////////////////////////////////
+SiteCounters::SiteCounters() {
+   MyM = NULL;
+   desc = NULL;
+   threadSites = NULL;
+   curSites = NULL;
+   nsites = 0;
+   counts = NULL;
+}
+
+//the file name only, so a profile outlives the build directory
+void SiteCounters::beginModule(Module &M, StringRef pass) {
+   MyM = &M;
+   moduleName = sys::path::filename(M.getModuleIdentifier()).str() + ":" + pass.str();
+   nsites = 0;
+   desc = NULL;
+   curSites = NULL;
+
+   counts = NULL;
+   if (!SiteProfileOpt.empty() && profile.load(SiteProfileOpt)) {
+      counts = profile.lookup(moduleName);
+      if (!counts)
+         errs() << "IFDup: no check site counts for " << moduleName << " in " << SiteProfileOpt << "\n";
+   }
+
+   if (!SiteCountersOpt) return;
+   LLVMContext &C = M.getContext();
+   Type *i8p = Type::getInt8PtrTy(C);
+   StructType *descTy = StructType::get(i8p, Type::getInt32Ty(C), NULL);
+   //nsites is only known at the end, endModule() sets the initializer
+   desc = new GlobalVariable(M, descTy, false, GlobalValue::PrivateLinkage,
+         Constant::getNullValue(descTy), "__ifdup_module");
+
+   FunctionType *FT = FunctionType::get(Type::getInt64PtrTy(C), descTy->getPointerTo(), false);
+   threadSites = cast<Function>(M.getOrInsertFunction("__ifdup_thread_sites", FT));
+   threadSites->setDoesNotThrow();
+}
+
+void SiteCounters::endModule() {
+   if (counts && counts->size() != nsites)
+      errs() << "IFDup: " << moduleName << " has " << nsites << " check sites, the profile "
+         << counts->size() << ": it is stale\n";
+   if (!desc) return;
+
+   LLVMContext &C = MyM->getContext();
+   Constant *nameInit = ConstantDataArray::getString(C, moduleName, true);
+   GlobalVariable *name = new GlobalVariable(*MyM, nameInit->getType(), true,
+         GlobalValue::PrivateLinkage, nameInit, "__ifdup_module_name");
+   Constant *fields[2];
+   fields[0] = ConstantExpr::getPointerCast(name, Type::getInt8PtrTy(C));
+   fields[1] = ConstantInt::get(Type::getInt32Ty(C), nsites);
+   desc->setInitializer(ConstantStruct::get(cast<StructType>(desc->getType()->getElementType()), fields));
+   desc = NULL;
+}
+
+//the call is created now and inserted once F is done, so that the
+//duplication never sees it
+void SiteCounters::beginFunction(Function &F) {
+   localnumsites = 0;
+   localsiteexec = 0;
+   localhotsite = 0;
+   localhotcount = 0;
+   curSites = desc ? CallInst::Create(threadSites, desc, "ifdup.sites") : NULL;
+}
+
+void SiteCounters::endFunction(Function &F) {
+   if (!curSites) return;
+   if (curSites->use_empty()) {
+      delete curSites;
+      curSites = NULL;
+      return;
+   }
+   //after the allocas, which must stay first in the entry block
+   BasicBlock::iterator pos = F.getEntryBlock().getFirstInsertionPt();
+   while (isa<AllocaInst>(pos)) ++pos;
+   curSites->insertBefore(pos);
+   curSites = NULL;
+}
+
+////////////////////////////////////
+//addSite()                       //
+////////////////////////////////////
+unsigned int SiteCounters::addSite(TerminatorInst *checkBr, unsigned int okSucc) {
+   unsigned int id = nsites++;
+   LLVMContext &C = checkBr->getContext();
+   Value *idv = ConstantInt::get(Type::getInt32Ty(C), id);
+   checkBr->setMetadata("ifdup.site", MDNode::get(C, idv));
+   localnumsites++;
+
+   //sites[id]++, no atomic: nobody else writes this thread's array
+   if (curSites) {
+      Type *i64 = Type::getInt64Ty(C);
+      Value *idx = ConstantInt::get(i64, id);
+      Instruction *slot = GetElementPtrInst::CreateInBounds(curSites, idx, "", checkBr);
+      LoadInst *n = new LoadInst(slot, "", checkBr);
+      Instruction *n1 = BinaryOperator::CreateAdd(n, ConstantInt::get(i64, 1), "", checkBr);
+      new StoreInst(n1, slot, checkBr);
+   }
+
+   if (counts && id < counts->size()) {
+      uint64_t c = (*counts)[id];
+      localsiteexec += c;
+      if (c > localhotcount) {
+         localhotcount = c;
+         localhotsite = id;
+      }
+      //the error edge was never taken
+      if (c > 0) {
+         uint32_t w = c > UINT32_MAX ? UINT32_MAX : (uint32_t)c;
+         BasicBlock *ok = checkBr->getSuccessor(okSucc);
+         SmallVector<uint32_t, 4> weights;
+         for (unsigned int i = 0; i < checkBr->getNumSuccessors(); i++)
+            weights.push_back(checkBr->getSuccessor(i) == ok ? w : 1);
+         MDBuilder MDB(C);
+         checkBr->setMetadata(LLVMContext::MD_prof, MDB.createBranchWeights(weights));
+      }
+   }
+   return id;
+}
+
+void SiteCounters::printStat(Function &F) {
+   errs() << "local check sites: " << localnumsites << " (" << F.getName() <<")\n";
+   if (!counts) return;
+   errs() << "local profiled check executions: " << localsiteexec << " (" << F.getName() <<")\n";
+   if (localhotcount > 0)
+      errs() << "local hottest check site: " << localhotsite << ", " << localhotcount
+         << " executions (" << F.getName() <<")\n";
+}
+
+// vim: ts=3 sts=3 sw=3 et
@@ -0,0 +1,147 @@
+//-------------Developed by Jing Yu ----------//
+//StoreVAtool.cpp                             //
+//============================================//
+//Store signatures for store-dense loops      //
+//============================================//
+
+#define DEBUG_TYPE "store_sig"
+
+#include "StoreVAtool.h"
+#include "LockInst.h"
+#include "CallClassify.h"
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/Statistic.h>
+
+#include <list>
+
+STATISTIC(NumStSigChecker, "Number of store signature checkers");
+STATISTIC(NumStSigCal, "Number of store signature calculations");
+
+using namespace llvm;
+
+StoreVAtool::StoreVAtool(LoopInfo *loopinfo, Function &F, Lock *lock, PrivateSlots *slots)
+   : funcloop(loopinfo), myfunc(&F), LockIns(lock), privateSlots(slots), stSig(NULL),
+     localStSigChecker(0), localStSigCal(0) {}
+
+////////////////////////////////////////
+//findInterestingLoop()               //
+//outermost loops with at least       //
+//ManyStore stores per block          //
+////////////////////////////////////////
+bool StoreVAtool::findInterestingLoop(float ManyStore, std::set<BasicBlock*> &skip) {
+   std::list<Loop*> worklist(funcloop->begin(), funcloop->end());
+   while (!worklist.empty()) {
+      Loop *L = worklist.front();
+      worklist.pop_front();
+      if (!workOnIt(L, ManyStore, skip)) {
+         const std::vector<Loop*>&subloops = L->getSubLoops();
+         worklist.insert(worklist.end(), subloops.begin(), subloops.end());
+         continue;
+      }
+
+      LoopList.push_back(L);
+      loopBlocks.insert(L->block_begin(), L->block_end());
+      SmallVector<BasicBlock*,8> exits;
+      L->getUniqueExitBlocks(exits);
+      exitBlocks.insert(exits.begin(), exits.end());
+   }
+   if (LoopList.empty()) return false;
+
+   //initialised to 0 by addSigCheckers()
+   stSig = new AllocaInst(Type::getInt64Ty(myfunc->getContext()), "ifdup.stsig", myfunc->begin()->begin());
+   return true;
+}
+
+//A signature must be checked before anything outside the loop sees the
+//stores, so loops that call functions keep their store checks.
+bool StoreVAtool::workOnIt(Loop *inLoop, float ManyStore, std::set<BasicBlock*> &skip) {
+   unsigned int numStore = 0;
+   for (Loop::block_iterator bi = inLoop->block_begin(), be = inLoop->block_end(); bi != be; ++bi) {
+      BasicBlock *BB = *bi;
+      if (skip.count(BB)) return false;
+      TerminatorInst *T = BB->getTerminator();
+      if (!isa<BranchInst>(T) && !isa<SwitchInst>(T)) return false;
+      for (BasicBlock::iterator I = BB->begin(), E = BB->end(); I != E; ++I) {
+         if (privateSlots->isPrivateAccess(I)) continue;
+         if (CallClassify::isSynchCall(I)) return false;
+         if (isa<StoreInst>(I)) numStore++;
+      }
+   }
+   return numStore >= ManyStore * inLoop->getNumBlocks();
+}
+
+void StoreVAtool::propSig(BasicBlock *parent, BasicBlock *BB) {
+   if (loopBlocks.count(parent)) loopBlocks.insert(BB);
+}
+
+//V fits into the 64-bit signature
+bool StoreVAtool::canSign(Type *ty) {
+   if (!stSig) return false;
+   if (ty->isPointerTy() || ty->isFloatTy() || ty->isDoubleTy()) return true;
+   return (ty->isIntegerTy() && ty->getIntegerBitWidth() <= 64);
+}
+
+//v as an integer of the same size
+Value *StoreVAtool::asSigInt(Value *v, Instruction *insertBefore) {
+   LLVMContext &C = insertBefore->getContext();
+   Type *ty = v->getType();
+   if (ty->isPointerTy())
+      return new PtrToIntInst(v, Type::getInt64Ty(C), v->getName()+"_sv", insertBefore);
+   if (ty->isFloatTy())
+      return new BitCastInst(v, Type::getInt32Ty(C), v->getName()+"_sv", insertBefore);
+   if (ty->isDoubleTy())
+      return new BitCastInst(v, Type::getInt64Ty(C), v->getName()+"_sv", insertBefore);
+   return v;
+}
+
+////////////////////////////////////////
+//newOneSigCal()                      //
+//stSig |= zext(V ^ V_r)              //
+////////////////////////////////////////
+int StoreVAtool::newOneSigCal(Value *V, Value *V_r, Instruction *I, const std::string &nametag) {
+   Type *i64 = Type::getInt64Ty(I->getContext());
+   int added = 4;
+   Value *a = asSigInt(V, I);
+   Value *b = asSigInt(V_r, I);
+   if (a != V) added++;
+   if (b != V_r) added++;
+   Instruction *diff = BinaryOperator::CreateXor(a, b, V->getName()+nametag, I);
+   diff = LockIns->lock_inst(diff);
+   Value *wide = diff;
+   if (diff->getType() != i64) {
+      wide = new ZExtInst(diff, i64, "", I);
+      added++;
+   }
+   LoadInst *sig = new LoadInst(stSig, "", I);
+   Instruction *newsig = BinaryOperator::CreateOr(sig, wide, "", I);
+   new StoreInst(newsig, stSig, I);
+
+   localStSigCal++;
+   NumStSigCal++;
+   return added;
+}
+
+////////////////////////////////////////
+//addSigCheckers()                    //
+//stSig == 0 ? rest : error, at the   //
+//top of every exit block             //
+////////////////////////////////////////
+void StoreVAtool::addSigCheckers(BasicBlock *errorBlock, SiteCounters &sites) {
+   if (!stSig) return;
+   Type *i64 = Type::getInt64Ty(myfunc->getContext());
+   new StoreInst(ConstantInt::get(i64, 0), stSig, stSig->getNextNode());
+
+   for (std::set<BasicBlock*>::iterator i = exitBlocks.begin(), e = exitBlocks.end(); i != e; ++i) {
+      BasicBlock *E = *i;
+      BasicBlock *rest = E->splitBasicBlock(E->getFirstInsertionPt(), E->getName()+"_stsig");
+      E->getTerminator()->eraseFromParent();
+      LoadInst *sig = new LoadInst(stSig, "", E);
+      Instruction *ok = new ICmpInst(*E, ICmpInst::ICMP_EQ, sig, ConstantInt::get(i64, 0), "stsig_ok");
+      sites.addSite(BranchInst::Create(rest, errorBlock, ok, E), 0);
+
+      localStSigChecker++;
+      NumStSigChecker++;
+   }
+}
+
+// vim: ts=3 sts=3 sw=3 et
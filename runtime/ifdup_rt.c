@@ -0,0 +1,272 @@
+/////////////////////////////////////////
+//ifdup_rt.c                           //
+/////////////////////////////////////////
+//Runtime of -ifdup-site-counters: one //
+//counter array per thread and module, //
+//merged and dumped at exit.           //
+/////////////////////////////////////////
+//Link the instrumented program with libifdup_rt.a -lpthread. The counts
+//go to $IFDUP_SITE_FILE (default ifdup.sites) and add up over runs.
+//Threads still running at exit are read as they are.
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#define SITE_MAGIC "IFDS"
+#define SITE_VERSION 1
+
+//emitted by SiteCounters, one per instrumented module and pass
+struct ifdup_module {
+   const char *name;
+   uint32_t nsites;
+};
+
+//counters of one module in one thread
+struct site_table {
+   struct ifdup_module *m;
+   uint64_t *counts;
+   struct site_table *next_in_thread;
+   struct site_table *prev_live, *next_live;
+};
+
+//sum of the threads that are gone
+struct site_total {
+   struct ifdup_module *m;
+   uint64_t *counts;
+   int written;
+   struct site_total *next;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static pthread_key_t thread_key;
+static struct site_table *live;
+static struct site_total *totals;
+static int dumped;
+
+static __thread struct ifdup_module *last_module;
+static __thread uint64_t *last_counts;
+static __thread struct site_table *mine;
+
+//////////////////////////////
+//merging                   //
+//////////////////////////////
+static struct site_total *total_of(struct ifdup_module *m) {
+   struct site_total *t;
+   for (t = totals; t; t = t->next)
+      if (t->m == m) return t;
+   t = calloc(1, sizeof(*t));
+   if (!t) abort();
+   t->counts = calloc(m->nsites ? m->nsites : 1, sizeof(uint64_t));
+   if (!t->counts) abort();
+   t->m = m;
+   t->next = totals;
+   totals = t;
+   return t;
+}
+
+static void merge_table(struct site_table *s) {
+   struct site_total *t = total_of(s->m);
+   uint32_t i;
+   for (i = 0; i < s->m->nsites; i++) t->counts[i] += s->counts[i];
+}
+
+static void unlink_live(struct site_table *s) {
+   if (s->prev_live) s->prev_live->next_live = s->next_live;
+   else live = s->next_live;
+   if (s->next_live) s->next_live->prev_live = s->prev_live;
+}
+
+//thread exit: fold its counters into the totals
+static void thread_done(void *p) {
+   struct site_table *s = p, *next;
+   pthread_mutex_lock(&lock);
+   for (; s; s = next) {
+      next = s->next_in_thread;
+      if (!dumped) merge_table(s);
+      unlink_live(s);
+      free(s->counts);
+      free(s);
+   }
+   pthread_mutex_unlock(&lock);
+   mine = NULL;
+   last_module = NULL;
+   last_counts = NULL;
+}
+
+//////////////////////////////
+//dump                      //
+//////////////////////////////
+//the file is small: read it whole, add, write it back
+static int read_all(int fd, char **buf, size_t *len) {
+   struct stat st;
+   ssize_t r;
+   size_t done = 0;
+   if (fstat(fd, &st)) return -1;
+   *len = st.st_size;
+   *buf = malloc(*len ? *len : 1);
+   if (!*buf) return -1;
+   while (done < *len && (r = read(fd, *buf + done, *len - done)) > 0) done += r;
+   *len = done;
+   return 0;
+}
+
+static int write_all(int fd, const void *p, size_t len) {
+   const char *c = p;
+   while (len > 0) {
+      ssize_t r = write(fd, c, len);
+      if (r <= 0) return -1;
+      c += r;
+      len -= r;
+   }
+   return 0;
+}
+
+static struct site_total *find_total(const char *name, uint32_t namelen, uint32_t nsites) {
+   struct site_total *t;
+   for (t = totals; t; t = t->next)
+      if (t->m->nsites == nsites && strlen(t->m->name) == namelen
+            && !memcmp(t->m->name, name, namelen))
+         return t;
+   return NULL;
+}
+
+static void write_record(int fd, const char *name, uint32_t namelen, uint32_t nsites, const uint64_t *counts) {
+   write_all(fd, &namelen, 4);
+   write_all(fd, name, namelen);
+   write_all(fd, &nsites, 4);
+   write_all(fd, counts, 8 * (size_t)nsites);
+}
+
+//modules of the old file come first, added to ours if they match; the
+//ones only we have follow
+static void dump(void) {
+   const char *path = getenv("IFDUP_SITE_FILE");
+   char *old = NULL;
+   size_t oldlen = 0, pos, end;
+   uint32_t version = SITE_VERSION, nmodules = 0, oldmodules = 0, m;
+   struct site_total *t;
+   int fd;
+
+   if (!path || !*path) path = "ifdup.sites";
+   fd = open(path, O_RDWR | O_CREAT, 0644);
+   if (fd < 0) {
+      perror(path);
+      return;
+   }
+   flock(fd, LOCK_EX);
+   if (read_all(fd, &old, &oldlen)) oldlen = 0;
+   if (oldlen < 12 || memcmp(old, SITE_MAGIC, 4) || memcmp(old + 4, &version, 4)) oldlen = 0;
+   else memcpy(&oldmodules, old + 8, 4);
+
+   //keep the whole records of the old file, mark our modules it has
+   for (pos = 12, m = 0; oldlen && m < oldmodules; m++) {
+      uint32_t namelen, nsites;
+      if (pos + 4 > oldlen) break;
+      memcpy(&namelen, old + pos, 4);
+      if (pos + 8 + namelen > oldlen) break;
+      memcpy(&nsites, old + pos + 4 + namelen, 4);
+      if (pos + 8 + namelen + 8 * (size_t)nsites > oldlen) break;
+      pos += 8 + namelen + 8 * (size_t)nsites;
+      nmodules++;
+   }
+   end = pos;
+   oldmodules = nmodules;
+   for (t = totals; t; t = t->next) nmodules++;
+   for (pos = 12; pos < end; ) {
+      uint32_t namelen, nsites;
+      memcpy(&namelen, old + pos, 4);
+      memcpy(&nsites, old + pos + 4 + namelen, 4);
+      if (find_total(old + pos + 4, namelen, nsites)) nmodules--;
+      pos += 8 + namelen + 8 * (size_t)nsites;
+   }
+
+   lseek(fd, 0, SEEK_SET);
+   if (ftruncate(fd, 0)) perror(path);
+   write_all(fd, SITE_MAGIC, 4);
+   write_all(fd, &version, 4);
+   write_all(fd, &nmodules, 4);
+
+   for (pos = 12, m = 0; m < oldmodules; m++) {
+      uint32_t namelen, nsites, i;
+      const char *name;
+      uint64_t *counts;
+      memcpy(&namelen, old + pos, 4);
+      name = old + pos + 4;
+      memcpy(&nsites, old + pos + 4 + namelen, 4);
+      counts = malloc(8 * (size_t)(nsites ? nsites : 1));
+      if (!counts) abort();
+      memcpy(counts, old + pos + 8 + namelen, 8 * (size_t)nsites);
+      pos += 8 + namelen + 8 * (size_t)nsites;
+
+      t = find_total(name, namelen, nsites);
+      if (t) {
+         for (i = 0; i < nsites; i++) counts[i] += t->counts[i];
+         t->written = 1;
+      }
+      write_record(fd, name, namelen, nsites, counts);
+      free(counts);
+   }
+   for (t = totals; t; t = t->next)
+      if (!t->written) write_record(fd, t->m->name, strlen(t->m->name), t->m->nsites, t->counts);
+
+   flock(fd, LOCK_UN);
+   close(fd);
+   free(old);
+}
+
+static void at_exit(void) {
+   struct site_table *s;
+   pthread_mutex_lock(&lock);
+   for (s = live; s; s = s->next_live) merge_table(s);
+   dump();
+   dumped = 1;
+   pthread_mutex_unlock(&lock);
+}
+
+static void init(void) {
+   pthread_key_create(&thread_key, thread_done);
+   atexit(at_exit);
+}
+
+//////////////////////////////
+//__ifdup_thread_sites()    //
+//////////////////////////////
+//Called once per instrumented function call. The common case is the
+//module of the last call in this thread.
+uint64_t *__ifdup_thread_sites(struct ifdup_module *m) {
+   struct site_table *s;
+   if (m == last_module) return last_counts;
+
+   for (s = mine; s; s = s->next_in_thread)
+      if (s->m == m) break;
+   if (!s) {
+      pthread_once(&once, init);
+      s = calloc(1, sizeof(*s));
+      if (!s) abort();
+      s->m = m;
+      s->counts = calloc(m->nsites ? m->nsites : 1, sizeof(uint64_t));
+      if (!s->counts) abort();
+      s->next_in_thread = mine;
+      mine = s;
+      pthread_setspecific(thread_key, mine);
+
+      pthread_mutex_lock(&lock);
+      s->next_live = live;
+      if (live) live->prev_live = s;
+      live = s;
+      pthread_mutex_unlock(&lock);
+   }
+   last_module = m;
+   last_counts = s->counts;
+   return last_counts;
+}
+
+// vim: ts=3 sts=3 sw=3 et
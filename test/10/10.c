@@ -0,0 +1,17 @@
+#include <stdio.h>
+int seed=5;
+static int pick(int a,int unused)
+{
+	return a;
+}
+__attribute__((weak)) int wpick(int a,int unused)
+{
+	return a;
+}
+int main()
+{
+	int x=pick(seed+1,seed*2);
+	int y=wpick(seed+1,seed*2);
+	printf("%d %d\n",x,y);
+	return 0;
+}
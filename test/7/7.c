@@ -0,0 +1,23 @@
+#include <stdio.h>
+#define N 1000
+#define REPEAT 100000
+double a[N],b[N];
+int main()
+{
+	double c=0.999;
+	long sum=0;
+	for(int r=0;r < REPEAT;r++)
+		for(int i=0;i < N;i++)
+		{
+			double x=a[i]+r;
+			x=x*c+1.0;
+			x=x*c-2.0;
+			x=x*c+3.0;
+			x=x*c-4.0;
+			b[i]=x;
+			if(x > 0)
+				sum=sum+i;
+		}
+	printf("%f %ld\n",b[N-1],sum);
+	return 0;
+}
@@ -0,0 +1,18 @@
+#include <stdio.h>
+static _Bool is_even(int x)
+{
+	return x%2==0;
+}
+static char half(char c)
+{
+	return c/2;
+}
+int main()
+{
+	int n=0;
+	for(int i=0;i < 10;i++)
+		if(is_even(i))
+			n=n+half(i);
+	printf("%d\n",n);
+	return 0;
+}
@@ -0,0 +1,14 @@
+#include <stdio.h>
+#include <string.h>
+int seed=5;
+int main()
+{
+	int a[16]={0};
+	char buf[64];
+	int idx[1];
+	idx[0]=(seed*3+1)%16;
+	a[idx[0]]=7;
+	memset(buf+seed*2,0,8);
+	printf("%d %d\n",a[0],buf[10]);
+	return 0;
+}
@@ -0,0 +1,76 @@
+#!/bin/sh
+# Run the README pipeline over test/1 .. test/10 and sum the checks
+# reported by -InsDup. Extra arguments are passed to -InsDup, e.g.
+# -ifdup-private-slots=false to compare the number of store checks.
+# IFDUP_PASS picks another duplication pass, to compare -InsDup with
+# -ParIFDup, -IFInsDup and -FullIFInsDup on the nested ifs, or with
+# -InsDupStld on the stores.
+#
+# IFDUP_RUNS=N also times each hardened program against the same program
+# built without the pass, best of N runs; test/7 is the loop meant for
+# this, the others are too short. IFDUP_LDFLAGS is added to the final
+# link, e.g. the runtime for -ifdup-site-counters.
+#
+# usage: [IFDUP_PASS=-IFInsDup] [IFDUP_RUNS=5] test/bench.sh [build/lib/libIFDup.so] [-ifdup-* options]
+
+LIB=${1:-build/lib/libIFDup.so}
+PASS=${IFDUP_PASS:--InsDup}
+[ $# -gt 0 ] && shift
+DIR=$(dirname "$0")
+OUT=${TMPDIR:-/tmp}/ifdup-bench
+mkdir -p "$OUT"
+
+# best <program>: the shortest of $IFDUP_RUNS runs, in microseconds
+best() {
+   b=
+   i=0
+   while [ $i -lt "$IFDUP_RUNS" ]; do
+      s=$(date +%s%N)
+      "$1" > /dev/null || exit 1
+      e=$(date +%s%N)
+      t=$(( (e - s) / 1000 ))
+      { [ -z "$b" ] || [ $t -lt $b ]; } && b=$t
+      i=$((i + 1))
+   done
+   echo $b
+}
+
+for n in 1 2 3 4 5 6 7 8 9 10; do
+   src=$DIR/$n/$n.c
+   [ -f "$src" ] || continue
+   clang -O0 -c -emit-llvm "$src" -o "$OUT/$n-O0.bc" || exit 1
+   opt -load "$LIB" $PASS -IFDupCost "$@" "$OUT/$n-O0.bc" -o "$OUT/$n-O0-insLock.bc" 2> "$OUT/$n.stat" || exit 1
+   clang -O2 -c -emit-llvm "$OUT/$n-O0-insLock.bc" -o "$OUT/$n-O2-insLock.bc" || exit 1
+   opt -load "$LIB" -Unlock "$OUT/$n-O2-insLock.bc" -o "$OUT/$n-O2-insUnlock.bc" || exit 1
+   clang -O0 "$OUT/$n-O2-insUnlock.bc" $IFDUP_LDFLAGS -o "$OUT/$n-O2-InsUnlock" || exit 1
+
+   awk -v t="$n" '
+      /^LOCAL_REDUND_CHECK/ { sum[$3] += $2 }
+      /^local promoted allocas:/ { promoted += $4 }
+      /^local duplicated private slots:/ { slots += $5 }
+      /^local generated instructions:/ { ins += $4 }
+      /^local generated branch checker BBs:/ { brbb += $6 }
+      /^local generated store checker BBs:/ { stbb += $6 }
+      /^local reloaded stores:/ { reload += $4 }
+      /^local (shortcut replicas|replicated BB):/ { rep += $NF }
+      /^local static size:/ { sb += $4; sa += $6 }
+      /^local estimated dynamic size:/ { db += $5; da += $7 }
+      /^IFDUP_COST_MODULE/ { ci = $11; cb = $12 }
+      END {
+         printf "test/%s: st %d ld %d br %d other %d ins %d promoted %d slots %d brbb %d replicas %d stbb %d reload %d", t,
+            sum["localnumfinalstcheck"], sum["localnumfinalldcheck"],
+            sum["localnumfinalbrcheck"], sum["localnumfinalothercheck"],
+            ins, promoted, slots, brbb, rep, stbb, reload
+         printf " static +%.1f%% dynamic +%.1f%% bfi insts +%.1f%% branches +%.1f%%\n",
+            sb ? 100 * (sa - sb) / sb : 0, db ? 100 * (da - db) / db : 0, ci, cb
+      }' "$OUT/$n.stat"
+
+   if [ -n "$IFDUP_RUNS" ]; then
+      clang -O2 -c -emit-llvm "$OUT/$n-O0.bc" -o "$OUT/$n-O2.bc" || exit 1
+      clang -O0 "$OUT/$n-O2.bc" -o "$OUT/$n-O2" || exit 1
+      plain=$(best "$OUT/$n-O2") || exit 1
+      hard=$(best "$OUT/$n-O2-InsUnlock") || exit 1
+      awk -v t="$n" -v p="$plain" -v h="$hard" 'BEGIN {
+         printf "test/%s: time %d us -> %d us (+%.1f%%)\n", t, p, h, p ? 100 * (h - p) / p : 0 }'
+   fi
+done
@@ -0,0 +1,126 @@
+#!/bin/sh
+# Run the passes over test/1 .. test/10 and check what they leave in the
+# IR and the stats: one line per check, exit status 1 if one fails.
+#
+# usage: test/check.sh [build/lib/libIFDup.so]
+
+LIB=${1:-build/lib/libIFDup.so}
+DIR=$(dirname "$0")
+OUT=${TMPDIR:-/tmp}/ifdup-check
+TESTS="1 2 3 4 5 6 7 8 9 10"
+mkdir -p "$OUT"
+fail=0
+
+# run <name> <opt arguments>: every test into $OUT/<test>-<name>.ll/.stat
+run() {
+   name=$1
+   shift
+   for n in $TESTS; do
+      [ -f "$OUT/$n-O0.bc" ] || clang -O0 -c -emit-llvm "$DIR/$n/$n.c" -o "$OUT/$n-O0.bc" || exit 1
+      opt -load "$LIB" "$@" -S "$OUT/$n-O0.bc" -o "$OUT/$n-$name.ll" 2> "$OUT/$n-$name.stat" || exit 1
+   done
+}
+
+# stat <name> <test> <prefix>: the number after <prefix>, summed over the functions
+stat() {
+   awk -v p="$3" 'index($0, p) == 1 { n += substr($0, length(p) + 1) + 0 } END { print n + 0 }' "$OUT/$2-$1.stat"
+}
+
+# redund <name> <test> <counter>: a LOCAL_REDUND_CHECK counter, summed
+redund() {
+   awk -v c="$3" '$1 == "LOCAL_REDUND_CHECK" && $3 == c { n += $2 } END { print n + 0 }' "$OUT/$2-$1.stat"
+}
+
+# count <name> <test> <regexp>: IR lines matching <regexp>
+count() {
+   grep -c -E "$3" "$OUT/$2-$1.ll"
+}
+
+# check <what> <test arguments>
+check() {
+   what=$1
+   shift
+   if [ "$@" ]; then
+      echo "ok   $what"
+   else
+      echo "FAIL $what ($*)"
+      fail=1
+   fi
+}
+
+# every checking branch is a numbered site, for -ParIFDup each replica
+run insdup -InsDup
+run parifdup -ParIFDup
+run counters -InsDup -ifdup-site-counters
+for n in $TESTS; do
+   check "test/$n -InsDup: one !ifdup.site per check site" \
+      $(count insdup $n '!ifdup.site !') -eq $(stat insdup $n 'local check sites:')
+   check "test/$n -ParIFDup: every replica is a check site" \
+      $(stat parifdup $n 'local check sites:') -eq $(stat parifdup $n 'local replicated BB:')
+   [ $(stat counters $n 'local check sites:') -gt 0 ] &&
+      check "test/$n -ifdup-site-counters: counters fetched" \
+         $(count counters $n 'call .*@__ifdup_thread_sites') -gt 0
+done
+check "test/2 -InsDup: the if is a check site" $(stat insdup 2 'local check sites:') -gt 0
+
+# a reloaded store loads once more and compares its address in the same branch
+run stld -InsDupStld
+for n in $TESTS; do
+   r=$(stat stld $n 'local reloaded stores:')
+   check "test/$n -InsDupStld: one locked load per reloaded store" \
+      $(( $(count stld $n '= call .*@lock\.load\.') - $(count insdup $n '= call .*@lock\.load\.') )) -eq $r
+   [ $r -gt 0 ] &&
+      check "test/$n -InsDupStld: reloads compare their address" \
+         $(count stld $n '= call i1 @lock\.BinaryOp\.and\.') -gt 0
+done
+check "test/7 -InsDupStld: the store to b[i] is reloaded" $(stat stld 7 'local reloaded stores:') -gt 0
+
+# a packed pair is one locked <2 x T> op; every lock.* call unlocks again,
+# which needs distinct lock names for <2 x i32>/<2 x i64> and float/double
+run simd -InsDupSIMD
+for n in $TESTS; do
+   check "test/$n -InsDupSIMD: one locked vector op per packed pair" \
+      $(count simd $n '= call <2 x [a-z0-9]+> @lock\.BinaryOp\.') -eq $(stat simd $n 'local packed pairs:')
+   check "test/$n -InsDupSIMD: no lock function is bitcast" \
+      $(count simd $n 'bitcast .*@lock\.') -eq 0
+   opt -load "$LIB" -Unlock -S "$OUT/$n-simd.ll" -o "$OUT/$n-simd-unlock.ll" 2> /dev/null || exit 1
+   check "test/$n -InsDupSIMD: everything unlocks" \
+      $(count simd-unlock $n '@lock\.') -eq 0
+done
+check "test/7 -InsDupSIMD: the double chain is packed" \
+   $(count simd 7 '= call <2 x double> @lock\.BinaryOp\.') -gt 0
+
+# shadow clones keep their parameter attributes on both halves, none on
+# the {r, r} return, and only callees -InsDup protects are cloned
+run shadow -ShadowCC -InsDup -verify
+run shadowskip -ShadowCC -InsDup -ifdup-skip='^is_even$' -verify
+check "test/8 -ShadowCC: the _Bool helper is cloned" \
+   $(count shadow 8 'define internal .*@is_even\.shadow\(') -gt 0
+check "test/8 -ShadowCC: no return attributes on {r, r}" \
+   $(count shadow 8 '(zeroext|signext) \{') -eq 0
+check "test/8 -ShadowCC: signext on both halves" \
+   $(count shadow 8 '@half\.shadow\(i8 signext [^,]*, i8 signext') -gt 0
+check "test/8 -ShadowCC -ifdup-skip: unprotected callee not cloned" \
+   $(count shadowskip 8 '@is_even\.shadow') -eq 0
+check "test/8 -ShadowCC -ifdup-skip: the others still are" \
+   $(count shadowskip 8 'define internal .*@half\.shadow\(') -gt 0
+
+# addrctl follows values through private slots and into call arguments:
+# seed*3 reaches a[] through idx[0], seed*2 reaches memset
+run addrctl -InsDup -ifdup-addr-ctl
+check "test/9 -ifdup-addr-ctl: both multiplies are duplicated" \
+   $(count addrctl 9 '= call .*@lock\.BinaryOp\.mul\.') -ge 2
+
+# under l1 loop hoisting leaves the checks of every store at the store
+run noscev -InsDup -ifdup-loop-scev=false
+for n in $TESTS; do
+   check "test/$n -ifdup-loop-scev: l1 store checks stay at the stores" \
+      $(redund insdup $n localnumfinalstcheck) -ge $(redund noscev $n localnumfinalstcheck)
+done
+
+# an argument the callee only spills to its .addr slot is not checked,
+# unless a weak body could be replaced by one that uses it
+check "test/10 -InsDup: one unused argument check dropped" \
+   $(redund insdup 10 localnumsummaryskip) -eq 1
+
+exit $fail